@@ -0,0 +1,246 @@
+// Encoder throughput sweep: codec x preset x tune x threads x thread type x size over synthetic
+// content. One JSON object per configuration goes to stdout, progress to stderr.
+//
+//   bench_encoder [--codecs libx264,libx265,mjpeg,mpeg4] [--presets veryfast,medium]
+//                 [--tunes ,zerolatency] [--threads 0,4] [--thread-types frame,slice]
+//                 [--sizes 1280x720,1920x1080,3840x2160] [--frames 300] [--warmup 10]
+//                 [--bitrate-bpp 0.1]
+//
+// An empty list item (as in ",zerolatency") means "leave at the encoder default". Presets and
+// tunes are only swept for libx264/libx265, the other codecs have no such options.
+#include "stream_encoder.h"
+#include "otl_log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace otl;
+
+struct BenchConfig {
+    std::string codec;
+    std::string preset;
+    std::string tune;
+    int threads{0};
+    std::string threadType;
+    int width{0};
+    int height{0};
+};
+
+struct BenchResult {
+    int frames{0};
+    int packets{0};
+    int64_t bytes{0};
+    double seconds{0};
+    std::vector<double> latencyMs;
+    int error{0};
+};
+
+static std::vector<std::string> splitList(const std::string &s) {
+    // empty items are kept, they mean "encoder default"
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (true) {
+        size_t pos = s.find(',', start);
+        out.push_back(s.substr(start, pos == std::string::npos ? std::string::npos : pos - start));
+        if (pos == std::string::npos) break;
+        start = pos + 1;
+    }
+    return out;
+}
+
+// Moving gradient plus per-frame noise: flat frames compress to nothing and would make every
+// encoder look fast.
+static AVFrame *makeFrame(int w, int h, AVPixelFormat fmt, int index, uint32_t &seed) {
+    AVFrame *f = av_frame_alloc();
+    if (!f) return nullptr;
+    f->width = w;
+    f->height = h;
+    f->format = fmt;
+    if (av_frame_get_buffer(f, 32) < 0) {
+        av_frame_free(&f);
+        return nullptr;
+    }
+    for (int y = 0; y < h; ++y) {
+        uint8_t *row = f->data[0] + y * f->linesize[0];
+        for (int x = 0; x < w; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            row[x] = (uint8_t)(((x + index * 4) ^ (y + index * 2)) + ((seed >> 28) & 0x7));
+        }
+    }
+    for (int p = 1; p <= 2; ++p) {
+        for (int y = 0; y < h / 2; ++y) {
+            uint8_t *row = f->data[p] + y * f->linesize[p];
+            for (int x = 0; x < w / 2; ++x) row[x] = (uint8_t)(128 + ((x + y + index * p) & 0x1f) - 16);
+        }
+    }
+    return f;
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t i = (size_t)(p * (v.size() - 1) + 0.5);
+    return v[std::min(i, v.size() - 1)];
+}
+
+static BenchResult runOne(const BenchConfig &cfg, const std::vector<AVFrame*> &content,
+                          int frames, int warmup, double bitrateBpp) {
+    BenchResult r;
+    EncodeParam p;
+    p.codecName = cfg.codec;
+    p.width = cfg.width;
+    p.height = cfg.height;
+    p.timeBase = {1, 30};
+    p.frameRate = {30, 1};
+    p.pixFmt = (AVPixelFormat)content[0]->format;
+    p.gopSize = 60;
+    p.preferHardware = false;
+    p.preset = cfg.preset;
+    p.tune = cfg.tune;
+    p.threadCount = cfg.threads;
+    if (cfg.threadType == "frame") p.threadType = FF_THREAD_FRAME;
+    if (cfg.threadType == "slice") p.threadType = FF_THREAD_SLICE;
+    if (bitrateBpp > 0) p.bitRate = (int64_t)(bitrateBpp * cfg.width * cfg.height * 30);
+
+    auto enc = CreateStreamEncoder(cfg.codec);
+    r.error = enc->init(&p);
+    if (r.error < 0) return r;
+
+    // the same few frames are cycled, nothing is allocated inside the timed loop except by
+    // the encoder itself
+    std::vector<PacketHandle> pkts;
+    pkts.reserve(16);
+    r.latencyMs.reserve(frames);
+    // latency is submit to the packet carrying the same pts, so frames held back by lookahead
+    // and B-frame reordering are counted, not just the time spent inside encode()
+    std::vector<std::chrono::steady_clock::time_point> submitted(warmup + frames);
+    auto collect = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        for (auto &pkt : pkts) {
+            r.packets++;
+            r.bytes += pkt->size;
+            if (pkt->pts >= warmup && pkt->pts < (int64_t)submitted.size()) {
+                r.latencyMs.push_back(std::chrono::duration<double, std::milli>(now - submitted[pkt->pts]).count());
+            }
+        }
+        pkts.clear();
+    };
+    std::chrono::steady_clock::time_point start;
+    for (int i = 0; i < warmup + frames; ++i) {
+        if (i == warmup) {
+            start = std::chrono::steady_clock::now();
+            r.packets = 0;
+            r.bytes = 0;
+        }
+        AVFrame *f = content[i % content.size()];
+        f->pts = i;
+        f->pict_type = AV_PICTURE_TYPE_NONE;
+        submitted[i] = std::chrono::steady_clock::now();
+        int ret = enc->encode(f, pkts);
+        if (ret < 0) {
+            r.error = ret;
+            return r;
+        }
+        collect();
+    }
+    enc->encode(nullptr, pkts);
+    collect();
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.frames = frames;
+    return r;
+}
+
+static void printResult(const BenchConfig &cfg, const BenchResult &r) {
+    printf("{\"codec\":\"%s\",\"preset\":\"%s\",\"tune\":\"%s\",\"threads\":%d,\"thread_type\":\"%s\","
+           "\"width\":%d,\"height\":%d",
+           cfg.codec.c_str(), cfg.preset.c_str(), cfg.tune.c_str(), cfg.threads, cfg.threadType.c_str(),
+           cfg.width, cfg.height);
+    if (r.error < 0) {
+        char err[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(r.error, err, sizeof(err));
+        printf(",\"error\":\"%s\"}\n", err);
+    } else {
+        double fps = r.seconds > 0 ? r.frames / r.seconds : 0;
+        double bpp = r.frames > 0 ? (double)r.bytes * 8 / ((double)cfg.width * cfg.height * r.frames) : 0;
+        printf(",\"frames\":%d,\"packets\":%d,\"fps\":%.2f,\"bpp\":%.5f,\"kbps\":%.1f,"
+               "\"lat_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}}\n",
+               r.frames, r.packets, fps, bpp, r.frames > 0 ? r.bytes * 8.0 * 30 / r.frames / 1000 : 0,
+               percentile(r.latencyMs, 0.5), percentile(r.latencyMs, 0.9),
+               percentile(r.latencyMs, 0.99), percentile(r.latencyMs, 1.0));
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    std::string codecs = "libx264,libx265,mjpeg,mpeg4";
+    std::string presets = "veryfast,medium";
+    std::string tunes = ",zerolatency";
+    std::string threads = "0";
+    std::string threadTypes = "frame,slice";
+    std::string sizes = "1280x720,1920x1080,3840x2160";
+    int frames = 300;
+    int warmup = 10;
+    double bitrateBpp = 0.1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--codecs" && hasValue) codecs = argv[++i];
+        else if (arg == "--presets" && hasValue) presets = argv[++i];
+        else if (arg == "--tunes" && hasValue) tunes = argv[++i];
+        else if (arg == "--threads" && hasValue) threads = argv[++i];
+        else if (arg == "--thread-types" && hasValue) threadTypes = argv[++i];
+        else if (arg == "--sizes" && hasValue) sizes = argv[++i];
+        else if (arg == "--frames" && hasValue) frames = std::max(1, atoi(argv[++i]));
+        else if (arg == "--warmup" && hasValue) warmup = std::max(0, atoi(argv[++i]));
+        else if (arg == "--bitrate-bpp" && hasValue) bitrateBpp = atof(argv[++i]);
+        else {
+            fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    // encoder logs would interleave with the JSON on a shared console
+    av_log_set_level(AV_LOG_ERROR);
+
+    for (auto &size : splitList(sizes)) {
+        int w = 0, h = 0;
+        if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+            fprintf(stderr, "bad size: %s\n", size.c_str());
+            return 1;
+        }
+        for (auto &codec : splitList(codecs)) {
+            bool x26x = codec == "libx264" || codec == "libx265";
+            AVPixelFormat fmt = codec == "mjpeg" ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+            std::vector<AVFrame*> content;
+            uint32_t seed = 1;
+            for (int i = 0; i < 8; ++i) {
+                AVFrame *f = makeFrame(w, h, fmt, i, seed);
+                if (f) content.push_back(f);
+            }
+            if (content.size() != 8) {
+                fprintf(stderr, "out of memory for %dx%d\n", w, h);
+                for (auto f : content) av_frame_free(&f);
+                return 1;
+            }
+
+            for (auto &preset : x26x ? splitList(presets) : std::vector<std::string>{""}) {
+                for (auto &tune : x26x ? splitList(tunes) : std::vector<std::string>{""}) {
+                    for (auto &t : splitList(threads)) {
+                        for (auto &tt : splitList(threadTypes)) {
+                            BenchConfig cfg{codec, preset, tune, atoi(t.c_str()), tt, w, h};
+                            fprintf(stderr, "%s %dx%d preset=%s tune=%s threads=%s type=%s\n",
+                                    codec.c_str(), w, h, preset.c_str(), tune.c_str(), t.c_str(), tt.c_str());
+                            printResult(cfg, runOne(cfg, content, frames, warmup, bitrateBpp));
+                        }
+                    }
+                }
+            }
+            for (auto f : content) av_frame_free(&f);
+        }
+    }
+    return 0;
+}
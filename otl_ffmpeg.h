@@ -19,10 +19,16 @@ extern "C" {
 }
 #endif
 
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <string>
 
 namespace otl {
 
+// 引用计数的 AVPacket：最后一个引用释放时由其 deleter 回收
+using PacketHandle = std::shared_ptr<AVPacket>;
+
 class FfmpegGlobal {
 public:
     FfmpegGlobal() {
@@ -40,6 +46,21 @@ public:
     }
 };
 
+// Muxer for a streaming output url, nullptr if the scheme is none of them (a file name is
+// left to avformat_alloc_output_context2() to guess). udp/tcp carry the raw elementary stream.
+inline const char *outputFormatForUrl(const std::string &url, AVCodecID codecId) {
+    auto startWith = [&url](const char *prefix) { return url.compare(0, strlen(prefix), prefix) == 0; };
+    if (startWith("rtsp://")) return "rtsp";
+    if (startWith("udp://") || startWith("tcp://")) {
+        if (codecId == AV_CODEC_ID_H264) return "h264";
+        if (codecId == AV_CODEC_ID_HEVC) return "hevc";
+        return "rawvideo";
+    }
+    if (startWith("rtp://")) return "rtp";
+    if (startWith("rtmp://")) return "flv";
+    return nullptr;
+}
+
 } // namespace otl
 
 #endif // OTL_FFMPEG_H
@@ -0,0 +1,364 @@
+#include "otl_frame_tensor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OTL_TENSOR_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OTL_TENSOR_NEON 1
+#endif
+
+namespace otl {
+
+namespace {
+
+struct CscCoeffs {
+    float yOffset;
+    float yScale;
+    float rv;   // R += rv * (V - 128)
+    float gu;   // G -= gu * (U - 128)
+    float gv;   // G -= gv * (V - 128)
+    float bu;   // B += bu * (U - 128)
+};
+
+// out = pixel * scale + bias, indexed by R/G/B (not by output order)
+struct ChannelNorm {
+    float scale[3];
+    float bias[3];
+};
+
+CscCoeffs cscCoeffs(bool fullRange, bool bt709) {
+    if (bt709) {
+        if (fullRange) return {0.f, 1.f, 1.5748f, 0.187324f, 0.468124f, 1.8556f};
+        return {16.f, 1.164384f, 1.792741f, 0.213249f, 0.532909f, 2.112402f};
+    }
+    if (fullRange) return {0.f, 1.f, 1.402f, 0.344136f, 0.714136f, 1.772f};
+    return {16.f, 1.164384f, 1.596027f, 0.391762f, 0.812968f, 2.017232f};
+}
+
+inline float clamp255(float v) {
+    return v < 0.f ? 0.f : (v > 255.f ? 255.f : v);
+}
+
+// Colour conversion + normalization for n pixels of one output row.
+void cscRowFloat(const float *y, const float *u, const float *v, int n, const CscCoeffs &c,
+                 const ChannelNorm &norm, float *dstR, float *dstG, float *dstB) {
+    int i = 0;
+#if defined(OTL_TENSOR_SSE2)
+    const __m128 yOff = _mm_set1_ps(c.yOffset), yScale = _mm_set1_ps(c.yScale);
+    const __m128 c128 = _mm_set1_ps(128.f), zero = _mm_setzero_ps(), c255 = _mm_set1_ps(255.f);
+    const __m128 rv = _mm_set1_ps(c.rv), gu = _mm_set1_ps(c.gu), gv = _mm_set1_ps(c.gv), bu = _mm_set1_ps(c.bu);
+    const __m128 sR = _mm_set1_ps(norm.scale[0]), sG = _mm_set1_ps(norm.scale[1]), sB = _mm_set1_ps(norm.scale[2]);
+    const __m128 bR = _mm_set1_ps(norm.bias[0]), bG = _mm_set1_ps(norm.bias[1]), bB = _mm_set1_ps(norm.bias[2]);
+    for (; i + 4 <= n; i += 4) {
+        __m128 yy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(y + i), yOff), yScale);
+        __m128 uu = _mm_sub_ps(_mm_loadu_ps(u + i), c128);
+        __m128 vv = _mm_sub_ps(_mm_loadu_ps(v + i), c128);
+        __m128 r = _mm_add_ps(yy, _mm_mul_ps(rv, vv));
+        __m128 g = _mm_sub_ps(yy, _mm_add_ps(_mm_mul_ps(gu, uu), _mm_mul_ps(gv, vv)));
+        __m128 b = _mm_add_ps(yy, _mm_mul_ps(bu, uu));
+        r = _mm_min_ps(_mm_max_ps(r, zero), c255);
+        g = _mm_min_ps(_mm_max_ps(g, zero), c255);
+        b = _mm_min_ps(_mm_max_ps(b, zero), c255);
+        _mm_storeu_ps(dstR + i, _mm_add_ps(_mm_mul_ps(r, sR), bR));
+        _mm_storeu_ps(dstG + i, _mm_add_ps(_mm_mul_ps(g, sG), bG));
+        _mm_storeu_ps(dstB + i, _mm_add_ps(_mm_mul_ps(b, sB), bB));
+    }
+#elif defined(OTL_TENSOR_NEON)
+    const float32x4_t yOff = vdupq_n_f32(c.yOffset), yScale = vdupq_n_f32(c.yScale);
+    const float32x4_t c128 = vdupq_n_f32(128.f), zero = vdupq_n_f32(0.f), c255 = vdupq_n_f32(255.f);
+    const float32x4_t sR = vdupq_n_f32(norm.scale[0]), sG = vdupq_n_f32(norm.scale[1]), sB = vdupq_n_f32(norm.scale[2]);
+    const float32x4_t bR = vdupq_n_f32(norm.bias[0]), bG = vdupq_n_f32(norm.bias[1]), bB = vdupq_n_f32(norm.bias[2]);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t yy = vmulq_f32(vsubq_f32(vld1q_f32(y + i), yOff), yScale);
+        float32x4_t uu = vsubq_f32(vld1q_f32(u + i), c128);
+        float32x4_t vv = vsubq_f32(vld1q_f32(v + i), c128);
+        float32x4_t r = vmlaq_n_f32(yy, vv, c.rv);
+        float32x4_t g = vmlsq_n_f32(vmlsq_n_f32(yy, uu, c.gu), vv, c.gv);
+        float32x4_t b = vmlaq_n_f32(yy, uu, c.bu);
+        r = vminq_f32(vmaxq_f32(r, zero), c255);
+        g = vminq_f32(vmaxq_f32(g, zero), c255);
+        b = vminq_f32(vmaxq_f32(b, zero), c255);
+        vst1q_f32(dstR + i, vmlaq_f32(bR, r, sR));
+        vst1q_f32(dstG + i, vmlaq_f32(bG, g, sG));
+        vst1q_f32(dstB + i, vmlaq_f32(bB, b, sB));
+    }
+#endif
+    for (; i < n; ++i) {
+        float yy = (y[i] - c.yOffset) * c.yScale;
+        float uu = u[i] - 128.f;
+        float vv = v[i] - 128.f;
+        dstR[i] = clamp255(yy + c.rv * vv) * norm.scale[0] + norm.bias[0];
+        dstG[i] = clamp255(yy - c.gu * uu - c.gv * vv) * norm.scale[1] + norm.bias[1];
+        dstB[i] = clamp255(yy + c.bu * uu) * norm.scale[2] + norm.bias[2];
+    }
+}
+
+void cscRowUint8(const float *y, const float *u, const float *v, int n, const CscCoeffs &c,
+                 uint8_t *dstR, uint8_t *dstG, uint8_t *dstB) {
+    int i = 0;
+#if defined(OTL_TENSOR_SSE2)
+    const __m128 yOff = _mm_set1_ps(c.yOffset), yScale = _mm_set1_ps(c.yScale), c128 = _mm_set1_ps(128.f);
+    const __m128 rv = _mm_set1_ps(c.rv), gu = _mm_set1_ps(c.gu), gv = _mm_set1_ps(c.gv), bu = _mm_set1_ps(c.bu);
+    auto store4 = [](uint8_t *dst, __m128 f) {
+        // round, then saturate int32 -> int16 -> uint8
+        __m128i i32 = _mm_cvtps_epi32(f);
+        __m128i i16 = _mm_packs_epi32(i32, i32);
+        __m128i u8 = _mm_packus_epi16(i16, i16);
+        int32_t packed = _mm_cvtsi128_si32(u8);
+        memcpy(dst, &packed, 4);
+    };
+    for (; i + 4 <= n; i += 4) {
+        __m128 yy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(y + i), yOff), yScale);
+        __m128 uu = _mm_sub_ps(_mm_loadu_ps(u + i), c128);
+        __m128 vv = _mm_sub_ps(_mm_loadu_ps(v + i), c128);
+        store4(dstR + i, _mm_add_ps(yy, _mm_mul_ps(rv, vv)));
+        store4(dstG + i, _mm_sub_ps(yy, _mm_add_ps(_mm_mul_ps(gu, uu), _mm_mul_ps(gv, vv))));
+        store4(dstB + i, _mm_add_ps(yy, _mm_mul_ps(bu, uu)));
+    }
+#elif defined(OTL_TENSOR_NEON)
+    const float32x4_t yOff = vdupq_n_f32(c.yOffset), yScale = vdupq_n_f32(c.yScale);
+    const float32x4_t c128 = vdupq_n_f32(128.f), half = vdupq_n_f32(0.5f);
+    auto store4 = [&](uint8_t *dst, float32x4_t f) {
+        // vcvtq truncates toward zero: add 0.5 and let vqmovun clamp negatives to 0
+        int32x4_t i32 = vcvtq_s32_f32(vaddq_f32(f, half));
+        uint16x4_t u16 = vqmovun_s32(i32);
+        uint8x8_t u8 = vqmovn_u16(vcombine_u16(u16, u16));
+        vst1_lane_u32(reinterpret_cast<uint32_t *>(dst), vreinterpret_u32_u8(u8), 0);
+    };
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t yy = vmulq_f32(vsubq_f32(vld1q_f32(y + i), yOff), yScale);
+        float32x4_t uu = vsubq_f32(vld1q_f32(u + i), c128);
+        float32x4_t vv = vsubq_f32(vld1q_f32(v + i), c128);
+        store4(dstR + i, vmlaq_n_f32(yy, vv, c.rv));
+        store4(dstG + i, vmlsq_n_f32(vmlsq_n_f32(yy, uu, c.gu), vv, c.gv));
+        store4(dstB + i, vmlaq_n_f32(yy, uu, c.bu));
+    }
+#endif
+    for (; i < n; ++i) {
+        float yy = (y[i] - c.yOffset) * c.yScale;
+        float uu = u[i] - 128.f;
+        float vv = v[i] - 128.f;
+        dstR[i] = (uint8_t)lrintf(clamp255(yy + c.rv * vv));
+        dstG[i] = (uint8_t)lrintf(clamp255(yy - c.gu * uu - c.gv * vv));
+        dstB[i] = (uint8_t)lrintf(clamp255(yy + c.bu * uu));
+    }
+}
+
+// Bilinear source coordinate for destination index d (pixel-centre aligned).
+void buildAxis(int dstLen, int srcLen, float scale, std::vector<int> &i0, std::vector<int> &i1,
+               std::vector<float> &w) {
+    i0.resize(dstLen);
+    i1.resize(dstLen);
+    w.resize(dstLen);
+    for (int d = 0; d < dstLen; ++d) {
+        float s = (d + 0.5f) / scale - 0.5f;
+        if (s < 0.f) s = 0.f;
+        int s0 = (int)s;
+        if (s0 > srcLen - 1) s0 = srcLen - 1;
+        i0[d] = s0;
+        i1[d] = std::min(s0 + 1, srcLen - 1);
+        w[d] = s - (float)s0;
+    }
+}
+
+} // namespace
+
+bool FrameTensorConverter::isFormatSupported(AVPixelFormat format) {
+    return format == AV_PIX_FMT_NV12 || format == AV_PIX_FMT_NV21 ||
+           format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+int FrameTensorConverter::init(const TensorParam &param) {
+    if (param.width <= 0 || param.height <= 0) return -1;
+    for (int c = 0; c < 3; ++c) {
+        if (param.std[c] == 0.f) return -1;
+    }
+    mParam = param;
+    mSrcWidth = 0;
+    mSrcHeight = 0;
+    mInited = true;
+    return 0;
+}
+
+size_t FrameTensorConverter::tensorBytes() const {
+    size_t elem = mParam.dataType == TensorDataType::Float32 ? sizeof(float) : sizeof(uint8_t);
+    return (size_t)3 * mParam.width * mParam.height * elem;
+}
+
+void FrameTensorConverter::prepare(int srcWidth, int srcHeight) {
+    if (srcWidth == mSrcWidth && srcHeight == mSrcHeight) return;
+    mSrcWidth = srcWidth;
+    mSrcHeight = srcHeight;
+
+    const int W = mParam.width, H = mParam.height;
+    TensorLayout l;
+    if (mParam.letterbox) {
+        float s = std::min((float)W / srcWidth, (float)H / srcHeight);
+        l.contentWidth = std::max(1, std::min(W, (int)lrintf(srcWidth * s)));
+        l.contentHeight = std::max(1, std::min(H, (int)lrintf(srcHeight * s)));
+        l.padLeft = (W - l.contentWidth) / 2;
+        l.padTop = (H - l.contentHeight) / 2;
+    } else {
+        l.contentWidth = W;
+        l.contentHeight = H;
+    }
+    l.scaleX = (float)l.contentWidth / srcWidth;
+    l.scaleY = (float)l.contentHeight / srcHeight;
+    mLayout = l;
+
+    int chromaW = (srcWidth + 1) / 2, chromaH = (srcHeight + 1) / 2;
+    buildAxis(l.contentWidth, srcWidth, l.scaleX, mLumaX0, mLumaX1, mLumaWx);
+    buildAxis(l.contentWidth, chromaW, l.scaleX * 2.0f, mChromaX0, mChromaX1, mChromaWx);
+    buildAxis(l.contentHeight, srcHeight, l.scaleY, mLumaY0, mLumaY1, mLumaWy);
+    buildAxis(l.contentHeight, chromaH, l.scaleY * 2.0f, mChromaY0, mChromaY1, mChromaWy);
+
+    mRowY.resize(l.contentWidth);
+    mRowU.resize(l.contentWidth);
+    mRowV.resize(l.contentWidth);
+}
+
+void FrameTensorConverter::fillPadding(void *dst) {
+    const int W = mParam.width, H = mParam.height;
+    const TensorLayout &l = mLayout;
+    const int right = W - l.padLeft - l.contentWidth;
+    const int bottom = H - l.padTop - l.contentHeight;
+    if (l.padLeft == 0 && l.padTop == 0 && right == 0 && bottom == 0) return;
+
+    for (int c = 0; c < 3; ++c) {
+        if (mParam.dataType == TensorDataType::Float32) {
+            float *plane = static_cast<float *>(dst) + (size_t)c * W * H;
+            float v = (mParam.padValue - mParam.mean[c]) / mParam.std[c];
+            std::fill(plane, plane + (size_t)l.padTop * W, v);
+            std::fill(plane + (size_t)(l.padTop + l.contentHeight) * W, plane + (size_t)W * H, v);
+            for (int y = l.padTop; y < l.padTop + l.contentHeight; ++y) {
+                float *row = plane + (size_t)y * W;
+                std::fill(row, row + l.padLeft, v);
+                std::fill(row + l.padLeft + l.contentWidth, row + W, v);
+            }
+        } else {
+            uint8_t *plane = static_cast<uint8_t *>(dst) + (size_t)c * W * H;
+            uint8_t v = mParam.padValue;
+            memset(plane, v, (size_t)l.padTop * W);
+            memset(plane + (size_t)(l.padTop + l.contentHeight) * W, v, (size_t)bottom * W);
+            for (int y = l.padTop; y < l.padTop + l.contentHeight; ++y) {
+                uint8_t *row = plane + (size_t)y * W;
+                memset(row, v, l.padLeft);
+                memset(row + l.padLeft + l.contentWidth, v, right);
+            }
+        }
+    }
+}
+
+int FrameTensorConverter::convert(const AVFrame *frame, void *dst) {
+    if (frame == nullptr) return -1;
+    AVPixelFormat format = (AVPixelFormat)frame->format;
+    bool fullRange = frame->color_range == AVCOL_RANGE_JPEG || format == AV_PIX_FMT_YUVJ420P;
+    bool bt709 = frame->colorspace == AVCOL_SPC_BT709;
+    const uint8_t *planes[3] = {frame->data[0], frame->data[1], frame->data[2]};
+    const int linesizes[3] = {frame->linesize[0], frame->linesize[1], frame->linesize[2]};
+    return convert(planes, linesizes, format, frame->width, frame->height, fullRange, bt709, dst);
+}
+
+int FrameTensorConverter::convert(const uint8_t *const planes[3], const int linesizes[3], AVPixelFormat format,
+                                  int srcWidth, int srcHeight, bool fullRange, bool bt709, void *dst) {
+    if (!mInited || dst == nullptr || srcWidth <= 0 || srcHeight <= 0) return -1;
+    if (!isFormatSupported(format)) return AVERROR(ENOSYS);
+
+    prepare(srcWidth, srcHeight);
+    fillPadding(dst);
+
+    const int W = mParam.width, H = mParam.height;
+    const TensorLayout &l = mLayout;
+    const CscCoeffs coeffs = cscCoeffs(fullRange, bt709);
+
+    // Output plane for R, G and B respectively.
+    int planeOf[3] = {0, 1, 2};
+    if (mParam.colorOrder == TensorColorOrder::BGR) {
+        planeOf[0] = 2;
+        planeOf[2] = 0;
+    }
+
+    ChannelNorm norm;
+    for (int rgb = 0; rgb < 3; ++rgb) {
+        int c = planeOf[rgb];
+        norm.scale[rgb] = 1.f / mParam.std[c];
+        norm.bias[rgb] = -mParam.mean[c] / mParam.std[c];
+    }
+
+    const bool semiPlanar = format == AV_PIX_FMT_NV12 || format == AV_PIX_FMT_NV21;
+    const int uOff = format == AV_PIX_FMT_NV21 ? 1 : 0;
+    const int vOff = format == AV_PIX_FMT_NV21 ? 0 : 1;
+
+    const int cw = l.contentWidth;
+    float *rowY = mRowY.data(), *rowU = mRowU.data(), *rowV = mRowV.data();
+    const int *lx0 = mLumaX0.data(), *lx1 = mLumaX1.data();
+    const int *cx0 = mChromaX0.data(), *cx1 = mChromaX1.data();
+    const float *lwx = mLumaWx.data(), *cwx = mChromaWx.data();
+
+    for (int dy = 0; dy < l.contentHeight; ++dy) {
+        // luma: horizontal lerp on both source rows, then vertical lerp
+        const uint8_t *y0 = planes[0] + (size_t)mLumaY0[dy] * linesizes[0];
+        const uint8_t *y1 = planes[0] + (size_t)mLumaY1[dy] * linesizes[0];
+        const float wy = mLumaWy[dy];
+        for (int x = 0; x < cw; ++x) {
+            float a = y0[lx0[x]] + (y0[lx1[x]] - y0[lx0[x]]) * lwx[x];
+            float b = y1[lx0[x]] + (y1[lx1[x]] - y1[lx0[x]]) * lwx[x];
+            rowY[x] = a + (b - a) * wy;
+        }
+
+        const float cwy = mChromaWy[dy];
+        if (semiPlanar) {
+            const uint8_t *c0 = planes[1] + (size_t)mChromaY0[dy] * linesizes[1];
+            const uint8_t *c1 = planes[1] + (size_t)mChromaY1[dy] * linesizes[1];
+            for (int x = 0; x < cw; ++x) {
+                int i0 = cx0[x] * 2, i1 = cx1[x] * 2;
+                float w = cwx[x];
+                float ua = c0[i0 + uOff] + (c0[i1 + uOff] - c0[i0 + uOff]) * w;
+                float ub = c1[i0 + uOff] + (c1[i1 + uOff] - c1[i0 + uOff]) * w;
+                float va = c0[i0 + vOff] + (c0[i1 + vOff] - c0[i0 + vOff]) * w;
+                float vb = c1[i0 + vOff] + (c1[i1 + vOff] - c1[i0 + vOff]) * w;
+                rowU[x] = ua + (ub - ua) * cwy;
+                rowV[x] = va + (vb - va) * cwy;
+            }
+        } else {
+            const uint8_t *u0 = planes[1] + (size_t)mChromaY0[dy] * linesizes[1];
+            const uint8_t *u1 = planes[1] + (size_t)mChromaY1[dy] * linesizes[1];
+            const uint8_t *v0 = planes[2] + (size_t)mChromaY0[dy] * linesizes[2];
+            const uint8_t *v1 = planes[2] + (size_t)mChromaY1[dy] * linesizes[2];
+            for (int x = 0; x < cw; ++x) {
+                int i0 = cx0[x], i1 = cx1[x];
+                float w = cwx[x];
+                float ua = u0[i0] + (u0[i1] - u0[i0]) * w;
+                float ub = u1[i0] + (u1[i1] - u1[i0]) * w;
+                float va = v0[i0] + (v0[i1] - v0[i0]) * w;
+                float vb = v1[i0] + (v1[i1] - v1[i0]) * w;
+                rowU[x] = ua + (ub - ua) * cwy;
+                rowV[x] = va + (vb - va) * cwy;
+            }
+        }
+
+        size_t rowOffset = (size_t)(l.padTop + dy) * W + l.padLeft;
+        if (mParam.dataType == TensorDataType::Float32) {
+            float *base = static_cast<float *>(dst);
+            cscRowFloat(rowY, rowU, rowV, cw, coeffs, norm,
+                        base + (size_t)planeOf[0] * W * H + rowOffset,
+                        base + (size_t)planeOf[1] * W * H + rowOffset,
+                        base + (size_t)planeOf[2] * W * H + rowOffset);
+        } else {
+            uint8_t *base = static_cast<uint8_t *>(dst);
+            cscRowUint8(rowY, rowU, rowV, cw, coeffs,
+                        base + (size_t)planeOf[0] * W * H + rowOffset,
+                        base + (size_t)planeOf[1] * W * H + rowOffset,
+                        base + (size_t)planeOf[2] * W * H + rowOffset);
+        }
+    }
+
+    return 0;
+}
+
+} // namespace otl
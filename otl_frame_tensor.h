@@ -0,0 +1,89 @@
+#ifndef OTL_FRAME_TENSOR_H
+#define OTL_FRAME_TENSOR_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+enum class TensorColorOrder : int8_t {
+    RGB = 0,
+    BGR
+};
+
+enum class TensorDataType : int8_t {
+    Uint8 = 0,
+    Float32
+};
+
+struct TensorParam {
+    int width{0};                   // tensor width (W of NCHW)
+    int height{0};                  // tensor height (H of NCHW)
+    TensorColorOrder colorOrder{TensorColorOrder::RGB};
+    TensorDataType dataType{TensorDataType::Float32};
+    bool letterbox{true};           // keep aspect ratio and pad, otherwise stretch
+    uint8_t padValue{114};          // pad colour in pixel domain, applied to all channels
+    // Float32 only: out = (pixel - mean[c]) / std[c], c in output channel order.
+    float mean[3]{0.f, 0.f, 0.f};
+    float std[3]{1.f, 1.f, 1.f};
+};
+
+// Where the picture landed inside the tensor, needed to map detections back.
+struct TensorLayout {
+    float scaleX{1.f};
+    float scaleY{1.f};
+    int padLeft{0};
+    int padTop{0};
+    int contentWidth{0};
+    int contentHeight{0};
+};
+
+// Converts NV12/NV21/YUV420P/YUVJ420P frames into a planar (CHW) RGB/BGR tensor in one pass:
+// bilinear resize, colour conversion, normalization and letterbox padding are fused per output
+// row, and the colour/normalize stage runs on SSE2 or NEON when available.
+class FrameTensorConverter {
+public:
+    FrameTensorConverter() = default;
+
+    int init(const TensorParam &param);
+
+    // dst must hold tensorBytes() bytes.
+    int convert(const AVFrame *frame, void *dst);
+    int convert(const uint8_t *const planes[3], const int linesizes[3], AVPixelFormat format,
+                int srcWidth, int srcHeight, bool fullRange, bool bt709, void *dst);
+
+    size_t tensorBytes() const;
+    const TensorParam &param() const { return mParam; }
+    const TensorLayout &layout() const { return mLayout; }
+
+    static bool isFormatSupported(AVPixelFormat format);
+
+private:
+    void prepare(int srcWidth, int srcHeight);
+    void fillPadding(void *dst);
+
+    TensorParam mParam;
+    TensorLayout mLayout;
+    bool mInited{false};
+
+    // sampling tables, rebuilt when the source size changes
+    int mSrcWidth{0};
+    int mSrcHeight{0};
+    std::vector<int> mLumaX0, mLumaX1;
+    std::vector<float> mLumaWx;
+    std::vector<int> mChromaX0, mChromaX1;
+    std::vector<float> mChromaWx;
+    std::vector<int> mLumaY0, mLumaY1;
+    std::vector<float> mLumaWy;
+    std::vector<int> mChromaY0, mChromaY1;
+    std::vector<float> mChromaWy;
+
+    // per-row scratch
+    std::vector<float> mRowY, mRowU, mRowV;
+};
+
+} // namespace otl
+
+#endif // OTL_FRAME_TENSOR_H
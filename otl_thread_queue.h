@@ -7,6 +7,7 @@
 #include <queue>
 #include <deque>
 #include <functional>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -389,6 +390,53 @@ namespace otl
         };
     }
 
+    // Bounded single-producer/single-consumer ring without locks: exactly one thread calls
+    // tryPush() and one thread calls tryPop(). Capacity is rounded up to a power of two.
+    template <typename T>
+    class SpscQueue : public NoCopyable
+    {
+    public:
+        explicit SpscQueue(size_t capacity)
+        {
+            size_t n = 2;
+            while (n < capacity) n <<= 1;
+            m_buf.resize(n);
+            m_mask = n - 1;
+        }
+
+        // item is left untouched when the queue is full
+        bool tryPush(T &&item)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) > m_mask) return false;
+            m_buf[head & m_mask] = std::move(item);
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(T &item)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail == m_head.load(std::memory_order_acquire)) return false;
+            item = std::move(m_buf[tail & m_mask]);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t size() const
+        {
+            return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return m_mask + 1; }
+
+    private:
+        std::vector<T> m_buf;
+        size_t m_mask{0};
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+    };
+
     template <typename T>
     class WorkerPool : public NoCopyable
     {
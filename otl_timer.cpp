@@ -303,7 +303,7 @@ namespace otl {
         uint32_t mTotalLayers;
         uint32_t mRecordCount{0};
         int64_t mStatisCount{0};
-        int64_t mStatisUpdateLastTime;
+        int64_t mStatisUpdateLastTime{0};
 
     public:
         StatToolImpl(int range=5):mCurrentIndex(0),mRecordCount(0) {
@@ -367,6 +367,9 @@ namespace otl {
 
             timeDiff = mLayers[newest].timeMsec - mLayers[oldest].timeMsec;
             byteDiff = mLayers[newest].bytes - mLayers[oldest].bytes;
+            if (timeDiff == 0) {
+                return 0.0;
+            }
 
             bps = (double)(byteDiff) * 1000 / (timeDiff);
             return bps;
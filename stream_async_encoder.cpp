@@ -0,0 +1,172 @@
+#include "stream_async_encoder.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace otl {
+
+static const char* TAG = "AsyncStreamEncoder";
+
+AsyncStreamEncoder::AsyncStreamEncoder(std::unique_ptr<StreamEncoder> encoder, const AsyncEncodeParam &param)
+    : mEncoder(std::move(encoder)), mParam(param) {
+    if (mParam.queueSize == 0) mParam.queueSize = 1;
+}
+
+AsyncStreamEncoder::~AsyncStreamEncoder() {
+    stop();
+    avcodec_parameters_free(&mCodecPar);
+}
+
+int AsyncStreamEncoder::init(EncodeParam *params) {
+    if (!mEncoder || mThread) return AVERROR(EINVAL);
+    int ret = mEncoder->init(params);
+    if (ret < 0) return ret;
+
+    // copied once here, the encode thread owns the encoder from now on
+    const AVCodecParameters *par = mEncoder->getCodecParameters();
+    if (par) {
+        mCodecPar = avcodec_parameters_alloc();
+        if (mCodecPar) avcodec_parameters_copy(mCodecPar, par);
+    }
+    mTimeBase = mEncoder->getTimeBase();
+
+    mStopping = false;
+    mThread = new std::thread(&AsyncStreamEncoder::encodeLoop, this);
+    return 0;
+}
+
+int AsyncStreamEncoder::submit(const AVFrame *frame) {
+    if (!frame) return AVERROR(EINVAL);
+    std::unique_lock<std::mutex> lk(mLock);
+    if (mStopping || !mThread) return AVERROR_EOF;
+    mStats.submitted++;
+
+    if (mFrames.size() >= mParam.queueSize) {
+        switch (mParam.policy) {
+            case EncodeOverloadPolicy::Block:
+                mSpaceCond.wait(lk, [this] { return mFrames.size() < mParam.queueSize || mStopping; });
+                if (mStopping) return AVERROR_EOF;
+                break;
+            case EncodeOverloadPolicy::DropNewest:
+                mStats.dropped++;
+                return AVERROR(EAGAIN);
+            case EncodeOverloadPolicy::DropOldest: {
+                Entry old = mFrames.front();
+                mFrames.pop_front();
+                // a keyframe request must survive the frame it was attached to
+                if (old.forceKey) mPendingKey = true;
+                av_frame_free(&old.frame);
+                mStats.dropped++;
+                break;
+            }
+        }
+    }
+
+    AVFrame *ref = av_frame_alloc();
+    if (!ref) return AVERROR(ENOMEM);
+    int ret = av_frame_ref(ref, frame);
+    if (ret < 0) {
+        av_frame_free(&ref);
+        return ret;
+    }
+    mFrames.push_back(Entry{ref, mPendingKey});
+    mPendingKey = false;
+    mStats.queueHighWater = std::max(mStats.queueHighWater, mFrames.size());
+    lk.unlock();
+    mFrameCond.notify_one();
+    return 0;
+}
+
+int AsyncStreamEncoder::requestKeyFrame() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mPendingKey = true;
+    return 0;
+}
+
+bool AsyncStreamEncoder::popPacket(PacketHandle &pkt, int timeoutMs) {
+    pkt.reset();
+    return mPacketQueue.pop(pkt, timeoutMs);
+}
+
+void AsyncStreamEncoder::deliver(std::vector<PacketHandle> &pkts) {
+    for (auto &pkt : pkts) {
+        if (mOnPacket) {
+            mOnPacket(pkt.get());
+        } else {
+            mPacketQueue.push(pkt);
+        }
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    mStats.packets += (int64_t)pkts.size();
+    pkts.clear();
+}
+
+void AsyncStreamEncoder::encodeLoop() {
+    std::vector<PacketHandle> pkts;
+    std::unique_lock<std::mutex> lk(mLock);
+    while (true) {
+        mFrameCond.wait(lk, [this] { return !mFrames.empty() || mStopping; });
+        if (mStopping && (!mDrain || mFrames.empty())) break;
+
+        Entry e = mFrames.front();
+        mFrames.pop_front();
+        lk.unlock();
+        mSpaceCond.notify_one();
+
+        if (e.forceKey) mEncoder->requestKeyFrame();
+        auto t0 = std::chrono::steady_clock::now();
+        int ret = mEncoder->encode(e.frame, pkts);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        av_frame_free(&e.frame);
+        if (ret < 0) OTL_LOGW(TAG, "encode failed: %d", ret);
+        deliver(pkts);
+
+        lk.lock();
+        mStats.encoded++;
+        mEncodeMsTotal += ms;
+    }
+    bool drain = mDrain;
+    lk.unlock();
+
+    if (drain) {
+        mEncoder->encode(nullptr, pkts);
+        deliver(pkts);
+    }
+    mPacketQueue.shutdown();
+}
+
+void AsyncStreamEncoder::shutdown(bool drain) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (!mThread) return;
+        mStopping = true;
+        mDrain = drain;
+    }
+    mFrameCond.notify_all();
+    mSpaceCond.notify_all();
+    mThread->join();
+    delete mThread;
+    mThread = nullptr;
+
+    std::lock_guard<std::mutex> lk(mLock);
+    for (auto &e : mFrames) av_frame_free(&e.frame);
+    mFrames.clear();
+}
+
+int AsyncStreamEncoder::flush() {
+    shutdown(true);
+    return 0;
+}
+
+void AsyncStreamEncoder::stop() {
+    shutdown(false);
+}
+
+AsyncEncodeStats AsyncStreamEncoder::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    AsyncEncodeStats s = mStats;
+    s.avgEncodeMs = mStats.encoded > 0 ? mEncodeMsTotal / mStats.encoded : 0;
+    return s;
+}
+
+} // namespace otl
@@ -0,0 +1,99 @@
+#ifndef STREAM_ASYNC_ENCODER_H
+#define STREAM_ASYNC_ENCODER_H
+
+#include "stream_encoder.h"
+#include "otl_thread_queue.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace otl {
+    // 编码队列满时的处理策略
+    enum class EncodeOverloadPolicy : int8_t {
+        Block = 0,      // submit() 阻塞直到有空位
+        DropNewest,     // 丢弃新提交的帧
+        DropOldest      // 丢弃队列中最旧的帧，保持低延迟（默认）
+    };
+
+    struct AsyncEncodeParam {
+        size_t queueSize{8};
+        EncodeOverloadPolicy policy{EncodeOverloadPolicy::DropOldest};
+    };
+
+    struct AsyncEncodeStats {
+        int64_t submitted{0};
+        int64_t encoded{0};
+        int64_t packets{0};
+        int64_t dropped{0};
+        size_t queueHighWater{0};
+        double avgEncodeMs{0};      // 每帧 send/receive 平均耗时
+    };
+
+    // Runs a StreamEncoder on its own thread. submit() only takes a reference on the frame
+    // (no pixel copy) and returns; the reference is dropped once the frame is encoded or
+    // discarded by the overload policy. Packets arrive on the encode thread through the
+    // callback, or are queued for popPacket() when no callback is set.
+    class AsyncStreamEncoder {
+    public:
+        // pkt 仅在回调期间有效，需要保留时请 av_packet_ref
+        using OnPacketFunc = std::function<void(AVPacket *pkt)>;
+
+        explicit AsyncStreamEncoder(std::unique_ptr<StreamEncoder> encoder,
+                                    const AsyncEncodeParam &param = AsyncEncodeParam());
+        ~AsyncStreamEncoder();
+
+        // Set before init().
+        void setPacketCallback(OnPacketFunc func) { mOnPacket = func; }
+        int init(EncodeParam *params);
+
+        // 0: queued; AVERROR(EAGAIN): dropped (DropNewest); AVERROR_EOF: after flush()/stop().
+        int submit(const AVFrame *frame);
+        // The next submitted frame becomes an IDR, also when frames before it are still queued.
+        int requestKeyFrame();
+
+        // timeoutMs < 0 waits; false on timeout or once stopped and empty.
+        bool popPacket(PacketHandle &pkt, int timeoutMs = -1);
+
+        // Encodes every queued frame, drains the encoder and stops the thread. The encoder
+        // can't take frames afterwards.
+        int flush();
+        // Stops without encoding what is still queued.
+        void stop();
+
+        const AVCodecParameters *getCodecParameters() const { return mCodecPar; }
+        AVRational getTimeBase() const { return mTimeBase; }
+        AsyncEncodeStats stats();
+
+    private:
+        struct Entry {
+            AVFrame *frame;
+            bool forceKey;
+        };
+
+        void encodeLoop();
+        void deliver(std::vector<PacketHandle> &pkts);
+        void shutdown(bool drain);
+
+        std::unique_ptr<StreamEncoder> mEncoder;
+        AsyncEncodeParam mParam;
+        OnPacketFunc mOnPacket;
+        internal::BlockingQueue<PacketHandle> mPacketQueue;
+        AVCodecParameters *mCodecPar{nullptr};
+        AVRational mTimeBase{1, 90000};
+
+        std::thread *mThread{nullptr};
+        std::mutex mLock;
+        std::condition_variable mFrameCond;
+        std::condition_variable mSpaceCond;
+        std::deque<Entry> mFrames;
+        bool mStopping{false};
+        bool mDrain{false};
+        bool mPendingKey{false};
+        double mEncodeMsTotal{0};
+        AsyncEncodeStats mStats;
+    };
+}
+
+#endif //STREAM_ASYNC_ENCODER_H
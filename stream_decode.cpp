@@ -13,6 +13,9 @@ StreamDecoder::StreamDecoder(int id, AVCodecContext *decoder)
 
 StreamDecoder::~StreamDecoder() {
     std::cout << "~StreamDecoder() dtor..." << std::endl;
+    // stop the reading thread before the decoder it calls into goes away
+    mDemuxer.closeStream(false);
+    releaseDecoder();
     av_dict_free(&mOptsDecoder);
 }
 
@@ -70,26 +73,89 @@ void StreamDecoder::onAvformatOpened(AVFormatContext *ifmtCtx) {
         mOnAvformatOpenedFunc(ifmtCtx);
     }
 
+    mOpenedTimeUs = av_gettime_relative();
+    mWaitFirstFrame = true;
+    {
+        std::lock_guard<std::mutex> lk(mStatsLock);
+        mReconnectStats.openCount++;
+    }
+
     if (mExternalDecCtx == nullptr) {
-        if (0 == createVideoDecoder(ifmtCtx)) {
-            printf("create video decoder ok!\n");
+        int videoIndex = getVideoStreamIndex(ifmtCtx);
+#if LIBAVCODEC_VERSION_MAJOR > 56
+        const AVCodecParameters *par = ifmtCtx->streams[videoIndex]->codecpar;
+#else
+        const AVCodecParameters *par = nullptr;
+#endif
+        if (mReuseDecoder && canReuseDecoder(par)) {
+            mTimebase = ifmtCtx->streams[videoIndex]->time_base;
+            avcodec_flush_buffers(mDecCtx);
+            {
+                std::lock_guard<std::mutex> lk(mStatsLock);
+                mReconnectStats.reuseCount++;
+            }
+            printf("id=%d, reuse video decoder after reconnect\n", mId);
+        } else {
+            releaseDecoder();
+            if (0 == createVideoDecoder(ifmtCtx)) {
+                printf("create video decoder ok!\n");
+#if LIBAVCODEC_VERSION_MAJOR > 56
+                mDecoderParams = avcodec_parameters_alloc();
+                if (mDecoderParams) avcodec_parameters_copy(mDecoderParams, par);
+#endif
+            } else {
+                mDemuxer.invalidateProbeCache();
+            }
         }
     }
 
-    if (strcmp(ifmtCtx->iformat->name, "h264") != 0) {
+    // a flushed or new decoder must start from a key frame again
+    mIsWaitingIframe = true;
+    if (ifmtCtx->iformat == nullptr || strcmp(ifmtCtx->iformat->name, "h264") != 0) {
         mIsWaitingIframe = false;
     }
 }
 
 void StreamDecoder::onAvformatClosed() {
     clearPackets();
+    mDownTimeUs = av_gettime_relative();
+    if (!mReuseDecoder) {
+        releaseDecoder();
+    }
+
+    if (mOnAvformatClosedFunc) mOnAvformatClosedFunc();
+}
+
+bool StreamDecoder::canReuseDecoder(const AVCodecParameters *par) const {
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    if (mDecCtx == nullptr || mDecoderParams == nullptr || par == nullptr) return false;
+    if (par->codec_id != mDecoderParams->codec_id ||
+        par->width != mDecoderParams->width ||
+        par->height != mDecoderParams->height ||
+        par->format != mDecoderParams->format) {
+        return false;
+    }
+    // AVCC/HVCC streams decode against extradata, so a changed SPS/PPS needs a new decoder
+    if (par->extradata_size != mDecoderParams->extradata_size) return false;
+    if (par->extradata_size > 0 &&
+        memcmp(par->extradata, mDecoderParams->extradata, par->extradata_size) != 0) {
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void StreamDecoder::releaseDecoder() {
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    avcodec_parameters_free(&mDecoderParams);
+#endif
     if (mDecCtx != nullptr) {
         avcodec_close(mDecCtx);
         avcodec_free_context(&mDecCtx);
         printf("free video decoder context!\n");
     }
-
-    if (mOnAvformatClosedFunc) mOnAvformatClosedFunc();
 }
 
 int StreamDecoder::onReadFrame(AVPacket *pkt) {
@@ -194,6 +260,22 @@ int StreamDecoder::onReadFrame(AVPacket *pkt) {
 
     if (ret > 0) mFrameDecodedNum++;
 
+    if (ret > 0 && mWaitFirstFrame) {
+        mWaitFirstFrame = false;
+        int64_t now = av_gettime_relative();
+        DecoderReconnectStats rs;
+        {
+            std::lock_guard<std::mutex> lk(mStatsLock);
+            mReconnectStats.lastFirstFrameUs = now - mOpenedTimeUs;
+            if (mDownTimeUs > 0) {
+                mReconnectStats.lastOutageUs = now - mDownTimeUs;
+            }
+            rs = mReconnectStats;
+        }
+        printf("id=%d, first frame %.1f ms after open (outage %.1f ms, decoder reused %d/%d)\n", mId,
+               rs.lastFirstFrameUs / 1000.0, rs.lastOutageUs / 1000.0, rs.reuseCount, rs.openCount);
+    }
+
     putPacket(pkt);
 
     if (ret > 0) {
@@ -207,6 +289,10 @@ int StreamDecoder::onReadFrame(AVPacket *pkt) {
             mOnDecodedFrameFunc(pktS, frame);
         }
 
+        if (mEnableTensor) {
+            emitTensor(pktS, frame);
+        }
+
         av_packet_unref(pktS);
         av_freep(&pktS);
     }
@@ -264,6 +350,12 @@ void StreamDecoder::clearPackets() {
 }
 
 int StreamDecoder::getVideoStreamIndex(AVFormatContext *ifmtCtx) {
+    // same pick as the demuxer's stream selection
+    int best = av_find_best_stream(ifmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (best >= 0) {
+        mVideoStreamIndex = best;
+        return mVideoStreamIndex;
+    }
     for (unsigned int i = 0; i < ifmtCtx->nb_streams; i++) {
 #if LIBAVFORMAT_VERSION_MAJOR > 56
         auto codecType = ifmtCtx->streams[i]->codecpar->codec_type;
@@ -335,12 +427,57 @@ int StreamDecoder::createVideoDecoder(AVFormatContext *ifmtCtx) {
     }
 #endif
 
+    decodeThreadsConfigure(mDecCtx, mOptsDecoder, &mThreadInfo);
+
     if ((ret = avcodec_open2(mDecCtx, codec, &mOptsDecoder)) < 0) {
         fprintf(stderr, "Failed to open %s codec\n",
                 av_get_media_type_string(AVMEDIA_TYPE_VIDEO));
         return ret;
     }
 
+    AVRational frameRate = ifmtCtx->streams[videoIndex]->avg_frame_rate;
+    if (frameRate.num <= 0) frameRate = ifmtCtx->streams[videoIndex]->r_frame_rate;
+    decodeThreadsReport(mDecCtx, frameRate, &mThreadInfo);
+    printf("id=%d, decoder threads: mode=%s count=%d, extra latency %d frames (%.1f ms)\n",
+           mId, decodeThreadModeName(mThreadInfo.activeMode), mThreadInfo.threadCount,
+           mThreadInfo.extraLatencyFrames, mThreadInfo.extraLatencyMs);
+
+    return 0;
+}
+
+int StreamDecoder::setTensorOutput(const TensorParam &param) {
+    if (param.width <= 0 || param.height <= 0) {
+        mEnableTensor = false;
+        return 0;
+    }
+
+    int ret = mTensorConverter.init(param);
+    if (ret < 0) {
+        printf("id=%d, invalid tensor output param\n", mId);
+        return ret;
+    }
+
+    mTensorBuffer.resize(mTensorConverter.tensorBytes());
+    mEnableTensor = true;
+    return 0;
+}
+
+int StreamDecoder::emitTensor(const AVPacket *pkt, const AVFrame *frame) {
+    int ret = mTensorConverter.convert(frame, mTensorBuffer.data());
+    if (ret < 0) {
+        printf("id=%d, tensor conversion failed for pix_fmt %d, disable tensor output.\n", mId, frame->format);
+        mEnableTensor = false;
+        return ret;
+    }
+
+    if (mObserver) {
+        mObserver->onDecodedTensor(pkt, frame, mTensorBuffer.data(), mTensorConverter.layout());
+    }
+
+    if (mOnDecodedTensorFunc != nullptr) {
+        mOnDecodedTensorFunc(pkt, frame, mTensorBuffer.data(), mTensorConverter.layout());
+    }
+
     return 0;
 }
 
@@ -351,11 +488,33 @@ int StreamDecoder::setObserver(StreamDecoderEvents *observer) {
 
 int StreamDecoder::openStream(std::string url, bool repeat, AVDictionary *opts) {
     av_dict_copy(&mOptsDecoder, opts, 0);
+    AVDictionaryEntry *e = av_dict_get(mOptsDecoder, "reuse_decoder", nullptr, 0);
+    mReuseDecoder = (e == nullptr || atoi(e->value) != 0);
+    {
+        std::lock_guard<std::mutex> lk(mStatsLock);
+        mReconnectStats = DecoderReconnectStats();
+    }
+    mDownTimeUs = 0;
+    // all streams reach the read-frame callback unless narrowed, "video" keeps the container
+    // from reading what is not decoded
+    AVDictionaryEntry *streams = av_dict_get(mOptsDecoder, "demux_streams", nullptr, 0);
+    mDemuxer.setStreamSelection(StreamDemuxer::parseStreamSelection(streams ? streams->value : "all"));
+    AVDictionaryEntry *probeCache = av_dict_get(mOptsDecoder, "probe_cache", nullptr, 0);
+    mDemuxer.setProbeCacheEnabled(probeCache != nullptr && atoi(probeCache->value) != 0);
+    AVDictionaryEntry *openTimeout = av_dict_get(mOptsDecoder, "open_timeout", nullptr, 0);
+    if (openTimeout != nullptr) mDemuxer.setOpenTimeout(atoi(openTimeout->value));
+    // max latency in ms the jitter buffer may add, 0 (default) reads straight through
+    AVDictionaryEntry *jitter = av_dict_get(mOptsDecoder, "jitter_buffer", nullptr, 0);
+    JitterBufferParam jitterParam;
+    if (jitter != nullptr) jitterParam.maxLatencyUs = atoll(jitter->value) * 1000;
+    mDemuxer.setJitterBuffer(jitterParam.maxLatencyUs > 0 && jitter != nullptr, jitterParam);
     return mDemuxer.openStream(url, this, repeat);
 }
 
 int StreamDecoder::closeStream(bool isWaiting) {
-    return mDemuxer.closeStream(isWaiting);
+    int ret = mDemuxer.closeStream(isWaiting);
+    releaseDecoder();
+    return ret;
 }
 
 AVPacket* StreamDecoder::ffmpegPacketAlloc() {
@@ -368,7 +527,8 @@ AVPacket* StreamDecoder::ffmpegPacketAlloc() {
     return pktNew;
 }
 
-AVCodecContext* StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDictionary **opts) {
+AVCodecContext* StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDictionary **opts,
+                                                   DecodeThreadInfo *threadInfo) {
     const AVCodec *codec = avcodec_find_decoder(codecId);
     if (NULL == codec) {
         printf("can't find code_id %d\n", codecId);
@@ -392,12 +552,19 @@ AVCodecContext* StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDic
     decCtx->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK;
     decCtx->has_b_frames = 0;
 
+    // Threading is opt-in: LOW_DELAY stays unless frame threads are requested.
+    DecodeThreadInfo info;
+    decodeThreadsConfigure(decCtx, opts ? *opts : nullptr, &info);
+
     if (avcodec_open2(decCtx, codec, opts) < 0) {
         std::cout << "Unable to open codec";
         avcodec_free_context(&decCtx);
         return nullptr;
     }
 
+    decodeThreadsReport(decCtx, decCtx->framerate, &info);
+    if (threadInfo) *threadInfo = info;
+
     return decCtx;
 }
 
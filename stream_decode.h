@@ -3,6 +3,8 @@
 #define STREAM_DECODE_H
 
 #include "stream_demuxer.h"
+#include "stream_decode_threads.h"
+#include "otl_frame_tensor.h"
 
 namespace otl {
 
@@ -23,17 +25,28 @@ struct StreamDecoderEvents {
     virtual ~StreamDecoderEvents() {}
     virtual void onDecodedAVFrame(const AVPacket *pkt, const AVFrame *pFrame) = 0;
     virtual void onDecodedSeiInfo(const uint8_t *sei_data, int sei_data_len, uint64_t pts, int64_t pkt_pos) {};
+    virtual void onDecodedTensor(const AVPacket *pkt, const AVFrame *pFrame, const void *tensor, const TensorLayout &layout) {};
     virtual void onStreamEof() {};
 };
 
+// Reconnect bookkeeping; times are monotonic microseconds.
+struct DecoderReconnectStats {
+    int openCount{0};               // successful stream opens, the first one included
+    int reuseCount{0};              // opens that kept the previous decoder (flush instead of re-create)
+    int64_t lastFirstFrameUs{0};    // stream opened -> first decoded frame, last open
+    int64_t lastOutageUs{0};        // stream down -> first decoded frame, last reconnect
+};
+
 class StreamDecoder : public StreamDemuxerEvents {
     StreamDecoderEvents *mObserver;
 
     using OnDecodedFrameCallback = std::function<void(const AVPacket *pkt, const AVFrame *pFrame)>;
     using OnDecodedSeiCallback = std::function<void(const uint8_t *seiData, int seiDataLen, uint64_t pts, int64_t pktPos)>;
     using OnStreamEofCallback = std::function<void()>;
+    using OnDecodedTensorCallback = std::function<void(const AVPacket *pkt, const AVFrame *pFrame, const void *tensor, const TensorLayout &layout)>;
     OnDecodedFrameCallback mOnDecodedFrameFunc;
     OnDecodedSeiCallback mOnDecodedSeiFunc;
+    OnDecodedTensorCallback mOnDecodedTensorFunc;
 
     StreamDemuxer::OnAvformatOpenedFunc mOnAvformatOpenedFunc;
     StreamDemuxer::OnAvformatClosedFunc mOnAvformatClosedFunc;
@@ -51,6 +64,7 @@ protected:
     bool mIsWaitingIframe{true};
     int mId{0};
     AVRational mTimebase;
+    DecodeThreadInfo mThreadInfo;
 
     int createVideoDecoder(AVFormatContext *ifmtCtx);
     int putPacket(AVPacket *pkt);
@@ -60,6 +74,25 @@ protected:
     int getVideoStreamIndex(AVFormatContext *ifmtCtx);
     bool isKeyFrame(AVPacket *pkt);
 
+    // ----- Decoder reuse across reconnects (opts key "reuse_decoder", default 1) -----
+    // The codec context (and HW device / filter graph) survive a stream drop and are only
+    // flushed when codec id, resolution, pixel format and extradata are unchanged.
+    bool mReuseDecoder{true};
+    AVCodecParameters *mDecoderParams{nullptr};
+    bool mWaitFirstFrame{false};
+    int64_t mOpenedTimeUs{0};
+    int64_t mDownTimeUs{0};
+    DecoderReconnectStats mReconnectStats;     // written on the demux thread, guarded by mStatsLock
+    mutable std::mutex mStatsLock;
+    bool canReuseDecoder(const AVCodecParameters *par) const;
+    void releaseDecoder();
+
+    // ----- Fused tensor output (enabled by setTensorOutput) -----
+    FrameTensorConverter mTensorConverter;
+    bool mEnableTensor{false};
+    std::vector<uint8_t> mTensorBuffer;
+    int emitTensor(const AVPacket *pkt, const AVFrame *frame);
+
     // Overload StreamDemuxerEvents Interface.
     virtual void onAvformatOpened(AVFormatContext *ifmtCtx) override;
     virtual void onAvformatClosed() override;
@@ -80,6 +113,14 @@ public:
         mOnDecodedSeiFunc = func;
     }
 
+    // Delivers each decoded (and filtered) frame as a planar RGB/BGR tensor, converted in one
+    // fused pass. Call before openStream(); a zero width/height disables it.
+    int setTensorOutput(const TensorParam &param);
+
+    void setDecodedTensorCallback(OnDecodedTensorCallback func) {
+        mOnDecodedTensorFunc = func;
+    }
+
     void setAvformatOpenedCallback(StreamDemuxer::OnAvformatOpenedFunc func) {
         mOnAvformatOpenedFunc = func;
     }
@@ -96,13 +137,29 @@ public:
         mOnReadEofFunc = func;
     }
 
+    // Input tuning (mmap file input, custom byte sources); applies from the next open.
+    StreamDemuxer &demuxer() { return mDemuxer; }
+
     int openStream(std::string url, bool repeat = true, AVDictionary *opts = nullptr);
     int closeStream(bool isWaiting = true);
     AVCodecID getVideoCodecId();
 
+    // Threading actually in use by the current decoder and the latency it adds.
+    const DecodeThreadInfo &getDecodeThreadInfo() const { return mThreadInfo; }
+
+    // Open/reconnect counters and time-to-first-frame.
+    DecoderReconnectStats getReconnectStats() const {
+        std::lock_guard<std::mutex> lk(mStatsLock);
+        return mReconnectStats;
+    }
+
+    // Time base of decoded frame pts, valid once the stream is open.
+    AVRational getTimeBase() const { return mTimebase; }
+
     // External utilities
     static AVPacket* ffmpegPacketAlloc();
-    static AVCodecContext* ffmpegCreateDecoder(enum AVCodecID id, AVDictionary **opts = nullptr);
+    static AVCodecContext* ffmpegCreateDecoder(enum AVCodecID id, AVDictionary **opts = nullptr,
+                                               DecodeThreadInfo *threadInfo = nullptr);
 };
 
 } // namespace otl
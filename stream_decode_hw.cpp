@@ -88,24 +88,15 @@ StreamDecoder::~StreamDecoder()
 {
     std::cout << "~StreamDecoder() dtor..." << std::endl;
 
-    // release filter graph resources
-    if (mFilterGraph) {
-        avfilter_graph_free(&mFilterGraph);
-        mFilterGraph = nullptr;
-        mBuffersrcCtx = nullptr;
-        mBuffersinkCtx = nullptr;
-        mFilterInited = false;
-        mEnableFilter = false;
-        mFilterDesc.clear();
-    }
+    // stop the reading thread before the decoder it calls into goes away
+    mDemuxer.closeStream(false);
 
-    // 释放硬件设备上下文
-    if (mHWDeviceCtx)
-    {
-        av_buffer_unref(&mHWDeviceCtx);
-        mHWDeviceCtx = nullptr;
-    }
+    // release decoder, filter graph and hw device resources
+    releaseDecoder();
+    mEnableFilter = false;
+    mFilterDesc.clear();
 
+    av_frame_free(&mTensorSwFrame);
     av_dict_free(&mOptsDecoder);
 }
 
@@ -226,15 +217,53 @@ void StreamDecoder::onAvformatOpened(AVFormatContext *ifmtCtx)
         mOnAvformatOpenedFunc(ifmtCtx);
     }
 
+    mOpenedTimeUs = av_gettime_relative();
+    mWaitFirstFrame = true;
+    {
+        std::lock_guard<std::mutex> lk(mStatsLock);
+        mReconnectStats.openCount++;
+    }
+
     if (mExternalDecCtx == nullptr)
     {
-        if (0 == createVideoDecoder(ifmtCtx))
+        int videoIndex = getVideoStreamIndex(ifmtCtx);
+#if LIBAVCODEC_VERSION_MAJOR > 56
+        const AVCodecParameters *par = ifmtCtx->streams[videoIndex]->codecpar;
+#else
+        const AVCodecParameters *par = nullptr;
+#endif
+        if (mReuseDecoder && canReuseDecoder(par))
         {
-            printf("create video decoder ok!\n");
+            // keep codec context, hw device and filter graph; only drop queued state
+            mTimebase = ifmtCtx->streams[videoIndex]->time_base;
+            avcodec_flush_buffers(mDecCtx);
+            {
+                std::lock_guard<std::mutex> lk(mStatsLock);
+                mReconnectStats.reuseCount++;
+            }
+            printf("id=%d, reuse video decoder after reconnect\n", mId);
+        }
+        else
+        {
+            releaseDecoder();
+            if (0 == createVideoDecoder(ifmtCtx))
+            {
+                printf("create video decoder ok!\n");
+#if LIBAVCODEC_VERSION_MAJOR > 56
+                mDecoderParams = avcodec_parameters_alloc();
+                if (mDecoderParams) avcodec_parameters_copy(mDecoderParams, par);
+#endif
+            }
+            else
+            {
+                mDemuxer.invalidateProbeCache();
+            }
         }
     }
 
-    if (strcmp(ifmtCtx->iformat->name, "h264") != 0)
+    // a flushed or new decoder must start from a key frame again
+    mIsWaitingIframe = true;
+    if (ifmtCtx->iformat == nullptr || strcmp(ifmtCtx->iformat->name, "h264") != 0)
     {
         mIsWaitingIframe = false;
     }
@@ -244,14 +273,52 @@ void StreamDecoder::onAvformatClosed()
 {
     clearPackets();
     std::cout << __FUNCTION__ << ":" << __LINE__ << std::endl;
+    mDownTimeUs = av_gettime_relative();
+    if (!mReuseDecoder)
+    {
+        releaseDecoder();
+    }
+
+    if (mOnAvformatClosedFunc)
+        mOnAvformatClosedFunc();
+}
+
+bool StreamDecoder::canReuseDecoder(const AVCodecParameters *par) const
+{
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    if (mDecCtx == nullptr || mDecoderParams == nullptr || par == nullptr) return false;
+    if (par->codec_id != mDecoderParams->codec_id ||
+        par->width != mDecoderParams->width ||
+        par->height != mDecoderParams->height ||
+        par->format != mDecoderParams->format)
+    {
+        return false;
+    }
+    // AVCC/HVCC streams decode against extradata, so a changed SPS/PPS needs a new decoder
+    if (par->extradata_size != mDecoderParams->extradata_size) return false;
+    if (par->extradata_size > 0 &&
+        memcmp(par->extradata, mDecoderParams->extradata, par->extradata_size) != 0)
+    {
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void StreamDecoder::releaseDecoder()
+{
     // free filter graph
     if (mFilterGraph) {
         avfilter_graph_free(&mFilterGraph);
         mFilterGraph = nullptr;
         mBuffersrcCtx = nullptr;
         mBuffersinkCtx = nullptr;
-        mFilterInited = false;
     }
+    mFilterInited = false;
+    mFilterHwFrames = nullptr;
+
     // 释放硬件设备上下文
     if (mHWDeviceCtx)
     {
@@ -259,15 +326,15 @@ void StreamDecoder::onAvformatClosed()
         mHWDeviceCtx = nullptr;
     }
 
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    avcodec_parameters_free(&mDecoderParams);
+#endif
     if (mDecCtx != nullptr)
     {
         avcodec_close(mDecCtx);
         avcodec_free_context(&mDecCtx);
         printf("free video decoder context!\n");
     }
-
-    if (mOnAvformatClosedFunc)
-        mOnAvformatClosedFunc();
 }
 
 int StreamDecoder::onReadFrame(AVPacket *pkt)
@@ -351,6 +418,24 @@ int StreamDecoder::onReadFrame(AVPacket *pkt)
     if (ret > 0)
         mFrameDecodedNum++;
 
+    if (ret > 0 && mWaitFirstFrame)
+    {
+        mWaitFirstFrame = false;
+        int64_t now = av_gettime_relative();
+        DecoderReconnectStats rs;
+        {
+            std::lock_guard<std::mutex> lk(mStatsLock);
+            mReconnectStats.lastFirstFrameUs = now - mOpenedTimeUs;
+            if (mDownTimeUs > 0)
+            {
+                mReconnectStats.lastOutageUs = now - mDownTimeUs;
+            }
+            rs = mReconnectStats;
+        }
+        printf("id=%d, first frame %.1f ms after open (outage %.1f ms, decoder reused %d/%d)\n", mId,
+               rs.lastFirstFrameUs / 1000.0, rs.lastOutageUs / 1000.0, rs.reuseCount, rs.openCount);
+    }
+
     putPacket(pkt);
 
     if (ret > 0)
@@ -358,10 +443,20 @@ int StreamDecoder::onReadFrame(AVPacket *pkt)
         auto pktS = getPacket();
         AVFrame *outFrame = frame;
 
+        // A reused decoder may hand out surfaces from a new hw_frames_ctx after reconnect;
+        // the graph was configured against the old one, so rebuild it.
+        if (mFilterInited && frame->hw_frames_ctx && frame->hw_frames_ctx->data != mFilterHwFrames) {
+            avfilter_graph_free(&mFilterGraph);
+            mBuffersrcCtx = nullptr;
+            mBuffersinkCtx = nullptr;
+            mFilterInited = false;
+        }
+
         // Lazy init filter graph when first frame arrives
         if (mEnableFilter && !mFilterInited) {
             if (initFilterGraphWithFrame(mExternalDecCtx != nullptr ? mExternalDecCtx : mDecCtx, frame) == 0) {
                 mFilterInited = true;
+                mFilterHwFrames = frame->hw_frames_ctx ? frame->hw_frames_ctx->data : nullptr;
             } else {
                 fprintf(stderr, "initFilterGraphWithFrame failed, disable filtering.\n");
                 mEnableFilter = false;
@@ -390,6 +485,11 @@ int StreamDecoder::onReadFrame(AVPacket *pkt)
             mOnDecodedFrameFunc(pktS, outFrame);
         }
 
+        if (mEnableTensor)
+        {
+            emitTensor(pktS, outFrame);
+        }
+
         av_packet_unref(pktS);
         av_freep(&pktS);
 
@@ -461,6 +561,13 @@ void StreamDecoder::clearPackets()
 
 int StreamDecoder::getVideoStreamIndex(AVFormatContext *ifmtCtx)
 {
+    // same pick as the demuxer's stream selection
+    int best = av_find_best_stream(ifmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (best >= 0)
+    {
+        mVideoStreamIndex = best;
+        return mVideoStreamIndex;
+    }
     for (unsigned int i = 0; i < ifmtCtx->nb_streams; i++)
     {
 #if LIBAVFORMAT_VERSION_MAJOR > 56
@@ -657,12 +764,85 @@ int StreamDecoder::createVideoDecoder(AVFormatContext *ifmtCtx)
         mDecCtx->pix_fmt = AV_PIX_FMT_BGR24;
     }
 
+    // Only matters for the software fallback; HW decoders report a single thread.
+    decodeThreadsConfigure(mDecCtx, mOptsDecoder, &mThreadInfo);
+
     if ((ret = avcodec_open2(mDecCtx, codec, &mOptsDecoder)) < 0)
     {
         fprintf(stderr, "Failed to open %s codec\n", av_get_media_type_string(AVMEDIA_TYPE_VIDEO));
         return ret;
     }
 
+    AVRational frameRate = ifmtCtx->streams[videoIndex]->avg_frame_rate;
+    if (frameRate.num <= 0) frameRate = ifmtCtx->streams[videoIndex]->r_frame_rate;
+    decodeThreadsReport(mDecCtx, frameRate, &mThreadInfo);
+    printf("id=%d, decoder threads: mode=%s count=%d, extra latency %d frames (%.1f ms)\n",
+           mId, decodeThreadModeName(mThreadInfo.activeMode), mThreadInfo.threadCount,
+           mThreadInfo.extraLatencyFrames, mThreadInfo.extraLatencyMs);
+
+    return 0;
+}
+
+int StreamDecoder::setTensorOutput(const TensorParam &param)
+{
+    if (param.width <= 0 || param.height <= 0)
+    {
+        mEnableTensor = false;
+        return 0;
+    }
+
+    int ret = mTensorConverter.init(param);
+    if (ret < 0)
+    {
+        printf("id=%d, invalid tensor output param\n", mId);
+        return ret;
+    }
+
+    mTensorBuffer.resize(mTensorConverter.tensorBytes());
+    mEnableTensor = true;
+    return 0;
+}
+
+int StreamDecoder::emitTensor(const AVPacket *pkt, const AVFrame *frame)
+{
+    const AVFrame *src = frame;
+    // HW surfaces are downloaded once; the fused pass then reads system memory directly.
+    if (frame->hw_frames_ctx)
+    {
+        if (mTensorSwFrame == nullptr)
+        {
+            mTensorSwFrame = av_frame_alloc();
+            if (mTensorSwFrame == nullptr) return AVERROR(ENOMEM);
+        }
+        av_frame_unref(mTensorSwFrame);
+        int ret = av_hwframe_transfer_data(mTensorSwFrame, frame, 0);
+        if (ret < 0)
+        {
+            print_ffmpeg_error(ret);
+            return ret;
+        }
+        av_frame_copy_props(mTensorSwFrame, frame);
+        src = mTensorSwFrame;
+    }
+
+    int ret = mTensorConverter.convert(src, mTensorBuffer.data());
+    if (ret < 0)
+    {
+        printf("id=%d, tensor conversion failed for pix_fmt %d, disable tensor output.\n", mId, src->format);
+        mEnableTensor = false;
+        return ret;
+    }
+
+    if (mObserver)
+    {
+        mObserver->onDecodedTensor(pkt, frame, mTensorBuffer.data(), mTensorConverter.layout());
+    }
+
+    if (mOnDecodedTensorFunc != nullptr)
+    {
+        mOnDecodedTensorFunc(pkt, frame, mTensorBuffer.data(), mTensorConverter.layout());
+    }
+
     return 0;
 }
 
@@ -675,6 +855,26 @@ int StreamDecoder::setObserver(StreamDecoderEvents *observer)
 int StreamDecoder::openStream(std::string url, bool repeat, AVDictionary *opts)
 {
     av_dict_copy(&mOptsDecoder, opts, 0);
+    AVDictionaryEntry *reuse = av_dict_get(mOptsDecoder, "reuse_decoder", nullptr, 0);
+    mReuseDecoder = (reuse == nullptr || atoi(reuse->value) != 0);
+    {
+        std::lock_guard<std::mutex> lk(mStatsLock);
+        mReconnectStats = DecoderReconnectStats();
+    }
+    mDownTimeUs = 0;
+    // all streams reach the read-frame callback unless narrowed, "video" keeps the container
+    // from reading what is not decoded
+    AVDictionaryEntry *streams = av_dict_get(mOptsDecoder, "demux_streams", nullptr, 0);
+    mDemuxer.setStreamSelection(StreamDemuxer::parseStreamSelection(streams ? streams->value : "all"));
+    AVDictionaryEntry *probeCache = av_dict_get(mOptsDecoder, "probe_cache", nullptr, 0);
+    mDemuxer.setProbeCacheEnabled(probeCache != nullptr && atoi(probeCache->value) != 0);
+    AVDictionaryEntry *openTimeout = av_dict_get(mOptsDecoder, "open_timeout", nullptr, 0);
+    if (openTimeout != nullptr) mDemuxer.setOpenTimeout(atoi(openTimeout->value));
+    // max latency in ms the jitter buffer may add, 0 (default) reads straight through
+    AVDictionaryEntry *jitter = av_dict_get(mOptsDecoder, "jitter_buffer", nullptr, 0);
+    JitterBufferParam jitterParam;
+    if (jitter != nullptr) jitterParam.maxLatencyUs = atoll(jitter->value) * 1000;
+    mDemuxer.setJitterBuffer(jitterParam.maxLatencyUs > 0 && jitter != nullptr, jitterParam);
     // parse filter string from opts without changing external interface
     AVDictionaryEntry *e = av_dict_get(mOptsDecoder, "filter", nullptr, 0);
     if (!e) e = av_dict_get(mOptsDecoder, "vf", nullptr, 0);
@@ -706,7 +906,9 @@ int StreamDecoder::openStream(std::string url, bool repeat, AVDictionary *opts)
 
 int StreamDecoder::closeStream(bool isWaiting)
 {
-    return mDemuxer.closeStream(isWaiting);
+    int ret = mDemuxer.closeStream(isWaiting);
+    releaseDecoder();
+    return ret;
 }
 
 AVPacket *StreamDecoder::ffmpegPacketAlloc()
@@ -720,7 +922,8 @@ AVPacket *StreamDecoder::ffmpegPacketAlloc()
     return pktNew;
 }
 
-AVCodecContext *StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDictionary **opts)
+AVCodecContext *StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDictionary **opts,
+                                                   DecodeThreadInfo *threadInfo)
 {
     const AVCodec *codec = avcodec_find_decoder(codecId);
     if (NULL == codec)
@@ -748,6 +951,10 @@ AVCodecContext *StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDic
     decCtx->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK;
     decCtx->has_b_frames = 0;
 
+    // Threading is opt-in: LOW_DELAY stays unless frame threads are requested.
+    DecodeThreadInfo info;
+    decodeThreadsConfigure(decCtx, opts ? *opts : nullptr, &info);
+
     if (avcodec_open2(decCtx, codec, opts) < 0)
     {
         std::cout << "Unable to open codec";
@@ -755,6 +962,9 @@ AVCodecContext *StreamDecoder::ffmpegCreateDecoder(enum AVCodecID codecId, AVDic
         return nullptr;
     }
 
+    decodeThreadsReport(decCtx, decCtx->framerate, &info);
+    if (threadInfo) *threadInfo = info;
+
     return decCtx;
 }
 
@@ -0,0 +1,109 @@
+#include "stream_decode_threads.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace otl {
+
+// Default worker count when "dec_threads" is 0: enough to reach real time on 4K
+// without letting one channel grab every core on a many-channel box.
+static const int kDefaultDecodeThreads = 4;
+
+static DecodeThreadMode parseThreadMode(const char *s) {
+    if (s == nullptr) return DecodeThreadMode::None;
+    if (strcmp(s, "slice") == 0) return DecodeThreadMode::Slice;
+    if (strcmp(s, "frame") == 0) return DecodeThreadMode::Frame;
+    if (strcmp(s, "auto") == 0) return DecodeThreadMode::Auto;
+    return DecodeThreadMode::None;
+}
+
+static DecodeThreadMode resolveAutoMode(int width, int height) {
+    int64_t pixels = (int64_t)width * height;
+    if (pixels <= 0) {
+        // resolution unknown: slice threads never add latency
+        return DecodeThreadMode::Slice;
+    }
+    if (pixels < 1280 * 720) return DecodeThreadMode::None;
+    if (pixels <= 2560 * 1440) return DecodeThreadMode::Slice;
+    return DecodeThreadMode::Frame;
+}
+
+const char *decodeThreadModeName(DecodeThreadMode mode) {
+    switch (mode) {
+        case DecodeThreadMode::Slice: return "slice";
+        case DecodeThreadMode::Frame: return "frame";
+        case DecodeThreadMode::Auto:  return "auto";
+        default:                      return "none";
+    }
+}
+
+int decodeThreadsConfigure(AVCodecContext *decCtx, const AVDictionary *opts, DecodeThreadInfo *info) {
+    if (decCtx == nullptr) return -1;
+
+    AVDictionaryEntry *e = av_dict_get(opts, "dec_thread_mode", nullptr, 0);
+    DecodeThreadMode requested = parseThreadMode(e ? e->value : nullptr);
+
+    int threads = 0;
+    e = av_dict_get(opts, "dec_threads", nullptr, 0);
+    if (e && e->value) threads = atoi(e->value);
+
+    DecodeThreadMode mode = requested;
+    if (mode == DecodeThreadMode::Auto) {
+        mode = resolveAutoMode(decCtx->width, decCtx->height);
+    }
+
+    if (threads <= 0) {
+        int cpus = (int)std::thread::hardware_concurrency();
+        threads = std::max(1, std::min(kDefaultDecodeThreads, cpus));
+    }
+
+    switch (mode) {
+        case DecodeThreadMode::Frame:
+            decCtx->thread_type = FF_THREAD_FRAME;
+            decCtx->thread_count = threads;
+            decCtx->flags &= ~AV_CODEC_FLAG_LOW_DELAY;
+            break;
+        case DecodeThreadMode::Slice:
+            decCtx->thread_type = FF_THREAD_SLICE;
+            decCtx->thread_count = threads;
+            break;
+        default:
+            decCtx->thread_count = 1;
+            break;
+    }
+
+    if (info) {
+        *info = DecodeThreadInfo();
+        info->requestedMode = requested;
+        info->activeMode = mode;
+        info->threadCount = decCtx->thread_count;
+    }
+
+    return 0;
+}
+
+void decodeThreadsReport(const AVCodecContext *decCtx, AVRational frameRate, DecodeThreadInfo *info) {
+    if (decCtx == nullptr || info == nullptr) return;
+
+    // libavcodec silently falls back when the codec lacks the capability,
+    // so trust active_thread_type rather than what was requested.
+    info->threadCount = decCtx->thread_count > 0 ? decCtx->thread_count : 1;
+    if (info->threadCount > 1 && (decCtx->active_thread_type & FF_THREAD_FRAME)) {
+        info->activeMode = DecodeThreadMode::Frame;
+        info->extraLatencyFrames = info->threadCount - 1;
+    } else if (info->threadCount > 1 && (decCtx->active_thread_type & FF_THREAD_SLICE)) {
+        info->activeMode = DecodeThreadMode::Slice;
+        info->extraLatencyFrames = 0;
+    } else {
+        info->activeMode = DecodeThreadMode::None;
+        info->extraLatencyFrames = 0;
+    }
+
+    info->extraLatencyMs = 0.0;
+    if (frameRate.num > 0 && frameRate.den > 0) {
+        info->extraLatencyMs = info->extraLatencyFrames * 1000.0 / av_q2d(frameRate);
+    }
+}
+
+} // namespace otl
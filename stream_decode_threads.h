@@ -0,0 +1,40 @@
+#ifndef STREAM_DECODE_THREADS_H
+#define STREAM_DECODE_THREADS_H
+
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+// Software decoder threading, selected through the decoder opts dictionary:
+//   "dec_thread_mode" : none | slice | frame | auto  (default: none)
+//   "dec_threads"     : worker thread count, 0 = let the mode decide (default: 0)
+// auto picks by resolution: below 720p single thread, up to 1440p slice threads,
+// above that frame threads (throughput first, e.g. 4K H.265).
+enum class DecodeThreadMode : int8_t {
+    None = 0,
+    Slice,
+    Frame,
+    Auto
+};
+
+struct DecodeThreadInfo {
+    DecodeThreadMode requestedMode{DecodeThreadMode::None};
+    DecodeThreadMode activeMode{DecodeThreadMode::None}; // what libavcodec actually enabled
+    int threadCount{1};
+    int extraLatencyFrames{0};   // frame threading holds (threads - 1) frames in flight
+    double extraLatencyMs{0.0};  // extraLatencyFrames converted with the stream frame rate, 0 if unknown
+};
+
+const char *decodeThreadModeName(DecodeThreadMode mode);
+
+// Call before avcodec_open2(). Reads the keys above from opts (they are left in the dictionary),
+// resolves auto against decCtx->width/height and sets thread_count/thread_type.
+// Frame threading also clears AV_CODEC_FLAG_LOW_DELAY, which would otherwise disable it.
+int decodeThreadsConfigure(AVCodecContext *decCtx, const AVDictionary *opts, DecodeThreadInfo *info);
+
+// Call after avcodec_open2() to fill in the active mode and the latency it adds.
+void decodeThreadsReport(const AVCodecContext *decCtx, AVRational frameRate, DecodeThreadInfo *info);
+
+} // namespace otl
+
+#endif // STREAM_DECODE_THREADS_H
@@ -1,20 +1,438 @@
 #include "stream_demuxer.h"
 
+#include <algorithm>
+#include <random>
+#include <set>
+#include "otl_log.h"
+
 namespace otl {
 
+// a timestamp jump larger than this restarts the pacing schedule instead of sleeping it out
+static const int64_t kPaceMaxJumpUs = 1000000;
+// a consumer that held the reader back this long is not compensated with a burst
+static const int64_t kPaceMaxLagUs = 500000;
+// the final stretch before a deadline is spun, sleeps are not precise below this
+static const int64_t kPaceSpinUs = 200;
+// retry delay after a failed open doubles from min to max, half of it randomized so a batch of
+// cameras that dropped together does not reconnect in lockstep
+static const int64_t kOpenBackoffMinUs = 500000;
+static const int64_t kOpenBackoffMaxUs = 30000000;
+
+// Counting semaphore bounding concurrent opens: one process wide (setOpenConcurrency), plus
+// one per openStreams() batch.
+struct OpenGate {
+    std::mutex lock;
+    std::condition_variable cond;
+    int limit{0};
+    int active{0};
+};
+
+static OpenGate &openGate() {
+    static OpenGate gate;
+    return gate;
+}
+
+static bool acquireOpenSlot(OpenGate &gate, const std::atomic<bool> &abort) {
+    std::unique_lock<std::mutex> lk(gate.lock);
+    while (gate.limit > 0 && gate.active >= gate.limit) {
+        if (abort) return false;
+        gate.cond.wait_for(lk, std::chrono::milliseconds(100));
+    }
+    gate.active++;
+    return true;
+}
+
+// a read error streak this long means the session is dead, reconnect instead of retrying
+static const int kMaxReadErrors = 50;
+static const unsigned kReadErrorBackoffUs = 10000;
+
+struct DemuxerRegistry {
+    std::mutex lock;
+    std::set<StreamDemuxer *> demuxers;
+};
+
+static DemuxerRegistry &registry() {
+    static DemuxerRegistry reg;
+    return reg;
+}
+
+static void registerIngestCommand() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        log::registerTelnetCommand("ingest", "ingest [id]",
+            "Shows ingest health per stream: bitrate, packet rate, pts jitter, discontinuities, read errors, stalls, reconnects",
+            "Stream",
+            [](const std::vector<std::string> &args) -> std::string {
+                return StreamDemuxer::formatIngestStats(args.size() > 1 ? atoi(args[1].c_str()) : -1);
+            });
+    });
+}
+
+static void releaseOpenSlot(OpenGate &gate) {
+    {
+        std::lock_guard<std::mutex> lk(gate.lock);
+        gate.active--;
+    }
+    gate.cond.notify_one();
+}
+
 StreamDemuxer::StreamDemuxer(int id)
     : m_ifmtCtx(nullptr), m_observer(nullptr), m_threadReading(nullptr), m_id(id) {
     m_ifmtCtx = avformat_alloc_context();
+    registerIngestCommand();
+    std::lock_guard<std::mutex> lk(registry().lock);
+    registry().demuxers.insert(this);
 }
 
 StreamDemuxer::~StreamDemuxer() {
     std::cout << "~StreamDemuxer() dtor..." << std::endl;
+    {
+        std::lock_guard<std::mutex> lk(registry().lock);
+        registry().demuxers.erase(this);
+    }
     closeStream(false);
     avformat_close_input(&m_ifmtCtx);
     avformat_free_context(m_ifmtCtx);
+    releaseInputSource();
+}
+
+std::vector<AVMediaType> StreamDemuxer::parseStreamSelection(const std::string &spec) {
+    std::vector<AVMediaType> types;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        std::string name = spec.substr(start, end - start);
+        if (name == "all") return std::vector<AVMediaType>();
+        if (name == "video") types.push_back(AVMEDIA_TYPE_VIDEO);
+        else if (name == "audio") types.push_back(AVMEDIA_TYPE_AUDIO);
+        else if (name == "data") types.push_back(AVMEDIA_TYPE_DATA);
+        else if (name == "subtitle") types.push_back(AVMEDIA_TYPE_SUBTITLE);
+        start = end + 1;
+    }
+    return types;
+}
+
+void StreamDemuxer::applyStreamSelection() {
+    unsigned int num = m_ifmtCtx->nb_streams;
+    m_streamSelected.assign(num, false);
+    bool any = false;
+    for (auto type : m_selectTypes) {
+        int index = av_find_best_stream(m_ifmtCtx, type, -1, -1, nullptr, 0);
+        if (index >= 0) {
+            m_streamSelected[index] = true;
+            any = true;
+        }
+    }
+    if (!m_selectTypes.empty() && !any) {
+        std::cout << "stream selection matches nothing, reading all streams" << std::endl;
+    }
+    if (!any) m_streamSelected.assign(num, true);
+
+    for (unsigned int i = 0; i < num; ++i) {
+        m_ifmtCtx->streams[i]->discard = m_streamSelected[i] ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    int video = av_find_best_stream(m_ifmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (video >= 0 && m_streamSelected[video]) {
+        m_timingStream = video;
+    } else {
+        m_timingStream = 0;
+        for (unsigned int i = 0; i < num; ++i) {
+            if (m_streamSelected[i]) {
+                m_timingStream = i;
+                break;
+            }
+        }
+    }
+}
+
+void StreamDemuxer::invalidateProbeCache() {
+    if (m_probedFromCache) {
+        ProbeCache::instance().invalidate(m_inputUrl);
+        m_probedFromCache = false;
+    }
+}
+
+void StreamDemuxer::resetPacing() {
+    m_paceAnchorTs = AV_NOPTS_VALUE;
+    m_paceLastTs = AV_NOPTS_VALUE;
+    m_paceDiscontinuity = false;
+    m_paceFrameUs = 40000;
+    AVRational fr = m_ifmtCtx->streams[m_timingStream]->avg_frame_rate;
+    if (fr.num > 0 && fr.den > 0) {
+        m_paceFrameUs = av_rescale(AV_TIME_BASE, fr.den, fr.num);
+    }
+}
+
+void StreamDemuxer::pacePacket(const AVPacket *pkt) {
+    // other streams are interleaved around the paced one and simply follow it
+    if (m_pacingMode == PacingMode::Unthrottled || pkt->stream_index != m_timingStream) return;
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    if (ts == AV_NOPTS_VALUE) return;
+    ts = av_rescale_q(ts, m_ifmtCtx->streams[m_timingStream]->time_base, av_make_q(1, AV_TIME_BASE));
+
+    double speed = m_pacingMode == PacingMode::Speed ? m_pacingSpeed : 1.0;
+    int64_t now = av_gettime_relative();
+    if (m_paceAnchorTs == AV_NOPTS_VALUE) {
+        m_paceAnchorTs = ts;
+        m_paceAnchorClock = now;
+        m_paceDiscontinuity = false;
+    } else {
+        int64_t delta = ts - m_paceLastTs;
+        if (m_paceDiscontinuity || delta < 0 || delta > kPaceMaxJumpUs) {
+            // file looped or timestamps jumped: carry on one frame after the previous packet,
+            // as a camera would
+            m_paceAnchorTs = ts;
+            m_paceAnchorClock = m_paceLastDue + (int64_t)(m_paceFrameUs / speed);
+            m_paceDiscontinuity = false;
+        } else if (delta > 0) {
+            m_paceFrameUs = delta;
+        }
+    }
+    m_paceLastTs = ts;
+
+    int64_t due = m_paceAnchorClock + (int64_t)((ts - m_paceAnchorTs) / speed);
+    if (now - due > kPaceMaxLagUs) {
+        m_paceAnchorTs = ts;
+        m_paceAnchorClock = now;
+        due = now;
+    }
+    m_paceLastDue = due;
+    sleepUntil(due);
+}
+
+void StreamDemuxer::sleepUntil(int64_t due) {
+    // short sleeps so closeStream() is never held up by a long gap
+    while (State::Service == m_workState) {
+        int64_t remain = due - av_gettime_relative();
+        if (remain <= 0) break;
+        if (remain > kPaceSpinUs) {
+            av_usleep((unsigned)std::min<int64_t>(remain - kPaceSpinUs, 10000));
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+int StreamDemuxer::openInputSource() {
+    std::string path;
+    if (m_inputSource) {
+        m_activeSource = m_inputSource;
+    } else if (m_useMmap && MmapInputSource::localFilePath(m_inputUrl, &path)) {
+        m_activeSource = std::make_shared<MmapInputSource>(path, m_mmapParam);
+    } else if (SyntheticInputSource::isSyntheticUrl(m_inputUrl)) {
+        SyntheticSourceParam param;
+        int ret = SyntheticSourceParam::parse(m_inputUrl, &param);
+        if (ret < 0) {
+            std::cout << "Bad synthetic source " << m_inputUrl << std::endl;
+            return ret;
+        }
+        m_activeSource = std::make_shared<SyntheticInputSource>(param);
+    } else {
+        return 0;
+    }
+
+    int ret = m_activeSource->open();
+    if (ret < 0) {
+        m_activeSource.reset();
+        return ret;
+    }
+    m_avioCtx = m_activeSource->createAVIOContext();
+    if (m_avioCtx == nullptr) {
+        releaseInputSource();
+        return AVERROR(ENOMEM);
+    }
+    if (m_ifmtCtx == nullptr) {
+        m_ifmtCtx = avformat_alloc_context();
+    }
+    m_ifmtCtx->pb = m_avioCtx;
+    return 0;
+}
+
+void StreamDemuxer::releaseInputSource() {
+    // avformat_close_input() leaves a caller supplied pb alone
+    StreamInputSource::freeAVIOContext(&m_avioCtx);
+    if (m_activeSource) {
+        m_activeSource->close();
+        m_activeSource.reset();
+    }
+}
+
+int StreamDemuxer::interruptCallback(void *opaque) {
+    StreamDemuxer *self = static_cast<StreamDemuxer *>(opaque);
+    if (self->m_abortIo) return 1;
+    int64_t deadline = self->m_ioDeadline;
+    return deadline > 0 && av_gettime_relative() > deadline ? 1 : 0;
+}
+
+void StreamDemuxer::recordOpenResult(int ret, int64_t gateWaitUs, int64_t openUs) {
+    {
+        std::lock_guard<std::mutex> lk(m_statsLock);
+        m_openStats.attempts++;
+        m_openStats.gateWaitUs = gateWaitUs;
+        if (ret < 0) {
+            m_openStats.failures++;
+            m_openStats.lastError = ret;
+        } else {
+            m_openStats.lastOpenUs = openUs;
+            if (!m_openStats.opened) {
+                m_openStats.opened = true;
+                m_openStats.firstOpenUs = av_gettime_relative() - m_openRequestTime;
+            }
+        }
+    }
+    if (ret >= 0) {
+        m_openFailStreak = 0;
+        m_openCond.notify_all();
+    }
+}
+
+void StreamDemuxer::backoffAfterFailure() {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    int64_t delay = std::min(kOpenBackoffMaxUs, kOpenBackoffMinUs << std::min(m_openFailStreak, 6));
+    delay = delay / 2 + std::uniform_int_distribution<int64_t>(0, delay / 2)(rng);
+    m_openFailStreak++;
+    printf("stream[%d] open failed, retry in %d ms\n", m_id, (int)(delay / 1000));
+
+    int64_t due = av_gettime_relative() + delay;
+    while (!m_abortIo && av_gettime_relative() < due) {
+        av_usleep((unsigned)std::min<int64_t>(due - av_gettime_relative(), 50000));
+    }
+}
+
+StreamOpenStats StreamDemuxer::openStats() const {
+    std::lock_guard<std::mutex> lk(m_statsLock);
+    return m_openStats;
+}
+
+void StreamDemuxer::setOpenConcurrency(int maxConcurrent) {
+    OpenGate &gate = openGate();
+    {
+        std::lock_guard<std::mutex> lk(gate.lock);
+        gate.limit = std::max(0, maxConcurrent);
+    }
+    gate.cond.notify_all();
+}
+
+int StreamDemuxer::openStreams(const std::vector<StreamOpenRequest> &requests, int maxConcurrent) {
+    // the batch's own gate, the process wide limit and other batches are left alone
+    auto gate = std::make_shared<OpenGate>();
+    gate->limit = std::max(0, maxConcurrent);
+    int started = 0;
+    for (const auto &req : requests) {
+        if (req.demuxer == nullptr) continue;
+        if (req.demuxer->startStream(req.url, req.observer, req.repeat, false, gate) == 0) started++;
+    }
+    return started;
+}
+
+int StreamDemuxer::waitOpened(const std::vector<StreamDemuxer *> &demuxers, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    int opened = 0;
+    for (auto d : demuxers) {
+        if (d == nullptr) continue;
+        std::unique_lock<std::mutex> lk(d->m_statsLock);
+        if (d->m_openCond.wait_until(lk, deadline, [d] { return d->m_openStats.opened || d->m_abortIo; }) &&
+            d->m_openStats.opened) {
+            opened++;
+        }
+    }
+    return opened;
+}
+
+int StreamDemuxer::openSession(AVDictionary **opts) {
+    if (m_ifmtCtx == nullptr) {
+        m_ifmtCtx = avformat_alloc_context();
+        if (m_ifmtCtx == nullptr) return AVERROR(ENOMEM);
+    }
+    m_ifmtCtx->interrupt_callback.callback = interruptCallback;
+    m_ifmtCtx->interrupt_callback.opaque = this;
+    m_ioDeadline = m_openTimeoutMs > 0 ? av_gettime_relative() + (int64_t)m_openTimeoutMs * 1000 : 0;
+
+    int ret = openInputSource();
+    if (ret < 0) {
+        std::cout << "Can't open input source for " << m_inputUrl << std::endl;
+        return ret;
+    }
+
+    // the source knows its container, no need to probe for it
+    decltype(av_find_input_format("")) ifmt = nullptr;
+    if (m_activeSource && m_activeSource->formatName() != nullptr) {
+        ifmt = av_find_input_format(m_activeSource->formatName());
+    }
+    ret = avformat_open_input(&m_ifmtCtx, m_inputUrl.c_str(), ifmt, opts);
+    if (ret < 0) {
+        std::cout << "Can't open file " << m_inputUrl << (ret == AVERROR_EXIT && !m_abortIo ? " (open timeout)" : "") << std::endl;
+        releaseInputSource();
+        return ret;
+    }
+
+    int64_t probeStart = av_gettime_relative();
+    m_probedFromCache = m_useProbeCache && ProbeCache::instance().apply(m_inputUrl, m_ifmtCtx);
+    if (!m_probedFromCache) {
+        ret = avformat_find_stream_info(m_ifmtCtx, nullptr);
+        if (ret < 0) {
+            std::cout << "Unable to get stream info" << std::endl;
+            avformat_close_input(&m_ifmtCtx);
+            releaseInputSource();
+            return ret;
+        }
+        if (m_useProbeCache) {
+            ProbeCache::instance().store(m_inputUrl, m_ifmtCtx, av_gettime_relative() - probeStart);
+        }
+    }
+
+    return 0;
+}
+
+std::vector<std::pair<int, IngestStats>> StreamDemuxer::allIngestStats() {
+    std::vector<std::pair<int, IngestStats>> all;
+    std::lock_guard<std::mutex> lk(registry().lock);
+    for (auto d : registry().demuxers) {
+        all.emplace_back(d->m_id, d->m_ingest.snapshot());
+    }
+    std::sort(all.begin(), all.end(), [](const std::pair<int, IngestStats> &a, const std::pair<int, IngestStats> &b) {
+        return a.first < b.first;
+    });
+    return all;
+}
+
+std::string StreamDemuxer::formatIngestStats(int id) {
+    std::string out = "   id open     kbps  pkt/s    fps jit_ms  disc   err  err/s stall_ms max_stall recon url\r\n";
+    std::lock_guard<std::mutex> lk(registry().lock);
+    std::vector<StreamDemuxer *> sorted(registry().demuxers.begin(), registry().demuxers.end());
+    std::sort(sorted.begin(), sorted.end(), [](StreamDemuxer *a, StreamDemuxer *b) { return a->m_id < b->m_id; });
+    for (auto d : sorted) {
+        if (id >= 0 && d->m_id != id) continue;
+        IngestStats s = d->m_ingest.snapshot();
+        char line[256];
+        snprintf(line, sizeof(line), "%5d %4s %8.1f %6.1f %6.1f %6.1f %5lld %5lld %6.2f %8lld %9lld %5lld ",
+                 d->m_id, s.opened ? "yes" : "no", s.kbps, s.packetRate, s.fps, s.ptsJitterMs,
+                 (long long)s.discontinuities, (long long)s.readErrors, s.readErrorRate,
+                 (long long)s.currentStallMs, (long long)s.longestStallMs, (long long)s.reconnects);
+        out += line + d->m_inputUrl + "\r\n";
+    }
+    return out;
+}
+
+JitterBufferStats StreamDemuxer::jitterBufferStats() {
+    std::lock_guard<std::mutex> lk(m_statsLock);
+    return m_jitterBuffer ? m_jitterBuffer->stats() : JitterBufferStats();
+}
+
+void StreamDemuxer::deliverPacket(AVPacket *pkt) {
+    if (m_observer) {
+        m_observer->onReadFrame(pkt);
+    }
+
+    if (m_pfnOnReadFrame) {
+        m_pfnOnReadFrame(pkt);
+    }
 }
 
 int StreamDemuxer::doInitialize() {
+    m_gotFirstPacket = false;
     std::string prefix = "rtsp://";
     AVDictionary *opts = nullptr;
     if (m_inputUrl.compare(0, prefix.size(), prefix) == 0) {
@@ -23,27 +441,38 @@ int StreamDemuxer::doInitialize() {
         av_dict_set(&opts, "probesize", "400", 0);
         av_dict_set(&opts, "analyzeduration", "100", 0);
     } else {
-        m_isFileUrl = true;
+        // synthetic sources behave like a live camera, they are reopened instead of rewound
+        m_isFileUrl = !SyntheticInputSource::isSyntheticUrl(m_inputUrl);
     }
 
     av_dict_set(&opts, "rw_timeout", "15000", 0);
 
     std::cout << "Open stream " << m_inputUrl << std::endl;
 
-    int ret = avformat_open_input(&m_ifmtCtx, m_inputUrl.c_str(), nullptr, &opts);
-    av_dict_free(&opts);
-    if (ret < 0) {
-        std::cout << "Can't open file " << m_inputUrl << std::endl;
-        return ret;
+    OpenGate &gate = m_openGate ? *m_openGate : openGate();
+    int64_t gateStart = av_gettime_relative();
+    if (!acquireOpenSlot(gate, m_abortIo)) {
+        av_dict_free(&opts);
+        return AVERROR_EXIT;
     }
-
-    ret = avformat_find_stream_info(m_ifmtCtx, nullptr);
-    if (ret < 0) {
-        std::cout << "Unable to get stream info" << std::endl;
-        return ret;
+    int64_t openStart = av_gettime_relative();
+    int ret = openSession(&opts);
+    av_dict_free(&opts);
+    releaseOpenSlot(gate);
+    m_ioDeadline = 0;
+    recordOpenResult(ret, openStart - gateStart, av_gettime_relative() - openStart);
+    if (ret < 0) return ret;
+    // pushed or callback input can't be rewound: its EOF goes down (and reconnects) like a live
+    // stream, and it may use the jitter buffer
+    if (m_activeSource && !m_activeSource->seekable()) m_isFileUrl = false;
+
+    std::cout << "Init:total stream num:" << m_ifmtCtx->nb_streams
+              << (m_probedFromCache ? " (probe cache)" : "") << std::endl;
+    applyStreamSelection();
+    resetPacing();
+    if (m_packetRing) {
+        m_packetRing->setStreams(m_ifmtCtx, m_timingStream);
     }
-
-    std::cout << "Init:total stream num:" << m_ifmtCtx->nb_streams << std::endl;
     if (m_observer) {
         m_observer->onAvformatOpened(m_ifmtCtx);
     }
@@ -52,12 +481,30 @@ int StreamDemuxer::doInitialize() {
         m_pfnOnAVFormatOpened(m_ifmtCtx);
     }
 
-    m_workState = State::Service;
+    m_ingest.onOpened();
+    if (m_useJitterBuffer && !m_isFileUrl) {
+        std::lock_guard<std::mutex> lk(m_statsLock);
+        m_jitterBuffer.reset(new JitterBuffer(m_jitterParam, [this](AVPacket *p) { deliverPacket(p); }));
+    }
+
+    // closeStream() may have asked for Down while the open was in flight
+    if (State::Initialize == m_workState) {
+        m_workState = State::Service;
+    }
     return 0;
 }
 
 int StreamDemuxer::doDown() {
+    m_ingest.onClosed();
+    std::unique_ptr<JitterBuffer> jitterBuffer;
+    {
+        std::lock_guard<std::mutex> lk(m_statsLock);
+        jitterBuffer.swap(m_jitterBuffer);
+    }
+    if (jitterBuffer) jitterBuffer->stop(false);
+
     avformat_close_input(&m_ifmtCtx);
+    releaseInputSource();
 
     if (m_observer) {
         m_observer->onAvformatClosed();
@@ -86,10 +533,28 @@ int StreamDemuxer::doService() {
 
     m_startTime = av_gettime();
     int64_t frameIndex = 0;
+    int readErrors = 0;
     while (State::Service == m_workState) {
         int ret = av_read_frame(m_ifmtCtx, pkt);
         if (ret < 0) {
-            if (ret != AVERROR_EOF) continue;
+            if (m_probedFromCache && !m_gotFirstPacket && ret != AVERROR_EOF && ret != AVERROR(EAGAIN)) {
+                // the cached description may be what broke this session
+                invalidateProbeCache();
+            }
+            if (ret == AVERROR(EAGAIN)) {
+                av_usleep(kReadErrorBackoffUs);
+                continue;
+            }
+            if (ret != AVERROR_EOF) {
+                m_ingest.onReadError(ret);
+                if (++readErrors >= kMaxReadErrors) {
+                    printf("stream[%d] %d read errors in a row, reconnecting\n", m_id, readErrors);
+                    m_workState = State::Down;
+                    break;
+                }
+                av_usleep(kReadErrorBackoffUs);
+                continue;
+            }
             if (m_repeat && m_isFileUrl) {
                 ret = av_seek_frame(m_ifmtCtx, -1, m_ifmtCtx->start_time, 0);
                 if (ret != 0) {
@@ -100,10 +565,12 @@ int StreamDemuxer::doService() {
                 }
                 frameIndex = 0;
                 m_startTime = av_gettime();
+                m_paceDiscontinuity = true;
                 //printf("seek_to_start\n");
                 continue;
             } else {
                 printf("file[%d] end!\n", m_id);
+                if (m_jitterBuffer) m_jitterBuffer->stop(true);
                 if (m_observer) m_observer->onReadEof(pkt);
                 if (m_pfnOnReadEof != nullptr) m_pfnOnReadEof(pkt);
                 m_workState = State::Down;
@@ -111,36 +578,47 @@ int StreamDemuxer::doService() {
             break;
         }
 
+        readErrors = 0;
+        m_gotFirstPacket = true;
+
+        if (!isStreamSelected(pkt->stream_index)) {
+            // demuxers without discard support, or streams that appeared after open
+            av_packet_unref(pkt);
+            continue;
+        }
+
         if (m_lastFrameTime != 0) {
-            if (pkt->pts == AV_NOPTS_VALUE) {
-                AVRational timeBase1 = m_ifmtCtx->streams[0]->time_base;
-                int64_t calcDuration = (double)AV_TIME_BASE / av_q2d(m_ifmtCtx->streams[0]->r_frame_rate);
+            AVStream *timingStream = m_ifmtCtx->streams[m_timingStream];
+            if (pkt->pts == AV_NOPTS_VALUE && pkt->stream_index == m_timingStream &&
+                timingStream->r_frame_rate.num > 0 && timingStream->r_frame_rate.den > 0) {
+                AVRational timeBase1 = timingStream->time_base;
+                int64_t calcDuration = (double)AV_TIME_BASE / av_q2d(timingStream->r_frame_rate);
                 pkt->pts = (double)(frameIndex * calcDuration) / (double)(av_q2d(timeBase1) * AV_TIME_BASE);
                 pkt->dts = pkt->pts;
                 pkt->duration = (double)calcDuration / (double)(av_q2d(timeBase1) * AV_TIME_BASE);
             }
-
-            AVRational timeBase = m_ifmtCtx->streams[0]->time_base;
-            AVRational timeBaseQ = {1, AV_TIME_BASE};
-            int64_t ptsTime = av_rescale_q(pkt->dts, timeBase, timeBaseQ);
-            int64_t nowTime = av_gettime() - m_startTime;
-            if (ptsTime > nowTime) {
-                int64_t delta = ptsTime - nowTime;
-                if (delta < 100000) {
-                    //av_usleep(delta);
-                }
-            }
         }
 
-        m_lastFrameTime = av_gettime();
-        if (pkt->stream_index == 0) frameIndex++;
+        m_ingest.onPacket(pkt, pkt->stream_index == m_timingStream, m_ifmtCtx->streams[pkt->stream_index]->time_base);
+        pacePacket(pkt);
 
-        if (m_observer) {
-            m_observer->onReadFrame(pkt);
+        if (m_packetRing) {
+            m_packetRing->push(pkt);
         }
 
-        if (m_pfnOnReadFrame) {
-            m_pfnOnReadFrame(pkt);
+        m_lastFrameTime = av_gettime();
+        if (pkt->stream_index == m_timingStream) frameIndex++;
+
+        if (m_jitterBuffer) {
+            AVPacket *queued = av_packet_alloc();
+            if (queued != nullptr) {
+                AVRational timeBase = m_ifmtCtx->streams[pkt->stream_index]->time_base;
+                bool timing = pkt->stream_index == m_timingStream;
+                av_packet_move_ref(queued, pkt);
+                m_jitterBuffer->push(queued, timing, timeBase);
+            }
+        } else {
+            deliverPacket(pkt);
         }
 
         av_packet_unref(pkt);
@@ -157,13 +635,27 @@ int StreamDemuxer::doService() {
 }
 
 int StreamDemuxer::openStream(const std::string& url, StreamDemuxerEvents *observer, bool repeat, bool isSyncOpen) {
+    return startStream(url, observer, repeat, isSyncOpen, nullptr);
+}
 
+int StreamDemuxer::startStream(const std::string &url, StreamDemuxerEvents *observer, bool repeat, bool isSyncOpen,
+                               std::shared_ptr<OpenGate> gate) {
     closeStream(false);
 
+    // the reading thread is joined, nobody holds a slot of the old gate any more
+    m_openGate = std::move(gate);
     m_inputUrl = url;
     m_observer = observer;
     m_repeat = repeat;
     m_workState = State::Initialize;
+    m_abortIo = false;
+    m_openFailStreak = 0;
+    m_ingest.reset();
+    {
+        std::lock_guard<std::mutex> lk(m_statsLock);
+        m_openStats = StreamOpenStats();
+        m_openRequestTime = av_gettime_relative();
+    }
     if (isSyncOpen) {
         int ret = doInitialize();
         if (ret < 0) {
@@ -177,7 +669,7 @@ int StreamDemuxer::openStream(const std::string& url, StreamDemuxerEvents *obser
             switch (m_workState) {
                 case State::Initialize:
                     if (doInitialize() != 0) {
-                        std::this_thread::sleep_for(std::chrono::seconds(1));
+                        backoffAfterFailure();
                     }
                     break;
                 case State::Service:
@@ -197,6 +689,13 @@ int StreamDemuxer::closeStream(bool isWaiting) {
     if (!isWaiting) {
         m_workState = State::Down;
         m_repeat = false;
+        if (m_inputSource) m_inputSource->interrupt();
+        // unblocks an open or read stuck in libavformat, and any backoff sleep
+        {
+            std::lock_guard<std::mutex> lk(m_statsLock);
+            m_abortIo = true;
+        }
+        m_openCond.notify_all();
     }
 
     if (nullptr != m_threadReading) {
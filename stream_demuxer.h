@@ -2,10 +2,21 @@
 #define STREAM_DEMUXER_H
 
 #include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <list>
+#include <vector>
 #include <functional>
+#include <memory>
 #include "otl_ffmpeg.h"
+#include "stream_ingest_stats.h"
+#include "stream_input_source.h"
+#include "stream_jitter_buffer.h"
+#include "stream_packet_ring.h"
+#include "stream_probe_cache.h"
+#include "stream_synth_source.h"
 
 namespace otl {
 
@@ -16,6 +27,26 @@ struct StreamDemuxerEvents {
     virtual void onReadEof(AVPacket *pkt) = 0;
 };
 
+struct StreamOpenStats {
+    int attempts{0};
+    int failures{0};
+    int lastError{0};
+    int64_t lastOpenUs{0};      // avformat_open_input + probe of the last successful attempt
+    int64_t gateWaitUs{0};      // time the last attempt queued behind the open concurrency limit
+    int64_t firstOpenUs{0};     // openStream() to the first successful open, 0 until then
+    bool opened{false};
+};
+
+class StreamDemuxer;
+struct OpenGate;
+
+struct StreamOpenRequest {
+    StreamDemuxer *demuxer{nullptr};
+    std::string url;
+    StreamDemuxerEvents *observer{nullptr};
+    bool repeat{true};
+};
+
 class StreamDemuxer : public FfmpegGlobal {
 public:
     enum class State : int8_t {
@@ -24,6 +55,12 @@ public:
         Down
     };
 
+    enum class PacingMode : int8_t {
+        Unthrottled = 0,    // read as fast as the consumer takes packets (default)
+        Realtime,           // release packets at their timestamps, like a live camera
+        Speed               // timestamps scaled by 1/speed, e.g. 2.0 plays twice as fast
+    };
+
     using OnAvformatOpenedFunc = std::function<void(AVFormatContext*)>;
     using OnAvformatClosedFunc = std::function<void()>;
     using OnReadFrameFunc = std::function<void(AVPacket *)>;
@@ -41,14 +78,78 @@ private:
     bool m_isFileUrl{false};
     int m_id;
 
+    // custom byte input (mmap'ed files, caller provided sources) instead of an FFmpeg protocol
+    std::shared_ptr<StreamInputSource> m_inputSource;
+    std::shared_ptr<StreamInputSource> m_activeSource;
+    AVIOContext *m_avioCtx{nullptr};
+    bool m_useMmap{false};
+    MmapInputParam m_mmapParam;
+
+    // open deadline and abort for blocking libavformat calls, see interruptCallback()
+    std::atomic<bool> m_abortIo{false};
+    std::atomic<int64_t> m_ioDeadline{0};
+    int m_openTimeoutMs{10000};
+    std::shared_ptr<OpenGate> m_openGate;   // openStreams() 批次的并发限制，空则使用全局限制
+    int m_openFailStreak{0};
+    int64_t m_openRequestTime{0};
+    mutable std::mutex m_statsLock;
+    std::condition_variable m_openCond;
+    StreamOpenStats m_openStats;
+
+    IngestMonitor m_ingest;
+
+    // live streams only; created per session, delivers packets on its own thread
+    bool m_useJitterBuffer{false};
+    JitterBufferParam m_jitterParam;
+    std::unique_ptr<JitterBuffer> m_jitterBuffer;
+
+    // pre-event buffer fed with every delivered packet
+    std::shared_ptr<PacketRingBuffer> m_packetRing;
+
+    bool m_useProbeCache{false};
+    bool m_probedFromCache{false};
+    bool m_gotFirstPacket{false};   // 本次会话是否已读到数据包，每次 doInitialize 重置
+
+    // stream selection: empty delivers every stream
+    std::vector<AVMediaType> m_selectTypes;
+    std::vector<bool> m_streamSelected;
+    int m_timingStream{0};
+
+    // pacing: packet ts (us) m_paceAnchorTs is due at monotonic time m_paceAnchorClock, every
+    // later packet is scheduled from that anchor so sleep overshoot never accumulates
+    PacingMode m_pacingMode{PacingMode::Unthrottled};
+    double m_pacingSpeed{1.0};
+    bool m_paceDiscontinuity{false};
+    int64_t m_paceAnchorClock{0};
+    int64_t m_paceAnchorTs{AV_NOPTS_VALUE};
+    int64_t m_paceLastTs{AV_NOPTS_VALUE};
+    int64_t m_paceLastDue{0};
+    int64_t m_paceFrameUs{40000};
+
     OnAvformatOpenedFunc m_pfnOnAVFormatOpened;
     OnAvformatClosedFunc m_pfnOnAVFormatClosed;
     OnReadFrameFunc m_pfnOnReadFrame;
     OnReadEofFunc m_pfnOnReadEof;
 protected:
     int doInitialize();
+    int startStream(const std::string &url, StreamDemuxerEvents *observer, bool repeat, bool isSyncOpen,
+                    std::shared_ptr<OpenGate> gate);
+    int openSession(AVDictionary **opts);
     int doService();
     int doDown();
+    void applyStreamSelection();
+    bool isStreamSelected(int index) const {
+        return m_selectTypes.empty() || (index >= 0 && index < (int)m_streamSelected.size() && m_streamSelected[index]);
+    }
+    void deliverPacket(AVPacket *pkt);
+    void resetPacing();
+    void pacePacket(const AVPacket *pkt);
+    void sleepUntil(int64_t due);
+    int openInputSource();
+    void releaseInputSource();
+    static int interruptCallback(void *opaque);
+    void recordOpenResult(int ret, int64_t gateWaitUs, int64_t openUs);
+    void backoffAfterFailure();
 
 public:
     StreamDemuxer(int id = 0);
@@ -59,8 +160,76 @@ public:
     void setReadFrameCallback(OnReadFrameFunc func) { m_pfnOnReadFrame = func; }
     void setReadEofCallback(OnReadEofFunc func) { m_pfnOnReadEof = func; }
 
+    // Skip avformat_find_stream_info() on reopen when ProbeCache has a matching entry for the url.
+    void setProbeCacheEnabled(bool enable) { m_useProbeCache = enable; }
+    bool probedFromCache() const { return m_probedFromCache; }
+    // Drop the cache entry the current session was opened with, e.g. when the decoder rejects it.
+    void invalidateProbeCache();
+
+    // Only the best stream of each listed type is read; every other stream is set to
+    // AVDISCARD_ALL so the container skips its payloads. Empty (default) reads all streams.
+    // Takes effect on the next (re)open.
+    void setStreamSelection(const std::vector<AVMediaType> &types) { m_selectTypes = types; }
+    // "all" or a comma separated list of video,audio,data,subtitle.
+    static std::vector<AVMediaType> parseStreamSelection(const std::string &spec);
+    // Stream whose timestamps drive pacing and timestamp repair: the selected video stream if
+    // there is one. Valid once the stream is open.
+    int timingStreamIndex() const { return m_timingStream; }
+
+    // Pacing of file sources; live sources are paced by the sender already.
+    void setPacing(PacingMode mode, double speed = 1.0) {
+        m_pacingMode = mode;
+        m_pacingSpeed = speed > 0 ? speed : 1.0;
+    }
+
+    // Keep the last seconds of compressed packets for PacketRingBuffer::dumpClip(). The ring is
+    // reset on every (re)open, timestamps of a new session are not comparable.
+    void setPacketRing(std::shared_ptr<PacketRingBuffer> ring) { m_packetRing = ring; }
+
+    // Smooth bursty network input with an adaptive JitterBuffer; onReadFrame() is then called
+    // from the buffer's thread. File URLs are not affected (see setPacing). Takes effect on
+    // the next (re)open.
+    void setJitterBuffer(bool enable, const JitterBufferParam &param = JitterBufferParam()) {
+        m_useJitterBuffer = enable;
+        m_jitterParam = param;
+    }
+    JitterBufferStats jitterBufferStats();
+
+    // Local file URLs are read through an mmap'ed MmapInputSource; other URLs are unaffected.
+    // Takes effect on the next (re)open.
+    void setMmapInput(bool enable, const MmapInputParam &param = MmapInputParam()) {
+        m_useMmap = enable;
+        m_mmapParam = param;
+    }
+    // Read every open through source; the url is then only used for logging. nullptr restores
+    // the FFmpeg protocols. Takes effect on the next (re)open.
+    void setInputSource(std::shared_ptr<StreamInputSource> source) { m_inputSource = source; }
+
+    // Deadline for avformat_open_input() plus probing, enforced through the interrupt callback
+    // so it also covers protocols that ignore rw_timeout. 0 disables it.
+    void setOpenTimeout(int ms) { m_openTimeoutMs = ms; }
+    StreamOpenStats openStats() const;
+
+    int id() const { return m_id; }
+    const std::string &url() const { return m_inputUrl; }
+    IngestStats ingestStats() { return m_ingest.snapshot(); }
+    // Every live demuxer, for monitoring; also served by the "ingest [id]" telnet command.
+    static std::vector<std::pair<int, IngestStats>> allIngestStats();
+    static std::string formatIngestStats(int id = -1);
+
     int openStream(const std::string &url, StreamDemuxerEvents *observer, bool repeat = true, bool isSyncOpen = false);
     int closeStream(bool isWaiting);
+
+    // Process wide cap on demuxers inside avformat_open_input()/find_stream_info() at the same
+    // time; the others queue until a slot frees. 0 (default) is unbounded.
+    static void setOpenConcurrency(int maxConcurrent);
+    // Starts all opens asynchronously (each on its demuxer's thread) with at most maxConcurrent
+    // of them connecting at once, e.g. hundreds of cameras at startup; their later reconnects
+    // share the same limit. Each call gets its own limit, setOpenConcurrency() and other batches
+    // are not affected. Returns the number started.
+    static int openStreams(const std::vector<StreamOpenRequest> &requests, int maxConcurrent);
+    // Blocks until every demuxer has opened once or timeoutMs passed; returns how many opened.
+    static int waitOpened(const std::vector<StreamDemuxer *> &demuxers, int timeoutMs);
 };
 
 } // namespace otl
@@ -1,6 +1,8 @@
 #include "stream_encoder.h"
 
 #include <chrono>
+#include <cstring>
+#include <deque>
 #include <vector>
 
 namespace otl {
@@ -23,140 +25,198 @@ public:
     int init(EncodeParam* params) override {
         if (!params) return AVERROR(EINVAL);
         mParams = *params;
+        // kept for reopening on reconfigure(), the caller's dictionary may be gone by then
+        av_dict_free(&mOptions);
+        if (mParams.options) av_dict_copy(&mOptions, mParams.options, 0);
+        mParams.options = mOptions;
 
-        const AVCodec* codec = resolveCodec(mParams.codecName);
+        const AVCodec* codec = resolveCodec(mParams);
         if (!codec) {
             OTL_LOGE(TAG, "codec not found for name=%s", mParams.codecName.c_str());
             return AVERROR_ENCODER_NOT_FOUND;
         }
 
-        mCtx = avcodec_alloc_context3(codec);
-        if (!mCtx) return AVERROR(ENOMEM);
+        int ret = openContext(codec, mParams, &mCtx);
+        if (ret < 0) return ret;
 
-        mCtx->codec_type = AVMEDIA_TYPE_VIDEO;
-        mCtx->codec_id   = codec->id;
-        mCtx->width      = mParams.width;
-        mCtx->height     = mParams.height;
-        mCtx->time_base  = mParams.timeBase.num > 0 ? mParams.timeBase : (AVRational{1, 90000});
-        if (mParams.frameRate.num > 0 && mParams.frameRate.den > 0) {
-            mCtx->framerate = mParams.frameRate;
-        }
-        mCtx->pix_fmt    = mParams.pixFmt;
-        if (mParams.bitRate > 0) mCtx->bit_rate = mParams.bitRate;
-        if (mParams.gopSize > 0) mCtx->gop_size = mParams.gopSize;
-        if (mParams.maxBFrames >= 0) mCtx->max_b_frames = mParams.maxBFrames;
-        if (mParams.threadCount > 0) mCtx->thread_count = mParams.threadCount;
-
-        // Common low-latency hints
-#ifdef AV_CODEC_FLAG_GLOBAL_HEADER
-        // leave global header decision to muxer; do not enforce here
-#endif
-
-        AVDictionary* opts = nullptr;
-        if (mParams.options) {
-            // clone external options but do not take ownership
-            av_dict_copy(&opts, mParams.options, 0);
+        if (!mRecvPkt) mRecvPkt = av_packet_alloc();
+        if (!mRecvPkt) {
+            avcodec_free_context(&mCtx);
+            return AVERROR(ENOMEM);
         }
+        mStart = std::chrono::steady_clock::now();
+        mFrameCount.store(0);
+        mFramesSinceKey = 0;
+        mBaseParams = mParams;
+        mReconfigured = false;
+        return 0;
+    }
 
-        // Preset/tune/profile
-        if (!mParams.preset.empty())   av_dict_set(&opts, "preset",  mParams.preset.c_str(), 0);
-        if (!mParams.tune.empty())     av_dict_set(&opts, "tune",    mParams.tune.c_str(), 0);
-        if (!mParams.profile.empty())  av_dict_set(&opts, "profile", mParams.profile.c_str(), 0);
-        if (mParams.crf >= 0) {
-            // CRF is widely supported by libx264/libx265
-            char buf[32]; snprintf(buf, sizeof(buf), "%d", mParams.crf);
-            av_dict_set(&opts, "crf", buf, 0);
-        }
-        if (mParams.qp >= 0) {
-            // Some encoders support constant QP via q or qp
-            char buf[32]; snprintf(buf, sizeof(buf), "%d", mParams.qp);
-            av_dict_set(&opts, "qp", buf, 0);
-            av_dict_set(&opts, "q", buf, 0);
+    int reset() override {
+        if (!mCtx) return AVERROR(EINVAL);
+        {
+            std::lock_guard<std::mutex> lk(mReconfigLock);
+            mPendingCfg = EncodeReconfig();
+            mHasPendingCfg = false;
         }
-
-        int ret = avcodec_open2(mCtx, codec, &opts);
-        if (ret < 0) {
-            char err[AV_ERROR_MAX_STRING_SIZE];
-            av_strerror(ret, err, sizeof(err));
-            OTL_LOGE(TAG, "avcodec_open2 failed: %s", err);
+        mSwitchPending = false;
+        for (auto pkt : mDrained) av_packet_free(&pkt);
+        mDrained.clear();
+
+        // queued frames and packets are dropped either way; a context that can't be flushed,
+        // or runs with reconfigured settings, is opened again from the init parameters
+        bool canFlush = false;
+#ifdef AV_CODEC_CAP_ENCODER_FLUSH
+        canFlush = (mCtx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) != 0;
+#endif
+        if (canFlush && !mReconfigured) {
+            avcodec_flush_buffers(mCtx);
+        } else {
+            AVCodecContext* next = nullptr;
+            int ret = openContext(mCtx->codec, mBaseParams, &next);
+            if (ret < 0) return ret;
             avcodec_free_context(&mCtx);
-            av_dict_free(&opts);
-            return ret;
+            mCtx = next;
+            mParams = mBaseParams;
+            mReconfigured = false;
         }
-        av_dict_free(&opts);
-
-        OTL_LOGI(TAG, "encoder opened: %s %dx%d pixfmt=%d br=%lld gop=%d b=%d tb=%d/%d fr=%d/%d",
-                 mParams.codecName.c_str(), mCtx->width, mCtx->height, mCtx->pix_fmt,
-                 (long long)mCtx->bit_rate, mCtx->gop_size, mCtx->max_b_frames,
-                 mCtx->time_base.num, mCtx->time_base.den,
-                 mCtx->framerate.num, mCtx->framerate.den);
+        mForceIdr.store(true);
+        mFramesSinceKey = 0;
         mStart = std::chrono::steady_clock::now();
         mFrameCount.store(0);
         return 0;
     }
 
-    int encode(AVFrame* frame, AVPacket** p_pkt, int* p_num) override {
+    int querySupportedPixFmts(const EncodeParam& params, std::vector<AVPixelFormat>& fmts) override {
+        fmts.clear();
+        const AVCodec* codec = resolveCodec(params);
+        if (!codec) return AVERROR_ENCODER_NOT_FOUND;
+        const AVPixelFormat* list = nullptr;
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+        int num = 0;
+        if (avcodec_get_supported_config(nullptr, codec, AV_CODEC_CONFIG_PIX_FORMAT, 0,
+                                         (const void**)&list, &num) < 0) {
+            list = nullptr;
+        }
+#else
+        list = codec->pix_fmts;
+#endif
+        for (; list && *list != AV_PIX_FMT_NONE; ++list) fmts.push_back(*list);
+        return 0;
+    }
+
+    int reconfigure(const EncodeReconfig& cfg) override {
+        if (cfg.bitRate == 0 || cfg.maxRate == 0 || cfg.bufSize == 0 || cfg.gopSize == 0) return AVERROR(EINVAL);
+        if (cfg.frameRate.num < 0 || cfg.frameRate.den < 0) return AVERROR(EINVAL);
+        std::lock_guard<std::mutex> lk(mReconfigLock);
+        if (cfg.bitRate > 0) mPendingCfg.bitRate = cfg.bitRate;
+        if (cfg.maxRate > 0) mPendingCfg.maxRate = cfg.maxRate;
+        if (cfg.bufSize > 0) mPendingCfg.bufSize = cfg.bufSize;
+        if (cfg.frameRate.num > 0 && cfg.frameRate.den > 0) mPendingCfg.frameRate = cfg.frameRate;
+        if (cfg.gopSize > 0) mPendingCfg.gopSize = cfg.gopSize;
+        mHasPendingCfg = true;
+        return 0;
+    }
+
+    int send(AVFrame* frame) override {
         if (!mCtx) return AVERROR(EINVAL);
-        if (!p_pkt || !p_num) return AVERROR(EINVAL);
-        *p_pkt = nullptr; *p_num = 0;
+
+        if (frame) applyReconfig(frame);
 
         // apply on-demand keyframe request
         if (frame && mForceIdr.exchange(false)) {
             frame->pict_type = AV_PICTURE_TYPE_I;
             frame->key_frame = 1;
         }
+        if (frame) {
+            mFramesSinceKey = frame->pict_type == AV_PICTURE_TYPE_I ? 1 : mFramesSinceKey + 1;
+        }
 
         int ret = avcodec_send_frame(mCtx, frame);
         if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
             logAvError("avcodec_send_frame", ret);
             return ret;
         }
+        return 0;
+    }
 
-        // Try receive one packet (API allows many; we return the first for simplicity)
-        AVPacket* pkt = av_packet_alloc();
-        if (!pkt) return AVERROR(ENOMEM);
-        ret = avcodec_receive_packet(mCtx, pkt);
-        if (ret == 0) {
-            *p_pkt = pkt;
-            *p_num = 1;
+    int receive(AVPacket* pkt) override {
+        if (!mCtx || !pkt) return AVERROR(EINVAL);
+        av_packet_unref(pkt);
+        // the tail of the encoder replaced by a reconfigure goes out first
+        if (!mDrained.empty()) {
+            AVPacket* old = mDrained.front();
+            mDrained.pop_front();
+            av_packet_move_ref(pkt, old);
+            av_packet_free(&old);
             mFrameCount.fetch_add(1, std::memory_order_relaxed);
             return 0;
-        } else {
-            av_packet_free(&pkt);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0; // no output yet
+        }
+        int ret = avcodec_receive_packet(mCtx, pkt);
+        if (ret == 0) {
+            mFrameCount.fetch_add(1, std::memory_order_relaxed);
+        } else if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
             logAvError("avcodec_receive_packet", ret);
-            return ret;
         }
+        return ret;
     }
 
-    // New vector-based API: collects all available packets after sending a frame
-    int encode(AVFrame* frame, std::vector<AVPacket*>& outPkts) override {
+    int encode(AVFrame* frame, AVPacket** p_pkt, int* p_num) override {
         if (!mCtx) return AVERROR(EINVAL);
+        if (!p_pkt || !p_num) return AVERROR(EINVAL);
+        *p_pkt = nullptr; *p_num = 0;
 
-        // apply on-demand keyframe request
-        if (frame && mForceIdr.exchange(false)) {
-            frame->pict_type = AV_PICTURE_TYPE_I;
-            frame->key_frame = 1;
-        }
+        int ret = send(frame);
+        if (ret < 0) return ret;
 
-        int ret = avcodec_send_frame(mCtx, frame);
-        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-            logAvError("avcodec_send_frame", ret);
-            return ret;
+        // Try receive one packet (API allows many; we return the first for simplicity).
+        // Received into the reusable packet, a new one is only allocated for real output.
+        ret = receive(mRecvPkt);
+        if (ret == 0) {
+            AVPacket* pkt = av_packet_alloc();
+            if (!pkt) return AVERROR(ENOMEM);
+            av_packet_move_ref(pkt, mRecvPkt);
+            *p_pkt = pkt;
+            *p_num = 1;
+            return 0;
         }
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0; // no output yet
+        return ret;
+    }
+
+    // Vector-based API: collects all available packets after sending a frame
+    int encode(AVFrame* frame, std::vector<AVPacket*>& outPkts) override {
+        int ret = send(frame);
+        if (ret < 0) return ret;
 
         while (true) {
-            AVPacket* pkt = av_packet_alloc();
-            if (!pkt) return AVERROR(ENOMEM);
-            ret = avcodec_receive_packet(mCtx, pkt);
+            ret = receive(mRecvPkt);
             if (ret == 0) {
+                AVPacket* pkt = av_packet_alloc();
+                if (!pkt) return AVERROR(ENOMEM);
+                av_packet_move_ref(pkt, mRecvPkt);
                 outPkts.push_back(pkt);
-                mFrameCount.fetch_add(1, std::memory_order_relaxed);
                 continue; // try drain more
             }
-            av_packet_free(&pkt);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0; // done
-            logAvError("avcodec_receive_packet", ret);
+            return ret;
+        }
+    }
+
+    int encode(AVFrame* frame, std::vector<PacketHandle>& outPkts) override {
+        int ret = send(frame);
+        if (ret < 0) return ret;
+
+        while (true) {
+            PacketHandle pkt = mPool->acquire();
+            if (!pkt) return AVERROR(ENOMEM);
+            // on EAGAIN the handle simply goes back to the pool
+            ret = receive(pkt.get());
+            if (ret == 0) {
+                outPkts.push_back(std::move(pkt));
+                continue;
+            }
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0;
             return ret;
         }
     }
@@ -200,8 +260,152 @@ public:
     }
 
 private:
-    const AVCodec* resolveCodec(const std::string& name) {
-        std::string lower = name;
+    int openContext(const AVCodec* codec, const EncodeParam& p, AVCodecContext** out) {
+        AVCodecContext* ctx = avcodec_alloc_context3(codec);
+        if (!ctx) return AVERROR(ENOMEM);
+
+        ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+        ctx->codec_id   = codec->id;
+        ctx->width      = p.width;
+        ctx->height     = p.height;
+        ctx->time_base  = p.timeBase.num > 0 ? p.timeBase : (AVRational{1, 90000});
+        if (p.frameRate.num > 0 && p.frameRate.den > 0) {
+            ctx->framerate = p.frameRate;
+        }
+        ctx->pix_fmt    = p.pixFmt;
+        if (p.bitRate > 0) ctx->bit_rate = p.bitRate;
+        if (p.maxRate > 0) ctx->rc_max_rate = p.maxRate;
+        if (p.bufSize > 0) ctx->rc_buffer_size = p.bufSize;
+        if (p.gopSize > 0) ctx->gop_size = p.gopSize;
+        if (p.maxBFrames >= 0) ctx->max_b_frames = p.maxBFrames;
+        if (p.threadCount > 0) ctx->thread_count = p.threadCount;
+        if (p.threadType > 0) ctx->thread_type = p.threadType;
+
+        // Common low-latency hints
+#ifdef AV_CODEC_FLAG_GLOBAL_HEADER
+        // leave global header decision to muxer; do not enforce here
+#endif
+
+        AVDictionary* opts = nullptr;
+        if (p.options) {
+            // clone external options but do not take ownership
+            av_dict_copy(&opts, p.options, 0);
+        }
+
+        // Preset/tune/profile
+        if (!p.preset.empty())   av_dict_set(&opts, "preset",  p.preset.c_str(), 0);
+        if (!p.tune.empty())     av_dict_set(&opts, "tune",    p.tune.c_str(), 0);
+        if (!p.profile.empty())  av_dict_set(&opts, "profile", p.profile.c_str(), 0);
+        if (p.crf >= 0) {
+            // CRF is widely supported by libx264/libx265
+            char buf[32]; snprintf(buf, sizeof(buf), "%d", p.crf);
+            av_dict_set(&opts, "crf", buf, 0);
+        }
+        if (p.qp >= 0) {
+            // Some encoders support constant QP via q or qp
+            char buf[32]; snprintf(buf, sizeof(buf), "%d", p.qp);
+            av_dict_set(&opts, "qp", buf, 0);
+            av_dict_set(&opts, "q", buf, 0);
+        }
+
+        int ret = avcodec_open2(ctx, codec, &opts);
+        if (ret < 0) {
+            char err[AV_ERROR_MAX_STRING_SIZE];
+            av_strerror(ret, err, sizeof(err));
+            OTL_LOGE(TAG, "avcodec_open2 failed: %s", err);
+            avcodec_free_context(&ctx);
+            av_dict_free(&opts);
+            return ret;
+        }
+        av_dict_free(&opts);
+
+        OTL_LOGI(TAG, "encoder opened: %s %dx%d pixfmt=%d br=%lld gop=%d b=%d tb=%d/%d fr=%d/%d",
+                 codec->name, ctx->width, ctx->height, ctx->pix_fmt,
+                 (long long)ctx->bit_rate, ctx->gop_size, ctx->max_b_frames,
+                 ctx->time_base.num, ctx->time_base.den,
+                 ctx->framerate.num, ctx->framerate.den);
+        *out = ctx;
+        return 0;
+    }
+
+    // Backends whose FFmpeg wrapper picks up bit_rate/rc_max_rate/rc_buffer_size changes on
+    // the next frame (x264_encoder_reconfig, NVENC/QSV dynamic bitrate).
+    bool supportsLiveRate() const {
+        std::string name = mCtx->codec->name;
+        auto endsWith = [&](const char* suffix) {
+            size_t n = strlen(suffix);
+            return name.size() >= n && name.compare(name.size() - n, n, suffix) == 0;
+        };
+        return name == "libx264" || endsWith("_nvenc") || endsWith("_qsv");
+    }
+
+    // Runs on the encode thread, right before frame is sent.
+    void applyReconfig(AVFrame* frame) {
+        EncodeReconfig cfg;
+        {
+            std::lock_guard<std::mutex> lk(mReconfigLock);
+            if (mHasPendingCfg) {
+                cfg = mPendingCfg;
+                mPendingCfg = EncodeReconfig();
+                mHasPendingCfg = false;
+            }
+        }
+
+        bool rateOnly = cfg.frameRate.num == 0 && cfg.gopSize < 0;
+        bool anyChange = cfg.bitRate > 0 || cfg.maxRate > 0 || cfg.bufSize > 0 || !rateOnly;
+        if (anyChange && rateOnly && !mSwitchPending && supportsLiveRate()) {
+            mReconfigured = true;
+            if (cfg.bitRate > 0) mParams.bitRate = mCtx->bit_rate = cfg.bitRate;
+            if (cfg.maxRate > 0) mParams.maxRate = mCtx->rc_max_rate = cfg.maxRate;
+            if (cfg.bufSize > 0) mParams.bufSize = mCtx->rc_buffer_size = cfg.bufSize;
+            OTL_LOGI(TAG, "reconfigured live: br=%lld maxrate=%lld bufsize=%d",
+                     (long long)mCtx->bit_rate, (long long)mCtx->rc_max_rate, mCtx->rc_buffer_size);
+            return;
+        }
+        if (anyChange) {
+            // later changes add up on top of a switch that is still waiting for its IDR
+            if (!mSwitchPending) mSwitchParams = mParams;
+            if (cfg.bitRate > 0) mSwitchParams.bitRate = cfg.bitRate;
+            if (cfg.maxRate > 0) mSwitchParams.maxRate = cfg.maxRate;
+            if (cfg.bufSize > 0) mSwitchParams.bufSize = cfg.bufSize;
+            if (cfg.frameRate.num > 0) mSwitchParams.frameRate = cfg.frameRate;
+            if (cfg.gopSize > 0) mSwitchParams.gopSize = cfg.gopSize;
+            mSwitchPending = true;
+        }
+        if (!mSwitchPending) return;
+
+        // switch where the old encoder would have placed its own IDR anyway; without a known
+        // GOP there is no such point and it happens right away
+        bool atIdr = mForceIdr.load(std::memory_order_relaxed) || frame->pict_type == AV_PICTURE_TYPE_I ||
+                     mCtx->gop_size <= 0 || mFramesSinceKey >= mCtx->gop_size;
+        if (!atIdr) return;
+        mSwitchPending = false;
+
+        AVCodecContext* next = nullptr;
+        if (openContext(mCtx->codec, mSwitchParams, &next) < 0) {
+            OTL_LOGW(TAG, "reconfigure: reopen failed, keeping current settings");
+            return;
+        }
+        // drain the old encoder, its packets go out before the new one's
+        avcodec_send_frame(mCtx, nullptr);
+        while (true) {
+            AVPacket* pkt = av_packet_alloc();
+            if (!pkt || avcodec_receive_packet(mCtx, pkt) < 0) {
+                av_packet_free(&pkt);
+                break;
+            }
+            mDrained.push_back(pkt);
+        }
+        avcodec_free_context(&mCtx);
+        mCtx = next;
+        mParams = mSwitchParams;
+        mReconfigured = true;
+        frame->pict_type = AV_PICTURE_TYPE_I;
+        OTL_LOGI(TAG, "reconfigured by reopen at IDR (%zu packets drained)", mDrained.size());
+    }
+
+    const AVCodec* resolveCodec(const EncodeParam& p) {
+        std::string lower = p.codecName;
         for (auto &c : lower) c = (char)tolower(c);
         // Normalize some aliases
         if (lower == "h265") lower = "hevc";
@@ -217,8 +421,8 @@ private:
 
         auto push_hw_family = [&](const std::string& family){
             // Respect explicit hwAccel preference first
-            if (!mParams.hwAccel.empty()) {
-                std::string acc = mParams.hwAccel;
+            if (!p.hwAccel.empty()) {
+                std::string acc = p.hwAccel;
                 for (auto &ch : acc) ch = (char)tolower(ch);
                 if (family == "h264") {
                     if (acc == "videotoolbox") push_if("h264_videotoolbox");
@@ -253,7 +457,7 @@ private:
             }
         };
 
-        if (mParams.preferHardware) {
+        if (p.preferHardware) {
             if (lower == "h264") push_hw_family("h264");
             if (lower == "hevc") push_hw_family("hevc");
         }
@@ -291,6 +495,10 @@ private:
             avcodec_parameters_free(&mCodecPar);
             mCodecPar = nullptr;
         }
+        av_packet_free(&mRecvPkt);
+        for (auto pkt : mDrained) av_packet_free(&pkt);
+        mDrained.clear();
+        av_dict_free(&mOptions);
     }
 
     static void logAvError(const char* what, int err) {
@@ -304,12 +512,65 @@ private:
     EncodeParam mParams{};
     AVCodecContext* mCtx{nullptr};
     mutable AVCodecParameters* mCodecPar{nullptr};
+    AVPacket* mRecvPkt{nullptr};                    // receive target of the raw pointer APIs
+    std::shared_ptr<PacketPool> mPool{PacketPool::create()};
+
+    AVDictionary* mOptions{nullptr};
+
+    // reconfigure() only queues, the encode thread applies it in send()
+    std::mutex mReconfigLock;
+    EncodeReconfig mPendingCfg;
+    bool mHasPendingCfg{false};
+    bool mSwitchPending{false};
+    EncodeParam mSwitchParams{};
+    EncodeParam mBaseParams{};                      // as passed to init(), restored by reset()
+    bool mReconfigured{false};
+    std::deque<AVPacket*> mDrained;
+    int mFramesSinceKey{0};
 
     std::atomic<bool> mForceIdr{false};
     std::atomic<uint64_t> mFrameCount{0};
     std::chrono::steady_clock::time_point mStart;
 };
 
+std::shared_ptr<PacketPool> PacketPool::create(size_t maxCached) {
+    return std::shared_ptr<PacketPool>(new PacketPool(maxCached));
+}
+
+PacketPool::~PacketPool() {
+    for (auto pkt : mFree) av_packet_free(&pkt);
+}
+
+PacketHandle PacketPool::acquire() {
+    AVPacket* pkt = nullptr;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (!mFree.empty()) {
+            pkt = mFree.back();
+            mFree.pop_back();
+        }
+    }
+    if (!pkt) pkt = av_packet_alloc();
+    if (!pkt) return nullptr;
+    std::shared_ptr<PacketPool> self = shared_from_this();
+    return PacketHandle(pkt, [self](AVPacket* p) { self->release(p); });
+}
+
+size_t PacketPool::cached() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mFree.size();
+}
+
+void PacketPool::release(AVPacket* pkt) {
+    av_packet_unref(pkt);
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mFree.size() < mMaxCached) {
+        mFree.push_back(pkt);
+    } else {
+        av_packet_free(&pkt);
+    }
+}
+
 std::unique_ptr<StreamEncoder> CreateStreamEncoder(const std::string &codecName) {
     return std::unique_ptr<StreamEncoder>(new FfmpegStreamEncoder(codecName));
 }
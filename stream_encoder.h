@@ -8,6 +8,7 @@
 #include "otl_ffmpeg.h"
 #include "otl_log.h"
 #include <memory>
+#include <mutex>
 #include <string>
 #include <atomic>
 #include <cstdint>
@@ -23,9 +24,12 @@ namespace otl {
         AVRational frameRate{0, 1};    // 可选，0 表示未知
         AVPixelFormat pixFmt{AV_PIX_FMT_YUV420P};
         int64_t bitRate{0};            // bps，0 表示按 crf/qp 控制
+        int64_t maxRate{0};            // VBV 峰值码率 bps，0 不限制
+        int bufSize{0};                // VBV 缓冲区大小 bits，0 由编码器决定
         int gopSize{0};                // 0 由编码器决定
         int maxBFrames{-1};            // <0 使用编码器默认
         int threadCount{0};            // 0 自动
+        int threadType{0};             // FF_THREAD_FRAME / FF_THREAD_SLICE，0 由编码器决定
 
         // 码控相关
         int crf{-1};                   // libx264/libx265 等支持
@@ -42,6 +46,34 @@ namespace otl {
         std::string hwAccel;             // 指定首选后端：videotoolbox/nvenc/qsv/vaapi/amf（留空则按平台优先级）
     };
 
+    // 运行时调整项，未设置的字段保持不变
+    struct EncodeReconfig {
+        int64_t bitRate{-1};
+        int64_t maxRate{-1};
+        int bufSize{-1};
+        AVRational frameRate{0, 0};
+        int gopSize{-1};
+    };
+
+    // Recycles AVPacket structs so a steady encode loop stops allocating them. Its handles
+    // unref the packet and return it here; they may outlive the encoder, they keep the pool alive.
+    class PacketPool : public std::enable_shared_from_this<PacketPool> {
+    public:
+        static std::shared_ptr<PacketPool> create(size_t maxCached = 32);
+        ~PacketPool();
+
+        PacketHandle acquire();
+        size_t cached();
+
+    private:
+        explicit PacketPool(size_t maxCached) : mMaxCached(maxCached) {}
+        void release(AVPacket *pkt);
+
+        std::mutex mLock;
+        std::vector<AVPacket*> mFree;
+        size_t mMaxCached;
+    };
+
     class StreamEncoder {
     public:
         StreamEncoder();
@@ -54,6 +86,15 @@ namespace otl {
         // Encoder should allocate AVPacket* elements; caller must free each via freePacket().
         virtual int encode(AVFrame* frame, std::vector<AVPacket*>& outPkts) { (void)frame; (void)outPkts; return -1; }
 
+        // Handle-based API: packets come from the encoder's PacketPool, nothing to free.
+        virtual int encode(AVFrame* frame, std::vector<PacketHandle>& outPkts) { (void)frame; (void)outPkts; return -1; }
+
+        // Lowest level, no allocation at all: send one frame (nullptr drains), then call
+        // receive() with the caller's packet until it returns AVERROR(EAGAIN) or AVERROR_EOF.
+        // pkt is unref'ed before it is filled.
+        virtual int send(AVFrame* frame) { (void)frame; return AVERROR(ENOSYS); }
+        virtual int receive(AVPacket* pkt) { (void)pkt; return AVERROR(ENOSYS); }
+
         // Free a single packet allocated/owned by encoder. Default uses libav to free.
         virtual void freePacket(AVPacket* pkt) { if (pkt) { av_packet_unref(pkt); av_packet_free(&pkt); } }
 
@@ -65,6 +106,22 @@ namespace otl {
         // 请求下一个帧编码为关键帧（IDR）
         virtual int requestKeyFrame() = 0;
 
+        // Back to the state right after init(): queued frames and packets are dropped,
+        // reconfigure() changes undone, and the next frame is an IDR. Lets an opened
+        // session be handed to another user.
+        virtual int reset() { return AVERROR(ENOSYS); }
+
+        // Pixel formats the encoder picked for params would accept, without opening it.
+        // An empty list means any format.
+        virtual int querySupportedPixFmts(const EncodeParam &params, std::vector<AVPixelFormat> &fmts) {
+            (void)params; fmts.clear(); return AVERROR(ENOSYS);
+        }
+
+        // Safe to call from any thread, takes effect with the next frame sent. Rate and VBV
+        // changes go to the running encoder where the backend supports it; anything else
+        // reopens the codec at the next regular IDR, so no extra keyframe is produced.
+        virtual int reconfigure(const EncodeReconfig &cfg) { (void)cfg; return AVERROR(ENOSYS); }
+
         // 获取编码帧率统计
         // 返回：平均 fps；frames 返回累计帧数；elapsedSec 返回起始到当前耗时（秒）
         virtual double getFps(uint64_t &frames, double &elapsedSec) const = 0;
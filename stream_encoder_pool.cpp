@@ -0,0 +1,216 @@
+#include "stream_encoder_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace otl {
+
+static const char* TAG = "EncoderPool";
+
+EncoderLease &EncoderLease::operator=(EncoderLease &&other) noexcept {
+    if (this != &other) {
+        release();
+        mPool = other.mPool;
+        mProfile = other.mProfile;
+        mEncoder = other.mEncoder;
+        other.mPool = nullptr;
+        other.mEncoder = nullptr;
+    }
+    return *this;
+}
+
+void EncoderLease::release() {
+    if (mPool && mEncoder) mPool->giveBack(mProfile, mEncoder);
+    mPool = nullptr;
+    mEncoder = nullptr;
+}
+
+EncoderPool::~EncoderPool() {
+    for (auto &p : mProfiles) {
+        p->sessions.clear();
+        av_dict_free(&p->options);
+    }
+}
+
+std::unique_ptr<StreamEncoder> EncoderPool::openSession(Profile &p) {
+    std::unique_ptr<StreamEncoder> enc = CreateStreamEncoder(p.param.codecName);
+    EncodeParam ep = p.param;
+    ep.options = p.options;
+    int ret = enc->init(&ep);
+    if (ret < 0) {
+        OTL_LOGW(TAG, "profile %s: session open failed: %d", p.name.c_str(), ret);
+        return nullptr;
+    }
+    return enc;
+}
+
+int EncoderPool::addProfile(const std::string &name, const EncodeParam &param, int preopen, int maxSessions) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        for (auto &p : mProfiles) {
+            if (p->name == name) return AVERROR(EEXIST);
+        }
+    }
+
+    std::unique_ptr<Profile> p(new Profile());
+    p->name = name;
+    p->param = param;
+    if (param.options) av_dict_copy(&p->options, param.options, 0);
+    p->param.options = nullptr;
+    p->maxSessions = std::max(1, std::max(maxSessions, preopen));
+    p->stats.profile = name;
+
+    for (int i = 0; i < preopen; ++i) {
+        std::unique_ptr<StreamEncoder> enc = openSession(*p);
+        if (!enc) {
+            p->stats.openFailures++;
+            if (i == 0) {
+                av_dict_free(&p->options);
+                return AVERROR_ENCODER_NOT_FOUND;
+            }
+            break;
+        }
+        std::unique_ptr<Session> s(new Session());
+        s->encoder = std::move(enc);
+        s->openedUs = av_gettime_relative();
+        p->sessions.push_back(std::move(s));
+    }
+    OTL_LOGI(TAG, "profile %s: %s %dx%d, %zu/%d sessions open", name.c_str(), param.codecName.c_str(),
+             param.width, param.height, p->sessions.size(), p->maxSessions);
+
+    std::lock_guard<std::mutex> lk(mLock);
+    mProfiles.push_back(std::move(p));
+    return 0;
+}
+
+EncoderLease EncoderPool::acquire(const EncodeParam &param, int timeoutMs) {
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        for (auto &p : mProfiles) {
+            const EncodeParam &q = p->param;
+            if (q.codecName == param.codecName && q.width == param.width && q.height == param.height &&
+                q.pixFmt == param.pixFmt && q.bitRate == param.bitRate && q.maxRate == param.maxRate &&
+                q.bufSize == param.bufSize && q.crf == param.crf && q.qp == param.qp &&
+                // the session was opened with them: they decide the packet timestamps and IDR spacing
+                av_cmp_q(q.timeBase, param.timeBase) == 0 && av_cmp_q(q.frameRate, param.frameRate) == 0 &&
+                q.gopSize == param.gopSize) {
+                name = p->name;
+                break;
+            }
+        }
+    }
+    if (name.empty()) return EncoderLease();
+    return acquire(name, timeoutMs);
+}
+
+EncoderLease EncoderPool::acquire(const std::string &name, int timeoutMs) {
+    const int64_t startUs = av_gettime_relative();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeoutMs, 0));
+
+    std::unique_lock<std::mutex> lk(mLock);
+    size_t index = 0;
+    while (index < mProfiles.size() && mProfiles[index]->name != name) ++index;
+    if (index == mProfiles.size()) return EncoderLease();
+    Profile &p = *mProfiles[index];
+
+    bool waited = false;
+    bool openFailed = false;
+    auto lease = [&](Session &s) {
+        int64_t now = av_gettime_relative();
+        s.leased = true;
+        s.leasedUs = now;
+        p.stats.leases++;
+        p.stats.leased++;
+        p.stats.peakLeased = std::max(p.stats.peakLeased, p.stats.leased);
+        if (waited) {
+            double ms = (now - startUs) / 1000.0;
+            p.stats.waits++;
+            p.waitMsTotal += ms;
+            p.stats.maxWaitMs = std::max(p.stats.maxWaitMs, ms);
+        }
+        return EncoderLease(this, index, s.encoder.get());
+    };
+
+    while (true) {
+        for (auto &s : p.sessions) {
+            if (!s->leased) return lease(*s);
+        }
+        // one open attempt per call, a backend that is out of sessions won't recover in a loop
+        if (!openFailed && (int)p.sessions.size() + p.opening < p.maxSessions) {
+            p.opening++;
+            lk.unlock();
+            std::unique_ptr<StreamEncoder> enc = openSession(p);
+            lk.lock();
+            p.opening--;
+            if (enc) {
+                std::unique_ptr<Session> s(new Session());
+                s->encoder = std::move(enc);
+                s->openedUs = av_gettime_relative();
+                p.sessions.push_back(std::move(s));
+                return lease(*p.sessions.back());
+            }
+            openFailed = true;
+            p.stats.openFailures++;
+            if (p.sessions.empty() && p.opening == 0) return EncoderLease();
+            continue;
+        }
+
+        waited = true;
+        if (timeoutMs < 0) {
+            mCond.wait(lk);
+        } else if (mCond.wait_until(lk, deadline) == std::cv_status::timeout) {
+            for (auto &s : p.sessions) {
+                if (!s->leased) return lease(*s);
+            }
+            p.stats.timeouts++;
+            return EncoderLease();
+        }
+    }
+}
+
+void EncoderPool::giveBack(size_t profile, StreamEncoder *encoder) {
+    // still marked leased while resetting, nobody else gets it half way
+    int ret = encoder->reset();
+
+    std::unique_ptr<StreamEncoder> broken;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        Profile &p = *mProfiles[profile];
+        auto it = std::find_if(p.sessions.begin(), p.sessions.end(),
+                               [&](const std::unique_ptr<Session> &s) { return s->encoder.get() == encoder; });
+        if (it == p.sessions.end()) return;
+        Session &s = **it;
+        s.busyUs += av_gettime_relative() - s.leasedUs;
+        s.leased = false;
+        p.stats.leased--;
+        if (ret < 0) {
+            // not reusable, its slot is opened again on demand
+            OTL_LOGW(TAG, "profile %s: session reset failed: %d, closing it", p.name.c_str(), ret);
+            broken = std::move(s.encoder);
+            p.sessions.erase(it);
+        }
+    }
+    mCond.notify_all();
+}
+
+std::vector<EncoderPoolStats> EncoderPool::stats() {
+    int64_t now = av_gettime_relative();
+    std::lock_guard<std::mutex> lk(mLock);
+    std::vector<EncoderPoolStats> out;
+    for (auto &p : mProfiles) {
+        EncoderPoolStats s = p->stats;
+        s.sessions = (int)p->sessions.size();
+        s.avgWaitMs = s.waits > 0 ? p->waitMsTotal / s.waits : 0;
+        int64_t busy = 0, open = 0;
+        for (auto &sess : p->sessions) {
+            busy += sess->busyUs + (sess->leased ? now - sess->leasedUs : 0);
+            open += now - sess->openedUs;
+        }
+        s.utilization = open > 0 ? (double)busy / open : 0;
+        out.push_back(s);
+    }
+    return out;
+}
+
+} // namespace otl
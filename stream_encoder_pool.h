@@ -0,0 +1,102 @@
+#ifndef STREAM_ENCODER_POOL_H
+#define STREAM_ENCODER_POOL_H
+
+#include "stream_encoder.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace otl {
+    struct EncoderPoolStats {
+        std::string profile;
+        int sessions{0};                // 已打开的会话
+        int leased{0};                  // 当前借出
+        int peakLeased{0};
+        int64_t leases{0};
+        int64_t waits{0};               // 借用时需要等待的次数
+        int64_t timeouts{0};
+        int64_t openFailures{0};
+        double avgWaitMs{0};
+        double maxWaitMs{0};
+        double utilization{0};          // 借出时间 / 会话打开时间
+    };
+
+    class EncoderPool;
+
+    // An opened encoder on loan. Returned to the pool, and reset there, when the lease is
+    // destroyed or release() is called.
+    class EncoderLease {
+    public:
+        EncoderLease() = default;
+        ~EncoderLease() { release(); }
+        EncoderLease(EncoderLease &&other) noexcept { *this = std::move(other); }
+        EncoderLease &operator=(EncoderLease &&other) noexcept;
+        EncoderLease(const EncoderLease &) = delete;
+        EncoderLease &operator=(const EncoderLease &) = delete;
+
+        explicit operator bool() const { return mEncoder != nullptr; }
+        StreamEncoder *get() const { return mEncoder; }
+        StreamEncoder *operator->() const { return mEncoder; }
+        void release();
+
+    private:
+        friend class EncoderPool;
+        EncoderLease(EncoderPool *pool, size_t profile, StreamEncoder *encoder)
+            : mPool(pool), mProfile(profile), mEncoder(encoder) {}
+
+        EncoderPool *mPool{nullptr};
+        size_t mProfile{0};
+        StreamEncoder *mEncoder{nullptr};
+    };
+
+    // Keeps opened encoder sessions per profile (codec, size, rate control) so a channel
+    // start takes a ready session instead of opening a codec. Sessions beyond preopen are
+    // opened on demand up to maxSessions; past that acquire() waits for a return. A returned
+    // session is reset() before it is leased again. Leases must not outlive the pool.
+    class EncoderPool {
+    public:
+        EncoderPool() = default;
+        ~EncoderPool();
+
+        // Opens preopen sessions right away. Fails if the first one can't be opened.
+        int addProfile(const std::string &name, const EncodeParam &param, int preopen = 1, int maxSessions = 1);
+
+        // timeoutMs < 0 waits; an empty lease on timeout or unknown profile.
+        EncoderLease acquire(const std::string &name, int timeoutMs = -1);
+        // Picks the profile whose codec, size, pixel format, rate control, time base, frame rate
+        // and GOP size match param.
+        EncoderLease acquire(const EncodeParam &param, int timeoutMs = -1);
+
+        std::vector<EncoderPoolStats> stats();
+
+    private:
+        friend class EncoderLease;
+
+        struct Session {
+            std::unique_ptr<StreamEncoder> encoder;
+            bool leased{false};
+            int64_t openedUs{0};
+            int64_t leasedUs{0};
+            int64_t busyUs{0};
+        };
+
+        struct Profile {
+            std::string name;
+            EncodeParam param;
+            AVDictionary *options{nullptr};  // param.options 的副本
+            int maxSessions{1};
+            int opening{0};                  // 正在打开中的会话
+            std::vector<std::unique_ptr<Session>> sessions;
+            double waitMsTotal{0};
+            EncoderPoolStats stats;
+        };
+
+        std::unique_ptr<StreamEncoder> openSession(Profile &p);
+        void giveBack(size_t profile, StreamEncoder *encoder);
+
+        std::mutex mLock;
+        std::condition_variable mCond;
+        std::vector<std::unique_ptr<Profile>> mProfiles;
+    };
+}
+
+#endif //STREAM_ENCODER_POOL_H
@@ -0,0 +1,388 @@
+#include "stream_fanout.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+
+namespace otl {
+
+static const char* TAG = "StreamFanout";
+
+struct StreamFanout::Sink {
+    int id{0};
+    FanoutSinkParam param;
+    GopPacketQueue queue;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> closing{false};       // finishing the output, only the deadline applies
+    std::atomic<int64_t> ioDeadline{0};     // see interruptCallback()
+    std::mutex waitLock;
+    std::condition_variable waitCond;
+
+    // 仅由 sink 线程访问
+    AVFormatContext *ofmtCtx{nullptr};
+    bool headerWritten{false};
+    AVPacket *scratch{nullptr};
+    std::vector<QueuedPacket> batch;
+    int64_t paceBaseDts{AV_NOPTS_VALUE};
+    int64_t paceBaseUs{0};
+
+    std::mutex statsLock;
+    FanoutSinkStats stats;
+
+    // called before each blocking libavformat call
+    void armIo() {
+        ioDeadline = param.ioTimeoutMs > 0 ? av_gettime_relative() + (int64_t)param.ioTimeoutMs * 1000 : 0;
+    }
+};
+
+static bool startWith(const std::string &s, const char *prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+StreamFanout::StreamFanout() = default;
+
+// Aborts blocking I/O on stop, or when a peer stalls past the deadline so it is reconnected
+// instead of holding its sink forever. The trailer and the final flush run after stop and are
+// only bounded by the deadline, a recording would be unplayable without them.
+int StreamFanout::interruptCallback(void *opaque) {
+    Sink *s = static_cast<Sink *>(opaque);
+    if (s->stopping && !s->closing) return 1;
+    int64_t deadline = s->ioDeadline;
+    return deadline > 0 && av_gettime_relative() > deadline ? 1 : 0;
+}
+
+StreamFanout::~StreamFanout() {
+    close();
+}
+
+int StreamFanout::open(const AVCodecParameters *codecpar, AVRational timeBase) {
+    if (!codecpar) return AVERROR(EINVAL);
+    std::lock_guard<std::mutex> lk(mLock);
+    if (!mSinks.empty()) return AVERROR(EBUSY);
+    avcodec_parameters_free(&mCodecPar);
+    mCodecPar = avcodec_parameters_alloc();
+    if (!mCodecPar) return AVERROR(ENOMEM);
+    int ret = avcodec_parameters_copy(mCodecPar, codecpar);
+    if (ret < 0) {
+        avcodec_parameters_free(&mCodecPar);
+        return ret;
+    }
+    mTimeBase = timeBase;
+    mTimestampSmoother.reset();
+    return 0;
+}
+
+int StreamFanout::addSink(const FanoutSinkParam &param) {
+    std::shared_ptr<Sink> s = std::make_shared<Sink>();
+    s->param = param;
+    s->param.reconnectMinMs = std::max(1, param.reconnectMinMs);
+    s->param.reconnectMaxMs = std::max(s->param.reconnectMinMs, param.reconnectMaxMs);
+    s->queue.setParam(param.backlog);
+    s->scratch = av_packet_alloc();
+    if (!s->scratch) return AVERROR(ENOMEM);
+    s->stats.url = param.url;
+
+    std::lock_guard<std::mutex> lk(mLock);
+    if (!mCodecPar) {
+        av_packet_free(&s->scratch);
+        return AVERROR(EINVAL);
+    }
+    s->id = mNextId++;
+    s->stats.id = s->id;
+    // nothing is queued until the sink is connected and has asked for a keyframe
+    s->queue.restartAtKeyframe();
+    s->thread = std::thread(&StreamFanout::sinkLoop, this, s.get());
+    mSinks.push_back(s);
+    OTL_LOGI(TAG, "sink %d: %s", s->id, param.url.c_str());
+    return s->id;
+}
+
+int StreamFanout::removeSink(int id) {
+    std::shared_ptr<Sink> s;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        auto it = std::find_if(mSinks.begin(), mSinks.end(),
+                               [id](const std::shared_ptr<Sink> &e) { return e->id == id; });
+        if (it == mSinks.end()) return AVERROR(ENOENT);
+        s = *it;
+        mSinks.erase(it);
+    }
+    // joined outside the lock, inputPacket() keeps feeding the other sinks meanwhile
+    stopSink(s.get());
+    return 0;
+}
+
+int StreamFanout::inputPacket(const AVPacket *pkt) {
+    if (!pkt) return AVERROR(EINVAL);
+    PacketHandle h = mPool->acquire();
+    if (!h) return AVERROR(ENOMEM);
+    int ret = av_packet_ref(h.get(), pkt);
+    if (ret < 0) return ret;
+
+    std::lock_guard<std::mutex> lk(mLock);
+    if (!mTimestampSmoother.smoothTimestamp(h.get())) return AVERROR(EINVAL);
+    int queued = 0;
+    for (auto &s : mSinks) {
+        if (s->queue.push(h)) queued++;
+    }
+    return queued;
+}
+
+void StreamFanout::close() {
+    std::vector<std::shared_ptr<Sink>> sinks;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        sinks.swap(mSinks);
+    }
+    // all of them are told to stop first, so slow ones close in parallel
+    for (auto &s : sinks) {
+        s->stopping = true;
+        s->queue.shutdown();
+        std::lock_guard<std::mutex> lk(s->waitLock);
+        s->waitCond.notify_all();
+    }
+    for (auto &s : sinks) stopSink(s.get());
+
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mCodecPar) mTimestampSmoother.printStatistics();
+    avcodec_parameters_free(&mCodecPar);
+}
+
+void StreamFanout::configureTimestampSmoother(double smoothingFactor, int64_t maxJumpThreshold, int64_t minIncrement) {
+    std::lock_guard<std::mutex> lk(mLock);
+    mTimestampSmoother.setSmoothingParameters(smoothingFactor, maxJumpThreshold, minIncrement);
+}
+
+std::vector<FanoutSinkStats> StreamFanout::stats() {
+    std::vector<std::shared_ptr<Sink>> sinks;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        sinks = mSinks;
+    }
+    std::vector<FanoutSinkStats> out;
+    for (auto &s : sinks) {
+        FanoutSinkStats st;
+        {
+            std::lock_guard<std::mutex> lk(s->statsLock);
+            st = s->stats;
+        }
+        st.backlog = s->queue.stats();
+        out.push_back(st);
+    }
+    return out;
+}
+
+void StreamFanout::stopSink(Sink *s) {
+    s->stopping = true;
+    s->queue.shutdown();
+    {
+        std::lock_guard<std::mutex> lk(s->waitLock);
+        s->waitCond.notify_all();
+    }
+    if (s->thread.joinable()) s->thread.join();
+    av_packet_free(&s->scratch);
+}
+
+void StreamFanout::setState(Sink *s, FanoutSinkState state) {
+    std::lock_guard<std::mutex> lk(s->statsLock);
+    s->stats.state = state;
+}
+
+bool StreamFanout::waitFor(Sink *s, int64_t us) {
+    std::unique_lock<std::mutex> lk(s->waitLock);
+    s->waitCond.wait_for(lk, std::chrono::microseconds(us), [s] { return s->stopping.load(); });
+    return !s->stopping;
+}
+
+int StreamFanout::connectSink(Sink *s) {
+    const std::string &url = s->param.url;
+    // anything but a streaming url, e.g. a recording file, is guessed from the name
+    const char *formatName = s->param.formatName.empty() ? outputFormatForUrl(url, mCodecPar->codec_id)
+                                                         : s->param.formatName.c_str();
+
+    int ret = avformat_alloc_output_context2(&s->ofmtCtx, nullptr, formatName, url.c_str());
+    if (ret < 0 || !s->ofmtCtx) return ret < 0 ? ret : AVERROR(ENOMEM);
+    // a peer that stops answering must not keep close() or this sink waiting
+    s->ofmtCtx->interrupt_callback.callback = interruptCallback;
+    s->ofmtCtx->interrupt_callback.opaque = s;
+
+    AVStream *ostream = avformat_new_stream(s->ofmtCtx, nullptr);
+    if (!ostream) return AVERROR(ENOMEM);
+    ret = avcodec_parameters_copy(ostream->codecpar, mCodecPar);
+    if (ret < 0) return ret;
+    ostream->time_base = mTimeBase;
+    av_opt_set(s->ofmtCtx, "strict", "experimental", 0);
+
+    if (!(s->ofmtCtx->oformat->flags & AVFMT_NOFILE)) {
+        s->armIo();
+        ret = avio_open2(&s->ofmtCtx->pb, url.c_str(), AVIO_FLAG_WRITE, &s->ofmtCtx->interrupt_callback, nullptr);
+        if (ret < 0) return ret;
+    }
+    s->ofmtCtx->flush_packets = 0;
+
+    AVDictionary *opts = nullptr;
+    if (startWith(url, "rtsp://")) {
+        av_dict_set(&opts, "rtsp_transport", "tcp", 0);
+        av_dict_set(&opts, "muxdelay", "0.1", 0);
+    }
+    s->armIo();
+    ret = avformat_write_header(s->ofmtCtx, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        // the header was not written, there is nothing to finish
+        if (!(s->ofmtCtx->oformat->flags & AVFMT_NOFILE)) avio_closep(&s->ofmtCtx->pb);
+        return ret;
+    }
+    s->headerWritten = true;
+    return 0;
+}
+
+void StreamFanout::disconnectSink(Sink *s, bool trailer) {
+    if (!s->ofmtCtx) return;
+    s->closing = trailer;
+    if (trailer && s->headerWritten) {
+        s->armIo();
+        av_write_trailer(s->ofmtCtx);
+    }
+    s->headerWritten = false;
+    if (!(s->ofmtCtx->oformat->flags & AVFMT_NOFILE)) {
+        s->armIo();
+        avio_closep(&s->ofmtCtx->pb);
+    }
+    s->closing = false;
+    avformat_free_context(s->ofmtCtx);
+    s->ofmtCtx = nullptr;
+}
+
+// Writes until the connection fails (true) or the sink is stopped (false).
+bool StreamFanout::streamSink(Sink *s) {
+    AVRational otb = s->ofmtCtx->streams[0]->time_base;
+    s->paceBaseDts = AV_NOPTS_VALUE;
+
+    while (!s->stopping) {
+        s->batch.clear();
+        if (!s->queue.popAll(s->batch, -1)) break;
+
+        int written = 0, errors = 0, lastError = 0;
+        int64_t bytes = 0, delaySum = 0, delayMax = 0, delayLast = 0;
+        bool lost = false;
+        for (auto &qp : s->batch) {
+            if (s->stopping) break;
+            const AVPacket *pkt = qp.pkt.get();
+            if (s->param.pace && pkt->dts != AV_NOPTS_VALUE) {
+                int64_t now = av_gettime_relative();
+                int64_t due = s->paceBaseDts == AV_NOPTS_VALUE ? now :
+                              s->paceBaseUs + av_rescale_q(pkt->dts - s->paceBaseDts, mTimeBase, AV_TIME_BASE_Q);
+                // first packet, or the timeline jumped (loop, discontinuity): start over from here
+                if (due - now > AV_TIME_BASE || now - due > AV_TIME_BASE) {
+                    s->paceBaseDts = pkt->dts;
+                    s->paceBaseUs = now;
+                    due = now;
+                }
+                if (due > now && !waitFor(s, due - now)) break;
+            }
+
+            int ret = av_packet_ref(s->scratch, pkt);
+            if (ret < 0) {
+                errors++;
+                lastError = ret;
+                continue;
+            }
+            s->scratch->stream_index = 0;
+            av_packet_rescale_ts(s->scratch, mTimeBase, otb);
+            int size = s->scratch->size;
+            s->armIo();
+            ret = av_interleaved_write_frame(s->ofmtCtx, s->scratch);
+            av_packet_unref(s->scratch);
+            if (ret < 0) {
+                errors++;
+                lastError = ret;
+                // a rejected timestamp costs one packet, anything else is the connection
+                if (ret != AVERROR(EINVAL)) {
+                    char err[AV_ERROR_MAX_STRING_SIZE] = {0};
+                    OTL_LOGW(TAG, "sink %d: write failed: %s", s->id, av_make_error_string(err, sizeof(err), ret));
+                    lost = true;
+                    break;
+                }
+                continue;
+            }
+            bytes += size;
+            delayLast = av_gettime_relative() - qp.enqueueUs;
+            delaySum += delayLast;
+            delayMax = std::max(delayMax, delayLast);
+            written++;
+        }
+        s->batch.clear();
+        if (written > 0 && !lost && s->ofmtCtx->pb) {
+            s->armIo();
+            avio_flush(s->ofmtCtx->pb);
+            // a flush cut short by the deadline leaves the context in error
+            if (s->ofmtCtx->pb->error < 0) {
+                errors++;
+                lastError = s->ofmtCtx->pb->error;
+                OTL_LOGW(TAG, "sink %d: flush failed: %d", s->id, lastError);
+                lost = true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(s->statsLock);
+            FanoutSinkStats &st = s->stats;
+            st.writeErrors += errors;
+            if (errors > 0) st.lastError = lastError;
+            if (written > 0) {
+                st.written += written;
+                st.bytes += bytes;
+                st.lastDelayUs = delayLast;
+                st.maxDelayUs = std::max(st.maxDelayUs, delayMax);
+                st.avgDelayUs += (delaySum / written - st.avgDelayUs) / 16;
+            }
+        }
+        if (lost) return true;
+    }
+    return false;
+}
+
+void StreamFanout::sinkLoop(Sink *s) {
+    int backoffMs = s->param.reconnectMinMs;
+    while (!s->stopping) {
+        setState(s, FanoutSinkState::Connecting);
+        int ret = connectSink(s);
+        if (ret >= 0) {
+            OTL_LOGI(TAG, "sink %d: connected to %s", s->id, s->param.url.c_str());
+            {
+                std::lock_guard<std::mutex> lk(s->statsLock);
+                s->stats.connects++;
+                s->stats.state = FanoutSinkState::Streaming;
+            }
+            backoffMs = s->param.reconnectMinMs;
+            // whatever piled up while connecting is stale, start fresh on the next keyframe
+            s->queue.restartAtKeyframe();
+            if (!streamSink(s)) break;
+
+            disconnectSink(s, false);
+            std::lock_guard<std::mutex> lk(s->statsLock);
+            s->stats.disconnects++;
+        } else {
+            disconnectSink(s, false);
+            if (s->stopping) break;
+            char err[AV_ERROR_MAX_STRING_SIZE] = {0};
+            OTL_LOGW(TAG, "sink %d: connect to %s failed: %s, retry in %d ms", s->id, s->param.url.c_str(),
+                     av_make_error_string(err, sizeof(err), ret), backoffMs);
+            std::lock_guard<std::mutex> lk(s->statsLock);
+            s->stats.lastError = ret;
+        }
+
+        setState(s, FanoutSinkState::Backoff);
+        if (!waitFor(s, (int64_t)backoffMs * 1000)) break;
+        backoffMs = std::min(backoffMs * 2, s->param.reconnectMaxMs);
+    }
+    disconnectSink(s, true);
+    setState(s, FanoutSinkState::Stopped);
+}
+
+} // namespace otl
@@ -0,0 +1,94 @@
+#ifndef STREAM_FANOUT_H
+#define STREAM_FANOUT_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "otl_ffmpeg.h"
+#include "stream_encoder.h"
+#include "stream_packet_queue.h"
+#include "timestamp_smoother.h"
+
+namespace otl {
+
+struct FanoutSinkParam {
+    std::string url;
+    std::string formatName;             // empty: from the url scheme, or guessed for files
+    PacketQueueParam backlog;           // beyond it the sink drops whole GOPs
+    bool pace{false};                   // release packets in real time by dts (file sources)
+    int ioTimeoutMs{5000};              // a connect, header or write blocked longer is a disconnect, 0 = no limit
+    int reconnectMinMs{500};
+    int reconnectMaxMs{30000};
+};
+
+enum class FanoutSinkState : int8_t {
+    Connecting = 0,
+    Streaming,
+    Backoff,                            // waiting before the next connect attempt
+    Stopped
+};
+
+struct FanoutSinkStats {
+    int id{0};
+    std::string url;
+    FanoutSinkState state{FanoutSinkState::Connecting};
+    int connects{0};
+    int disconnects{0};
+    int lastError{0};
+    int64_t written{0};
+    int64_t bytes{0};
+    int64_t writeErrors{0};
+    int64_t lastDelayUs{0};             // inputPacket() -> written by this sink
+    int64_t avgDelayUs{0};
+    int64_t maxDelayUs{0};
+    PacketQueueStats backlog;
+};
+
+// One encoded stream to several destinations. inputPacket() takes a single reference and
+// smooths timestamps once; every sink queues the same shared packet. Each sink has its own
+// thread, backlog bound, optional pacing and connect / stream / back off cycle, so a slow or
+// unreachable destination only drops its own GOPs and never holds up the others.
+class StreamFanout : public FfmpegGlobal {
+public:
+    StreamFanout();
+    ~StreamFanout() override;
+
+    // Describes the stream all sinks carry; packets passed in are in timeBase.
+    int open(const AVCodecParameters *codecpar, AVRational timeBase);
+    // Returns the sink id (>= 0). The sink connects on its own thread.
+    int addSink(const FanoutSinkParam &param);
+    int removeSink(int id);
+
+    // The packet is referenced, not consumed. Returns how many sinks queued it; a sink that
+    // is behind or not connected drops it on its own.
+    int inputPacket(const AVPacket *pkt);
+    void close();
+
+    void configureTimestampSmoother(double smoothingFactor, int64_t maxJumpThreshold, int64_t minIncrement);
+    std::vector<FanoutSinkStats> stats();
+
+private:
+    struct Sink;
+
+    static int interruptCallback(void *opaque);
+    void sinkLoop(Sink *s);
+    int connectSink(Sink *s);
+    void disconnectSink(Sink *s, bool trailer);
+    bool streamSink(Sink *s);
+    bool waitFor(Sink *s, int64_t us);
+    void setState(Sink *s, FanoutSinkState state);
+    void stopSink(Sink *s);
+
+    std::mutex mLock;
+    std::vector<std::shared_ptr<Sink>> mSinks;
+    AVCodecParameters *mCodecPar{nullptr};
+    AVRational mTimeBase{1, 90000};
+    int mNextId{0};
+    std::shared_ptr<PacketPool> mPool{PacketPool::create(64)};
+    TimestampSmoother mTimestampSmoother;
+};
+
+} // namespace otl
+
+#endif // STREAM_FANOUT_H
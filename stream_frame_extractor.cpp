@@ -0,0 +1,243 @@
+#include "stream_frame_extractor.h"
+
+#include <algorithm>
+
+namespace otl {
+
+FrameExtractor::~FrameExtractor() {
+    close();
+    av_dict_free(&mOptsDecoder);
+}
+
+void FrameExtractor::setDecoderOptions(const AVDictionary *opts) {
+    av_dict_free(&mOptsDecoder);
+    av_dict_copy(&mOptsDecoder, opts, 0);
+}
+
+void FrameExtractor::close() {
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    av_frame_free(&mFrame);
+    av_packet_free(&mPacket);
+#endif
+    avcodec_free_context(&mDecCtx);
+    avformat_close_input(&mIfmtCtx);
+    mIndex.clear();
+    mUrl.clear();
+}
+
+#if LIBAVCODEC_VERSION_MAJOR > 56
+
+static int64_t frameTimestamp(const AVFrame *frame) {
+    return frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+}
+
+int FrameExtractor::open(const std::string &url) {
+    if (mIfmtCtx != nullptr && url == mUrl) return 0;
+    close();
+
+    int ret = avformat_open_input(&mIfmtCtx, url.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        printf("FrameExtractor: can't open %s\n", url.c_str());
+        return ret;
+    }
+    ret = avformat_find_stream_info(mIfmtCtx, nullptr);
+    if (ret < 0) return ret;
+    int streamIndex = av_find_best_stream(mIfmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (streamIndex < 0) return streamIndex;
+    AVStream *st = mIfmtCtx->streams[streamIndex];
+
+    mStats.sidecarHit = false;
+    std::string sidecar = KeyframeIndex::sidecarPathFor(url);
+    if (mUseSidecar && mIndex.load(sidecar, url) == 0 && mIndex.streamIndex() == streamIndex &&
+        mIndex.timeBase().num == st->time_base.num && mIndex.timeBase().den == st->time_base.den) {
+        mStats.sidecarHit = true;
+    } else {
+        ret = mIndex.build(mIfmtCtx, streamIndex);
+        if (ret < 0) return ret;
+        // the container index is already in the file, a sidecar only pays off after a scan
+        if (mUseSidecar && !mIndex.fromContainer() && mIndex.save(sidecar, url) < 0) {
+            printf("FrameExtractor: can't write %s\n", sidecar.c_str());
+        }
+    }
+
+    for (unsigned int i = 0; i < mIfmtCtx->nb_streams; ++i) {
+        if ((int)i != streamIndex) mIfmtCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (codec == nullptr) return AVERROR_DECODER_NOT_FOUND;
+    mDecCtx = avcodec_alloc_context3(codec);
+    if (mDecCtx == nullptr) return AVERROR(ENOMEM);
+    ret = avcodec_parameters_to_context(mDecCtx, st->codecpar);
+    if (ret < 0) return ret;
+    decodeThreadsConfigure(mDecCtx, mOptsDecoder, &mThreadInfo);
+    AVDictionary *opts = nullptr;
+    av_dict_copy(&opts, mOptsDecoder, 0);
+    ret = avcodec_open2(mDecCtx, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) return ret;
+    decodeThreadsReport(mDecCtx, st->avg_frame_rate, &mThreadInfo);
+
+    mPacket = av_packet_alloc();
+    mFrame = av_frame_alloc();
+    if (mPacket == nullptr || mFrame == nullptr) return AVERROR(ENOMEM);
+
+    mUrl = url;
+    return 0;
+}
+
+int FrameExtractor::extractFrames(const std::string &url, const std::vector<int64_t> &pts,
+                                  std::vector<AVFrame *> &frames) {
+    int64_t startTime = av_gettime_relative();
+    bool sidecarHit = mStats.sidecarHit;
+    mStats = FrameExtractStats();
+    mStats.sidecarHit = sidecarHit;
+    mStats.requests = (int)pts.size();
+    frames.assign(pts.size(), nullptr);
+    if (pts.empty()) return 0;
+
+    int ret = open(url);
+    if (ret < 0) {
+        close();
+        return ret;
+    }
+
+    std::vector<Request> sorted(pts.size());
+    for (size_t i = 0; i < pts.size(); ++i) {
+        sorted[i].pts = pts[i];
+        sorted[i].slot = (int)i;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Request &a, const Request &b) { return a.pts < b.pts; });
+
+    // One decode pass per GOP that has requests. Without keyframe pts the index is keyed by
+    // dts, so a request just before a keyframe's pts can land one GOP too late; those come
+    // back as deferred and get a second pass on the previous GOP.
+    std::vector<Request> deferred;
+    size_t i = 0;
+    while (i < sorted.size()) {
+        int gop = std::max(0, mIndex.findGop(sorted[i].pts));
+        size_t j = i;
+        std::vector<Request> group;
+        while (j < sorted.size() && std::max(0, mIndex.findGop(sorted[j].pts)) == gop) group.push_back(sorted[j++]);
+        ret = decodeGop(gop, group, true, frames, deferred);
+        if (ret < 0) printf("FrameExtractor: gop %d decode failed, ret=%d\n", gop, ret);
+        i = j;
+    }
+
+    std::vector<Request> unused;
+    i = 0;
+    while (i < deferred.size()) {
+        int gop = std::max(0, mIndex.findGop(deferred[i].pts) - 1);
+        size_t j = i;
+        std::vector<Request> group;
+        while (j < deferred.size() && std::max(0, mIndex.findGop(deferred[j].pts) - 1) == gop) group.push_back(deferred[j++]);
+        decodeGop(gop, group, false, frames, unused);
+        i = j;
+    }
+
+    for (auto f : frames) {
+        if (f) mStats.found++;
+    }
+    mStats.elapsedUs = av_gettime_relative() - startTime;
+    return mStats.found > 0 ? 0 : AVERROR_INVALIDDATA;
+}
+
+int FrameExtractor::decodeGop(int gop, const std::vector<Request> &reqs, bool allowRetry,
+                              std::vector<AVFrame *> &frames, std::vector<Request> &deferred) {
+    const KeyframeEntry &key = mIndex.entries()[gop];
+    const int streamIndex = mIndex.streamIndex();
+
+    avcodec_flush_buffers(mDecCtx);
+    int ret = -1;
+    if (key.timestamp != AV_NOPTS_VALUE) {
+        ret = av_seek_frame(mIfmtCtx, streamIndex, key.timestamp, AVSEEK_FLAG_BACKWARD);
+    }
+    if (ret < 0 && key.pos >= 0) {
+        ret = av_seek_frame(mIfmtCtx, streamIndex, key.pos, AVSEEK_FLAG_BYTE);
+    }
+    if (ret < 0) return ret;
+    mStats.gopsDecoded++;
+
+    size_t next = 0;
+    bool started = false;
+    bool flushing = false;
+    int64_t startPts = AV_NOPTS_VALUE;
+    AVFrame *prev = nullptr;
+    auto answer = [&](const AVFrame *frame) {
+        av_frame_free(&frames[reqs[next].slot]);
+        frames[reqs[next].slot] = av_frame_clone(frame);
+        next++;
+    };
+
+    while (next < reqs.size()) {
+        if (!flushing) {
+            ret = av_read_frame(mIfmtCtx, mPacket);
+            if (ret < 0) {
+                // end of file: drain what the decoder still holds
+                flushing = true;
+                avcodec_send_packet(mDecCtx, nullptr);
+            } else if (mPacket->stream_index != streamIndex) {
+                av_packet_unref(mPacket);
+                continue;
+            } else {
+                if (!started) {
+                    if (!(mPacket->flags & AV_PKT_FLAG_KEY) || !keyframeReached(mPacket, key)) {
+                        av_packet_unref(mPacket);
+                        continue;
+                    }
+                    started = true;
+                    startPts = mPacket->pts != AV_NOPTS_VALUE ? mPacket->pts : mPacket->dts;
+                    while (allowRetry && gop > 0 && startPts != AV_NOPTS_VALUE &&
+                           next < reqs.size() && reqs[next].pts < startPts) {
+                        deferred.push_back(reqs[next++]);
+                    }
+                }
+                ret = avcodec_send_packet(mDecCtx, mPacket);
+                av_packet_unref(mPacket);
+                if (ret < 0) continue;
+            }
+        }
+
+        while (next < reqs.size()) {
+            ret = avcodec_receive_frame(mDecCtx, mFrame);
+            if (ret < 0) break;
+            int64_t t = frameTimestamp(mFrame);
+            // leading pictures of an open GOP reference the previous GOP and are not shown from here
+            if (t != AV_NOPTS_VALUE && startPts != AV_NOPTS_VALUE && t < startPts) {
+                av_frame_unref(mFrame);
+                continue;
+            }
+            mStats.framesDecoded++;
+            while (next < reqs.size() && t != AV_NOPTS_VALUE && reqs[next].pts < t) {
+                answer(prev ? prev : mFrame);
+            }
+            while (next < reqs.size() && (t == AV_NOPTS_VALUE || reqs[next].pts == t)) {
+                answer(mFrame);
+            }
+            if (prev == nullptr) prev = av_frame_alloc();
+            av_frame_unref(prev);
+            av_frame_move_ref(prev, mFrame);
+        }
+        if (flushing && ret < 0) break;
+    }
+
+    // past the last frame of the file
+    while (next < reqs.size() && prev != nullptr) {
+        answer(prev);
+    }
+    av_frame_free(&prev);
+    return started ? 0 : AVERROR_INVALIDDATA;
+}
+
+#else
+
+int FrameExtractor::extractFrames(const std::string &url, const std::vector<int64_t> &pts,
+                                  std::vector<AVFrame *> &frames) {
+    frames.assign(pts.size(), nullptr);
+    printf("FrameExtractor: needs the send/receive decode API (libavcodec > 56)\n");
+    return AVERROR(ENOSYS);
+}
+
+#endif
+
+} // namespace otl
@@ -0,0 +1,69 @@
+#ifndef STREAM_FRAME_EXTRACTOR_H
+#define STREAM_FRAME_EXTRACTOR_H
+
+#include <string>
+#include <vector>
+#include "stream_keyframe_index.h"
+#include "stream_decode_threads.h"
+
+namespace otl {
+
+struct FrameExtractStats {
+    int requests{0};
+    int found{0};
+    int gopsDecoded{0};
+    int framesDecoded{0};
+    int64_t elapsedUs{0};       // last extractFrames() call, open and index included
+    bool sidecarHit{false};     // index came from the sidecar instead of the media file
+};
+
+// Random access frame extraction (snapshots, evidence frames) on recorded files.
+// Requests are sorted and grouped by GOP through the keyframe index, each needed GOP is
+// decoded once from its keyframe, and decoding stops as soon as the last request of the
+// GOP is answered. The index is kept in a "<file>.kfi" sidecar so files without a
+// container index (ts, flv) are scanned only the first time.
+class FrameExtractor : public FfmpegGlobal {
+public:
+    FrameExtractor() = default;
+    virtual ~FrameExtractor();
+
+    // Decoder opts, same keys as StreamDecoder ("dec_thread_mode", "dec_threads").
+    void setDecoderOptions(const AVDictionary *opts);
+    void setSidecarEnabled(bool enable) { mUseSidecar = enable; }
+
+    // pts are in the video stream time_base (see timeBase()). frames[i] receives the frame
+    // shown at pts[i], i.e. the last frame with pts <= pts[i] (the first frame if pts[i] lies
+    // before it), or nullptr if nothing could be decoded. The caller frees them with
+    // av_frame_free(). The file stays open for further calls with the same url.
+    int extractFrames(const std::string &url, const std::vector<int64_t> &pts, std::vector<AVFrame *> &frames);
+    void close();
+
+    AVRational timeBase() const { return mIndex.timeBase(); }
+    const KeyframeIndex &index() const { return mIndex; }
+    const FrameExtractStats &stats() const { return mStats; }
+
+private:
+    struct Request {
+        int64_t pts;
+        int slot;
+    };
+
+    int open(const std::string &url);
+    int decodeGop(int gop, const std::vector<Request> &reqs, bool allowRetry,
+                  std::vector<AVFrame *> &frames, std::vector<Request> &deferred);
+
+    std::string mUrl;
+    AVFormatContext *mIfmtCtx{nullptr};
+    AVCodecContext *mDecCtx{nullptr};
+    AVPacket *mPacket{nullptr};
+    AVFrame *mFrame{nullptr};
+    AVDictionary *mOptsDecoder{nullptr};
+    DecodeThreadInfo mThreadInfo;
+    KeyframeIndex mIndex;
+    FrameExtractStats mStats;
+    bool mUseSidecar{true};
+};
+
+} // namespace otl
+
+#endif // STREAM_FRAME_EXTRACTOR_H
@@ -0,0 +1,104 @@
+#include "stream_ingest_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace otl {
+
+// larger timing stream steps are counted as discontinuities, not as jitter
+static const int64_t kMaxTsStepUs = 1000000;
+
+IngestMonitor::IngestMonitor()
+    : mByteStat(StatTool::create()), mPacketStat(StatTool::create()),
+      mFrameStat(StatTool::create()), mErrorStat(StatTool::create()) {
+}
+
+void IngestMonitor::reset() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mByteStat->reset();
+    mPacketStat->reset();
+    mFrameStat->reset();
+    mErrorStat->reset();
+    mStats = IngestStats();
+    mOpenCount = 0;
+    mLastArrivalUs = 0;
+    mLastTimingArrivalUs = 0;
+    mLastTimingTsUs = AV_NOPTS_VALUE;
+    mJitterUs = 0;
+}
+
+void IngestMonitor::onOpened() {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mOpenCount++ > 0) mStats.reconnects++;
+    mStats.opened = true;
+    // the gap while reconnecting is accounted as reconnect, not as a stall
+    mLastArrivalUs = 0;
+    mLastTimingArrivalUs = 0;
+    mLastTimingTsUs = AV_NOPTS_VALUE;
+}
+
+void IngestMonitor::onClosed() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mStats.opened = false;
+}
+
+void IngestMonitor::onPacket(const AVPacket *pkt, bool timingStream, AVRational timeBase) {
+    int64_t now = av_gettime_relative();
+    std::lock_guard<std::mutex> lk(mLock);
+    mStats.packets++;
+    mStats.bytes += pkt->size;
+    mByteStat->update(pkt->size);
+    mPacketStat->update(1);
+    if (mLastArrivalUs > 0) {
+        mStats.longestStallMs = std::max(mStats.longestStallMs, (now - mLastArrivalUs) / 1000);
+    }
+    mLastArrivalUs = now;
+
+    if (!timingStream) return;
+    mFrameStat->update(1);
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    if (ts == AV_NOPTS_VALUE) return;
+    ts = av_rescale_q(ts, timeBase, av_make_q(1, AV_TIME_BASE));
+    if (mLastTimingTsUs != AV_NOPTS_VALUE) {
+        int64_t tsStep = ts - mLastTimingTsUs;
+        if (tsStep < -kMaxTsStepUs || tsStep > kMaxTsStepUs) {
+            mStats.discontinuities++;
+        } else {
+            // B frames step pts backwards a little, that is reordering and still fine here
+            double d = (double)(now - mLastTimingArrivalUs) - (double)tsStep;
+            mJitterUs += (std::fabs(d) - mJitterUs) / 16.0;
+        }
+    }
+    mLastTimingTsUs = ts;
+    mLastTimingArrivalUs = now;
+}
+
+void IngestMonitor::onReadError(int err) {
+    std::lock_guard<std::mutex> lk(mLock);
+    mStats.readErrors++;
+    mStats.lastReadError = err;
+    mErrorStat->update(1);
+}
+
+IngestStats IngestMonitor::snapshot() {
+    int64_t now = av_gettime_relative();
+    std::lock_guard<std::mutex> lk(mLock);
+    IngestStats s = mStats;
+    // StatTool only samples on update, a silent stream would keep its last rate
+    mByteStat->update(0);
+    mPacketStat->update(0);
+    mFrameStat->update(0);
+    mErrorStat->update(0);
+    s.kbps = mByteStat->getkbps();
+    s.packetRate = mPacketStat->getSpeed();
+    s.fps = mFrameStat->getSpeed();
+    s.readErrorRate = mErrorStat->getSpeed();
+    s.ptsJitterMs = mJitterUs / 1000.0;
+    if (mLastArrivalUs > 0) {
+        s.currentStallMs = (now - mLastArrivalUs) / 1000;
+        s.longestStallMs = std::max(s.longestStallMs, s.currentStallMs);
+    }
+    return s;
+}
+
+} // namespace otl
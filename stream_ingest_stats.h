@@ -0,0 +1,58 @@
+#ifndef STREAM_INGEST_STATS_H
+#define STREAM_INGEST_STATS_H
+
+#include <mutex>
+#include <string>
+#include "otl_ffmpeg.h"
+#include "otl_timer.h"
+
+namespace otl {
+
+struct IngestStats {
+    int64_t packets{0};
+    int64_t bytes{0};
+    double kbps{0};                 // rates are over the last ~5 seconds
+    double packetRate{0};
+    double fps{0};                  // packets of the timing (video) stream per second
+    double ptsJitterMs{0};          // RFC 3550 interarrival jitter of the timing stream
+    int64_t discontinuities{0};     // timing stream timestamps going back or jumping > 1s
+    int64_t readErrors{0};
+    int lastReadError{0};
+    double readErrorRate{0};        // errors per second
+    int64_t longestStallMs{0};      // longest gap between two packets
+    int64_t currentStallMs{0};      // time since the last packet
+    int64_t reconnects{0};
+    bool opened{false};
+};
+
+// Ingest health of one demuxer, fed from its read thread and read from any thread. Tells a
+// camera problem (stalls, jitter, timestamp jumps at low load) from local overload.
+class IngestMonitor {
+public:
+    IngestMonitor();
+
+    void reset();
+    void onOpened();
+    void onClosed();
+    void onPacket(const AVPacket *pkt, bool timingStream, AVRational timeBase);
+    void onReadError(int err);
+
+    IngestStats snapshot();
+
+private:
+    std::mutex mLock;
+    StatToolPtr mByteStat;
+    StatToolPtr mPacketStat;
+    StatToolPtr mFrameStat;
+    StatToolPtr mErrorStat;
+    IngestStats mStats;
+    int64_t mOpenCount{0};
+    int64_t mLastArrivalUs{0};
+    int64_t mLastTimingArrivalUs{0};
+    int64_t mLastTimingTsUs{AV_NOPTS_VALUE};
+    double mJitterUs{0};
+};
+
+} // namespace otl
+
+#endif // STREAM_INGEST_STATS_H
@@ -0,0 +1,277 @@
+#include "stream_input_source.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace otl {
+
+AVIOContext *StreamInputSource::createAVIOContext(int bufferSize) {
+    uint8_t *buffer = (uint8_t *)av_malloc(bufferSize);
+    if (buffer == nullptr) return nullptr;
+    AVIOContext *pb = avio_alloc_context(buffer, bufferSize, 0, this, readPacket, nullptr,
+                                         seekable() ? seekPacket : nullptr);
+    if (pb == nullptr) {
+        av_free(buffer);
+        return nullptr;
+    }
+    pb->direct = directRead() ? 1 : 0;
+    return pb;
+}
+
+void StreamInputSource::freeAVIOContext(AVIOContext **pb) {
+    if (pb == nullptr || *pb == nullptr) return;
+    // libavformat may have swapped the buffer, free whatever it holds now
+    av_freep(&(*pb)->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+    avio_context_free(pb);
+#else
+    av_freep(pb);
+#endif
+}
+
+int StreamInputSource::readPacket(void *opaque, uint8_t *buf, int size) {
+    int ret = static_cast<StreamInputSource *>(opaque)->read(buf, size);
+    return ret == 0 ? AVERROR_EOF : ret;
+}
+
+int64_t StreamInputSource::seekPacket(void *opaque, int64_t offset, int whence) {
+    return static_cast<StreamInputSource *>(opaque)->seek(offset, whence & ~AVSEEK_FORCE);
+}
+
+MmapInputSource::MmapInputSource(const std::string &path, const MmapInputParam &param)
+    : mPath(path), mParam(param) {
+}
+
+MmapInputSource::~MmapInputSource() {
+    close();
+}
+
+bool MmapInputSource::localFilePath(const std::string &url, std::string *path) {
+    std::string prefix = "file:";
+    std::string p = url.compare(0, prefix.size(), prefix) == 0 ? url.substr(prefix.size()) : url;
+    if (p.empty() || p.find("://") != std::string::npos) return false;
+    if (path) *path = p;
+    return true;
+}
+
+int MmapInputSource::open() {
+    close();
+
+    mFd = ::open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (mFd < 0) {
+        printf("mmap input: can't open %s\n", mPath.c_str());
+        return AVERROR(errno);
+    }
+    struct stat st;
+    if (fstat(mFd, &st) != 0 || st.st_size <= 0) {
+        close();
+        return AVERROR_INVALIDDATA;
+    }
+    mSize = st.st_size;
+    void *addr = mmap(nullptr, (size_t)mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        close();
+        return AVERROR(err);
+    }
+    mData = (uint8_t *)addr;
+    // the mapping keeps the file referenced
+    ::close(mFd);
+    mFd = -1;
+
+    switch (mParam.hint) {
+        case MmapAccessHint::Sequential: madvise(mData, (size_t)mSize, MADV_SEQUENTIAL); break;
+        case MmapAccessHint::Random:     madvise(mData, (size_t)mSize, MADV_RANDOM); break;
+        default: break;
+    }
+    mPos = 0;
+
+    if (mParam.readaheadBytes > 0) {
+        mReadaheadRunning = true;
+        mReadaheadThread = new std::thread(&MmapInputSource::readaheadLoop, this);
+    }
+    return 0;
+}
+
+void MmapInputSource::close() {
+    if (mReadaheadThread != nullptr) {
+        {
+            std::lock_guard<std::mutex> lk(mReadaheadLock);
+            mReadaheadRunning = false;
+        }
+        mReadaheadCond.notify_all();
+        mReadaheadThread->join();
+        delete mReadaheadThread;
+        mReadaheadThread = nullptr;
+    }
+    if (mData != nullptr) {
+        munmap(mData, (size_t)mSize);
+        mData = nullptr;
+    }
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+    mSize = 0;
+    mPos = 0;
+}
+
+int MmapInputSource::read(uint8_t *buf, int size) {
+    int64_t pos = mPos;
+    if (mData == nullptr) return AVERROR(EBADF);
+    if (pos >= mSize) return AVERROR_EOF;
+    int n = (int)std::min<int64_t>(size, mSize - pos);
+    memcpy(buf, mData + pos, n);
+    mPos = pos + n;
+    if (mReadaheadThread != nullptr) mReadaheadCond.notify_one();
+    return n;
+}
+
+int64_t MmapInputSource::seek(int64_t offset, int whence) {
+    int64_t pos;
+    switch (whence) {
+        case AVSEEK_SIZE: return mSize;
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = mPos + offset; break;
+        case SEEK_END: pos = mSize + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > mSize) return AVERROR(EINVAL);
+    mPos = pos;
+    if (mReadaheadThread != nullptr) mReadaheadCond.notify_one();
+    return pos;
+}
+
+void MmapInputSource::readaheadLoop() {
+    const int64_t page = sysconf(_SC_PAGESIZE);
+    const int64_t chunk = 1 << 20;
+    const int64_t window = (int64_t)mParam.readaheadBytes;
+    int64_t prefetched = 0;
+    volatile uint8_t sink = 0;
+
+    std::unique_lock<std::mutex> lk(mReadaheadLock);
+    while (mReadaheadRunning) {
+        int64_t pos = mPos;
+        // the reader seeked outside the prefetched window: restart from its position
+        if (pos > prefetched || pos + 2 * window < prefetched) {
+            prefetched = pos & ~(page - 1);
+        }
+        int64_t target = std::min(mSize, pos + window);
+        if (prefetched >= target) {
+            mReadaheadCond.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
+        }
+
+        lk.unlock();
+        int64_t len = std::min(chunk, target - prefetched);
+        int64_t aligned = prefetched & ~(page - 1);
+        madvise(mData + aligned, (size_t)(prefetched + len - aligned), MADV_WILLNEED);
+        // touching the pages takes the major faults here instead of on the demux thread
+        for (int64_t off = prefetched; off < prefetched + len; off += page) {
+            sink = sink + mData[off];
+        }
+        prefetched += len;
+        lk.lock();
+    }
+}
+
+ChunkQueueInputSource::ChunkQueueInputSource(size_t maxChunks, const char *formatName)
+    : mQueue(maxChunks), mFormatName(formatName) {
+}
+
+ChunkQueueInputSource::~ChunkQueueInputSource() {
+    close();
+    AVBufferRef *buf = nullptr;
+    while (mQueue.tryPop(buf)) av_buffer_unref(&buf);
+}
+
+int ChunkQueueInputSource::pushChunk(AVBufferRef *buf) {
+    if (buf == nullptr) return AVERROR(EINVAL);
+    if (mEof) return AVERROR_EOF;
+    if (!mQueue.tryPush(std::move(buf))) return AVERROR(EAGAIN);
+    if (mReaderWaiting) {
+        std::lock_guard<std::mutex> lk(mWaitLock);
+        mWaitCond.notify_one();
+    }
+    return 0;
+}
+
+int ChunkQueueInputSource::pushChunk(uint8_t *data, int size, void (*freeFunc)(void *opaque, uint8_t *data),
+                                     void *opaque) {
+    if (mEof) return AVERROR_EOF;
+    // only this thread pushes, so room seen here is still there after av_buffer_create()
+    if (mQueue.size() >= mQueue.capacity()) return AVERROR(EAGAIN);
+    AVBufferRef *buf = av_buffer_create(data, size, freeFunc, opaque, AV_BUFFER_FLAG_READONLY);
+    if (buf == nullptr) return AVERROR(ENOMEM);
+    int ret = pushChunk(buf);
+    if (ret < 0) av_buffer_unref(&buf);
+    return ret;
+}
+
+void ChunkQueueInputSource::endOfStream() {
+    mEof = true;
+    std::lock_guard<std::mutex> lk(mWaitLock);
+    mWaitCond.notify_one();
+}
+
+void ChunkQueueInputSource::interrupt() {
+    mInterrupted = true;
+    std::lock_guard<std::mutex> lk(mWaitLock);
+    mWaitCond.notify_one();
+}
+
+int ChunkQueueInputSource::open() {
+    mInterrupted = false;
+    // the previous session read up to endOfStream(), what is pushed now is a new stream; an
+    // end of stream signalled before it was reached still applies to this session
+    if (mEofDelivered) {
+        mEof = false;
+        mEofDelivered = false;
+    }
+    return 0;
+}
+
+void ChunkQueueInputSource::close() {
+    // a partly read chunk belongs to the closed session's container state
+    av_buffer_unref(&mCurrent);
+    mOffset = 0;
+}
+
+int ChunkQueueInputSource::read(uint8_t *buf, int size) {
+    int64_t deadline = mReadTimeoutMs > 0 ? av_gettime_relative() + (int64_t)mReadTimeoutMs * 1000 : 0;
+    while (mCurrent == nullptr) {
+        if (mQueue.tryPop(mCurrent)) {
+            mOffset = 0;
+            break;
+        }
+        if (mInterrupted) return AVERROR_EXIT;
+        if (mEof) {
+            // a push may have landed between the pop and the flag check
+            if (mQueue.tryPop(mCurrent)) {
+                mOffset = 0;
+                break;
+            }
+            mEofDelivered = true;
+            return AVERROR_EOF;
+        }
+        if (deadline > 0 && av_gettime_relative() > deadline) return AVERROR(ETIMEDOUT);
+
+        std::unique_lock<std::mutex> lk(mWaitLock);
+        mReaderWaiting = true;
+        if (mQueue.size() == 0 && !mInterrupted && !mEof) {
+            mWaitCond.wait_for(lk, std::chrono::milliseconds(10));
+        }
+        mReaderWaiting = false;
+    }
+
+    int n = std::min(size, (int)mCurrent->size - mOffset);
+    memcpy(buf, mCurrent->data + mOffset, n);
+    mOffset += n;
+    if (mOffset >= (int)mCurrent->size) av_buffer_unref(&mCurrent);
+    return n;
+}
+
+} // namespace otl
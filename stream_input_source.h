@@ -0,0 +1,156 @@
+#ifndef STREAM_INPUT_SOURCE_H
+#define STREAM_INPUT_SOURCE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "otl_ffmpeg.h"
+#include "otl_thread_queue.h"
+
+namespace otl {
+
+// Byte source behind a custom AVIOContext, used by StreamDemuxer instead of an FFmpeg protocol.
+// open() is called before every avformat_open_input(), reconnects included, and close() after
+// the format context is gone.
+class StreamInputSource {
+public:
+    virtual ~StreamInputSource() {}
+
+    virtual int open() = 0;
+    virtual void close() = 0;
+    // Returns bytes read, or AVERROR_EOF at the end of the input.
+    virtual int read(uint8_t *buf, int size) = 0;
+    // whence is SEEK_SET/SEEK_CUR/SEEK_END or AVSEEK_SIZE; only called when seekable().
+    virtual int64_t seek(int64_t offset, int whence) { return AVERROR(ENOSYS); }
+    virtual bool seekable() const { return false; }
+    // Large reads go straight into the caller's (packet) buffer instead of through the
+    // AVIOContext buffer; worth it when read() itself is just a memcpy.
+    virtual bool directRead() const { return false; }
+    // Demuxer to use without probing, nullptr to let libavformat probe the bytes.
+    virtual const char *formatName() const { return nullptr; }
+    // Unblocks a read() waiting for data, called from StreamDemuxer::closeStream(); the next
+    // open() clears it.
+    virtual void interrupt() {}
+
+    AVIOContext *createAVIOContext(int bufferSize = 32768);
+    static void freeAVIOContext(AVIOContext **pb);
+
+private:
+    static int readPacket(void *opaque, uint8_t *buf, int size);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+};
+
+enum class MmapAccessHint : int8_t {
+    Normal = 0,
+    Sequential,     // MADV_SEQUENTIAL: aggressive kernel readahead, pages dropped behind the reader
+    Random          // MADV_RANDOM: no readahead, for seek heavy access
+};
+
+struct MmapInputParam {
+    MmapAccessHint hint{MmapAccessHint::Sequential};
+    size_t readaheadBytes{0};   // > 0: a thread keeps this much data ahead of the reader resident
+};
+
+// Local file mapped read-only. Reads are a memcpy out of the page cache, no read() syscalls;
+// with directRead() libavformat copies payloads once, from the mapping into the packet.
+class MmapInputSource : public StreamInputSource {
+public:
+    MmapInputSource(const std::string &path, const MmapInputParam &param = MmapInputParam());
+    virtual ~MmapInputSource();
+
+    int open() override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override { return true; }
+    bool directRead() const override { return true; }
+
+    const uint8_t *data() const { return mData; }
+    int64_t size() const { return mSize; }
+
+    // "file:/a.mp4" and "/a.mp4" map to "/a.mp4"; anything with another scheme is not local.
+    static bool localFilePath(const std::string &url, std::string *path);
+
+private:
+    void readaheadLoop();
+
+    std::string mPath;
+    MmapInputParam mParam;
+    int mFd{-1};
+    uint8_t *mData{nullptr};
+    int64_t mSize{0};
+    std::atomic<int64_t> mPos{0};
+
+    std::thread *mReadaheadThread{nullptr};
+    std::mutex mReadaheadLock;
+    std::condition_variable mReadaheadCond;
+    bool mReadaheadRunning{false};
+};
+
+// Input pushed by the caller, e.g. from an own RTP gateway or a message bus. Chunks are handed
+// over as AVBufferRef without copying and pass a lock-free SPSC queue to the demux thread, so
+// exactly one thread may push. Queued data survives a reconnect of the demuxer.
+class ChunkQueueInputSource : public StreamInputSource {
+public:
+    // formatName: container of the pushed bytes (e.g. "mpegts", "h264"), nullptr to probe.
+    explicit ChunkQueueInputSource(size_t maxChunks = 1024, const char *formatName = nullptr);
+    virtual ~ChunkQueueInputSource();
+
+    // Takes ownership of buf on success. AVERROR(EAGAIN): queue full, buf stays with the caller.
+    int pushChunk(AVBufferRef *buf);
+    // Zero copy wrap of caller memory, freeFunc(opaque, data) runs once the demuxer is done.
+    int pushChunk(uint8_t *data, int size, void (*freeFunc)(void *opaque, uint8_t *data), void *opaque);
+    // read() returns AVERROR_EOF once everything queued before this call is consumed. The
+    // demuxer then goes down; when it is opened again the source takes new chunks.
+    void endOfStream();
+    // read() gives up with AVERROR(ETIMEDOUT) after waiting this long for data, 0 = forever.
+    void setReadTimeout(int ms) { mReadTimeoutMs = ms; }
+    size_t queuedChunks() const { return mQueue.size(); }
+
+    int open() override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    bool directRead() const override { return true; }
+    const char *formatName() const override { return mFormatName; }
+    void interrupt() override;
+
+private:
+    SpscQueue<AVBufferRef *> mQueue;
+    const char *mFormatName;
+    AVBufferRef *mCurrent{nullptr};
+    int mOffset{0};
+    int mReadTimeoutMs{5000};
+    std::atomic<bool> mEof{false};
+    bool mEofDelivered{false};      // demux thread only
+    std::atomic<bool> mInterrupted{false};
+    // wakes a reader waiting on an empty queue; the queue itself takes no lock
+    std::atomic<bool> mReaderWaiting{false};
+    std::mutex mWaitLock;
+    std::condition_variable mWaitCond;
+};
+
+// Pull mode: every read is forwarded to the caller's function.
+class CallbackInputSource : public StreamInputSource {
+public:
+    // Returns bytes read, 0 or AVERROR_EOF at the end, another AVERROR on failure.
+    using ReadFunc = std::function<int(uint8_t *buf, int size)>;
+
+    explicit CallbackInputSource(ReadFunc read, const char *formatName = nullptr)
+        : mRead(read), mFormatName(formatName) {}
+
+    int open() override { return mRead ? 0 : AVERROR(EINVAL); }
+    void close() override {}
+    int read(uint8_t *buf, int size) override { return mRead(buf, size); }
+    const char *formatName() const override { return mFormatName; }
+
+private:
+    ReadFunc mRead;
+    const char *mFormatName;
+};
+
+} // namespace otl
+
+#endif // STREAM_INPUT_SOURCE_H
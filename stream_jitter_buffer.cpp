@@ -0,0 +1,128 @@
+#include "stream_jitter_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace otl {
+
+// larger dts steps restart the schedule instead of being waited out
+static const int64_t kMaxTsStepUs = 1000000;
+// the arrival offset is the minimum over this window and the previous one, so clock drift
+// between sender and receiver is followed
+static const int64_t kOffsetWindowUs = 10000000;
+
+JitterBuffer::JitterBuffer(const JitterBufferParam &param, ReleaseFunc release)
+    : mParam(param), mRelease(release) {
+    mTargetUs = (double)mParam.minDelayUs;
+    mThread = new std::thread(&JitterBuffer::releaseLoop, this);
+}
+
+JitterBuffer::~JitterBuffer() {
+    stop(false);
+}
+
+void JitterBuffer::push(AVPacket *pkt, bool timingStream, AVRational timeBase) {
+    int64_t now = av_gettime_relative();
+    std::unique_lock<std::mutex> lk(mLock);
+    if (!mRunning) {
+        av_packet_free(&pkt);
+        return;
+    }
+
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    int64_t due = mLastDue > 0 ? mLastDue : now;
+    if (timingStream && ts != AV_NOPTS_VALUE) {
+        ts = av_rescale_q(ts, timeBase, av_make_q(1, AV_TIME_BASE));
+        int64_t offset = now - ts;
+        int64_t step = mLastTs != AV_NOPTS_VALUE ? ts - mLastTs : 0;
+        if (mLastTs == AV_NOPTS_VALUE || step < 0 || step > kMaxTsStepUs) {
+            if (mLastTs != AV_NOPTS_VALUE) mStats.discontinuities++;
+            mOffsetCur = mOffsetPrev = offset;
+            mWindowStart = now;
+        } else {
+            double d = (double)(now - mLastArrival) - (double)step;
+            mJitterUs += (std::fabs(d) - mJitterUs) / 16.0;
+            mOffsetCur = std::min(mOffsetCur, offset);
+            if (now - mWindowStart > kOffsetWindowUs) {
+                mOffsetPrev = mOffsetCur;
+                mOffsetCur = offset;
+                mWindowStart = now;
+            }
+        }
+        mLastTs = ts;
+        mLastArrival = now;
+
+        double target = std::min((double)mParam.maxLatencyUs,
+                                 std::max((double)mParam.minDelayUs, mParam.jitterFactor * mJitterUs));
+        // move slowly, a jump in depth is a visible stall or burst by itself
+        mTargetUs += (target - mTargetUs) / 8.0;
+        due = std::min(mOffsetPrev, mOffsetCur) + ts + (int64_t)mTargetUs;
+        due = std::min(due, now + mParam.maxLatencyUs);
+        if (due < now) mStats.late++;
+    }
+    due = std::max(due, mLastDue);
+    mLastDue = due;
+    mQueue.push_back(Entry{pkt, due});
+    lk.unlock();
+    mCond.notify_one();
+}
+
+void JitterBuffer::releaseLoop() {
+    std::unique_lock<std::mutex> lk(mLock);
+    while (mRunning) {
+        if (mQueue.empty()) {
+            mCond.wait(lk);
+            continue;
+        }
+        int64_t wait = mQueue.front().due - av_gettime_relative();
+        if (wait > 0) {
+            mCond.wait_for(lk, std::chrono::microseconds(wait));
+            continue;
+        }
+        AVPacket *pkt = mQueue.front().pkt;
+        mQueue.pop_front();
+        mStats.released++;
+        lk.unlock();
+        mRelease(pkt);
+        av_packet_free(&pkt);
+        lk.lock();
+    }
+}
+
+void JitterBuffer::stop(bool flush) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mRunning = false;
+    }
+    mCond.notify_all();
+    if (mThread != nullptr) {
+        mThread->join();
+        delete mThread;
+        mThread = nullptr;
+    }
+
+    std::deque<Entry> rest;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        rest.swap(mQueue);
+    }
+    for (auto &e : rest) {
+        if (flush) mRelease(e.pkt);
+        av_packet_free(&e.pkt);
+    }
+    if (flush) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mStats.released += (int64_t)rest.size();
+    }
+}
+
+JitterBufferStats JitterBuffer::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    JitterBufferStats s = mStats;
+    s.targetDelayUs = (int64_t)mTargetUs;
+    s.jitterUs = (int64_t)mJitterUs;
+    s.queued = (int)mQueue.size();
+    return s;
+}
+
+} // namespace otl
@@ -0,0 +1,76 @@
+#ifndef STREAM_JITTER_BUFFER_H
+#define STREAM_JITTER_BUFFER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+struct JitterBufferParam {
+    int64_t minDelayUs{20000};
+    int64_t maxLatencyUs{500000};   // cap on the added delay, whatever the jitter
+    double jitterFactor{3.0};       // target delay = jitterFactor * measured jitter
+};
+
+struct JitterBufferStats {
+    int64_t targetDelayUs{0};
+    int64_t jitterUs{0};
+    int queued{0};
+    int64_t released{0};
+    int64_t late{0};                // arrived after their release slot
+    int64_t discontinuities{0};
+};
+
+// Smooths bursty live input: packets are released on their own thread at
+// arrival offset + dts + target delay, where the arrival offset is the smallest seen recently
+// (the least delayed packet) and the target delay follows the measured interarrival jitter
+// within [minDelayUs, maxLatencyUs]. Only the timing stream is scheduled, other packets keep
+// their place in the FIFO.
+class JitterBuffer {
+public:
+    using ReleaseFunc = std::function<void(AVPacket *)>;
+
+    JitterBuffer(const JitterBufferParam &param, ReleaseFunc release);
+    ~JitterBuffer();
+
+    // Takes ownership of pkt.
+    void push(AVPacket *pkt, bool timingStream, AVRational timeBase);
+    // flush: release what is queued right away instead of dropping it.
+    void stop(bool flush);
+
+    JitterBufferStats stats();
+
+private:
+    struct Entry {
+        AVPacket *pkt;
+        int64_t due;
+    };
+
+    void releaseLoop();
+
+    JitterBufferParam mParam;
+    ReleaseFunc mRelease;
+    std::thread *mThread{nullptr};
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<Entry> mQueue;
+    bool mRunning{true};
+
+    int64_t mLastTs{AV_NOPTS_VALUE};
+    int64_t mLastArrival{0};
+    int64_t mLastDue{0};
+    int64_t mOffsetCur{0};
+    int64_t mOffsetPrev{0};
+    int64_t mWindowStart{0};
+    double mJitterUs{0};
+    double mTargetUs{0};
+    JitterBufferStats mStats;
+};
+
+} // namespace otl
+
+#endif // STREAM_JITTER_BUFFER_H
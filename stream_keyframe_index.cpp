@@ -0,0 +1,271 @@
+#include "stream_keyframe_index.h"
+
+#include <sys/stat.h>
+#include "otl_baseclass.h"
+
+namespace otl {
+
+static const uint32_t kSidecarMagic = 0x4f4b4649;   // "OKFI"
+static const uint16_t kSidecarVersion = 1;
+static const uint16_t kSidecarFlagContainer = 0x1;
+
+bool keyframeReached(const AVPacket *pkt, const KeyframeEntry &k) {
+    if (k.pos >= 0 && pkt->pos >= 0) return pkt->pos >= k.pos;
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    return ts != AV_NOPTS_VALUE && k.timestamp != AV_NOPTS_VALUE && ts >= k.timestamp;
+}
+
+void KeyframeIndex::clear() {
+    mEntries.clear();
+    mStreamIndex = -1;
+    mTimeBase = av_make_q(0, 1);
+    mFromContainer = false;
+}
+
+int KeyframeIndex::build(const std::string &url) {
+    AVFormatContext *ifmtCtx = nullptr;
+    int ret = avformat_open_input(&ifmtCtx, url.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        printf("KeyframeIndex: can't open %s\n", url.c_str());
+        return ret;
+    }
+
+    ret = avformat_find_stream_info(ifmtCtx, nullptr);
+    if (ret >= 0) {
+        ret = av_find_best_stream(ifmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (ret >= 0) {
+            ret = build(ifmtCtx, ret);
+        }
+    }
+
+    avformat_close_input(&ifmtCtx);
+    return ret;
+}
+
+int KeyframeIndex::build(AVFormatContext *ifmtCtx, int streamIndex) {
+    clear();
+    if (ifmtCtx == nullptr || streamIndex < 0 || streamIndex >= (int)ifmtCtx->nb_streams) {
+        return AVERROR(EINVAL);
+    }
+
+    AVStream *st = ifmtCtx->streams[streamIndex];
+    mStreamIndex = streamIndex;
+    mTimeBase = st->time_base;
+
+    // A single entry says nothing about the rest of the file (e.g. a lone mkv cue),
+    // so only trust the container index when it actually splits the stream.
+    if (loadContainerIndex(st) >= 2) {
+        mFromContainer = true;
+        return 0;
+    }
+
+    mEntries.clear();
+    int ret = scanPackets(ifmtCtx);
+    if (ret < 0) {
+        return ret;
+    }
+    return mEntries.empty() ? AVERROR_INVALIDDATA : 0;
+}
+
+int KeyframeIndex::loadContainerIndex(AVStream *st) {
+    // mov/mp4 index every sample, so the distance between key entries is the GOP length;
+    // sparse indexes (mkv cues) leave it 0.
+    bool allSamples = false;
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    int count = avformat_index_get_entries_count(st);
+#else
+    int count = st->nb_index_entries;
+#endif
+    int samples = 0;
+    for (int i = 0; i < count; ++i) {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+        const AVIndexEntry *e = avformat_index_get_entry(st, i);
+#else
+        const AVIndexEntry *e = &st->index_entries[i];
+#endif
+        if (e == nullptr) continue;
+        if (!(e->flags & AVINDEX_KEYFRAME)) {
+            allSamples = true;
+            samples++;
+            continue;
+        }
+        if (!mEntries.empty()) mEntries.back().frames = samples;
+        samples = 1;
+        KeyframeEntry k;
+        k.pos = e->pos;
+        k.timestamp = e->timestamp;
+        mEntries.push_back(k);
+    }
+    if (!mEntries.empty()) mEntries.back().frames = samples;
+    if (!allSamples) {
+        for (auto &k : mEntries) k.frames = 0;
+    }
+    return (int)mEntries.size();
+}
+
+int KeyframeIndex::scanPackets(AVFormatContext *ifmtCtx) {
+    // Only the video stream is of interest; let the demuxer skip the rest.
+    std::vector<enum AVDiscard> saved(ifmtCtx->nb_streams);
+    for (unsigned int i = 0; i < ifmtCtx->nb_streams; ++i) {
+        saved[i] = ifmtCtx->streams[i]->discard;
+        if ((int)i != mStreamIndex) ifmtCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    AVPacket *pkt = av_packet_alloc();
+#else
+    AVPacket *pkt = (AVPacket*)av_malloc(sizeof(AVPacket));
+    av_init_packet(pkt);
+#endif
+
+    int ret = 0;
+    while (true) {
+        ret = av_read_frame(ifmtCtx, pkt);
+        if (ret < 0) break;
+        if (pkt->stream_index == mStreamIndex) {
+            if (pkt->flags & AV_PKT_FLAG_KEY) {
+                KeyframeEntry k;
+                k.pos = pkt->pos;
+                k.timestamp = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+                k.pts = pkt->pts;
+                mEntries.push_back(k);
+            }
+            if (!mEntries.empty()) mEntries.back().frames++;
+        }
+        av_packet_unref(pkt);
+    }
+
+#if LIBAVCODEC_VERSION_MAJOR > 56
+    av_packet_free(&pkt);
+#else
+    av_free_packet(pkt);
+    av_freep(&pkt);
+#endif
+
+    for (unsigned int i = 0; i < ifmtCtx->nb_streams; ++i) {
+        ifmtCtx->streams[i]->discard = saved[i];
+    }
+
+    if (ret != AVERROR_EOF) {
+        printf("KeyframeIndex: packet scan stopped early, ret=%d\n", ret);
+        return ret;
+    }
+
+    ret = av_seek_frame(ifmtCtx, -1, ifmtCtx->start_time != AV_NOPTS_VALUE ? ifmtCtx->start_time : 0,
+                        AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+        av_seek_frame(ifmtCtx, -1, 0, AVSEEK_FLAG_BYTE);
+    }
+    return 0;
+}
+
+int KeyframeIndex::findGop(int64_t pts) const {
+    if (mEntries.empty() || pts == AV_NOPTS_VALUE) return -1;
+    auto key = [](const KeyframeEntry &k) { return k.pts != AV_NOPTS_VALUE ? k.pts : k.timestamp; };
+    int lo = 0, hi = (int)mEntries.size() - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (key(mEntries[mid]) <= pts) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+int KeyframeIndex::mediaFileStamp(const std::string &mediaPath, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(mediaPath.c_str(), &st) != 0) return AVERROR(errno);
+    *size = (int64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return 0;
+}
+
+int KeyframeIndex::save(const std::string &sidecarPath, const std::string &mediaPath) const {
+    int64_t mediaSize, mediaMtime;
+    int ret = mediaFileStamp(mediaPath, &mediaSize, &mediaMtime);
+    if (ret < 0) return ret;
+    if (mEntries.empty()) return AVERROR(EINVAL);
+
+    ByteBuffer buf(64 + mEntries.size() * 28);
+    buf.push_back(kSidecarMagic);
+    buf.push_back(kSidecarVersion);
+    buf.push_back((uint16_t)(mFromContainer ? kSidecarFlagContainer : 0));
+    buf.push_back((int32_t)mStreamIndex);
+    buf.push_back((int32_t)mTimeBase.num);
+    buf.push_back((int32_t)mTimeBase.den);
+    buf.push_back(mediaSize);
+    buf.push_back(mediaMtime);
+    buf.push_back((uint32_t)mEntries.size());
+    for (const auto &k : mEntries) {
+        buf.push_back(k.pos);
+        buf.push_back(k.timestamp);
+        buf.push_back(k.pts);
+        buf.push_back(k.frames);
+    }
+
+    // write to a temp name first so a concurrent reader never sees half a file
+    std::string tmpPath = sidecarPath + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (fp == nullptr) return AVERROR(errno);
+    size_t written = fwrite(buf.data(), 1, buf.size(), fp);
+    fclose(fp);
+    if (written != (size_t)buf.size() || rename(tmpPath.c_str(), sidecarPath.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+int KeyframeIndex::load(const std::string &sidecarPath, const std::string &mediaPath) {
+    int64_t mediaSize, mediaMtime;
+    int ret = mediaFileStamp(mediaPath, &mediaSize, &mediaMtime);
+    if (ret < 0) return ret;
+
+    FILE *fp = fopen(sidecarPath.c_str(), "rb");
+    if (fp == nullptr) return AVERROR(errno);
+    std::string content;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) content.append(chunk, n);
+    fclose(fp);
+
+    ByteBuffer buf(content);
+    uint32_t magic = 0, count = 0;
+    uint16_t version = 0, flags = 0;
+    int32_t streamIndex = -1, tbNum = 0, tbDen = 0;
+    int64_t savedSize = 0, savedMtime = 0;
+    if (buf.pop_front(magic) != 0 || magic != kSidecarMagic ||
+        buf.pop_front(version) != 0 || version != kSidecarVersion ||
+        buf.pop_front(flags) != 0 || buf.pop_front(streamIndex) != 0 ||
+        buf.pop_front(tbNum) != 0 || buf.pop_front(tbDen) != 0 ||
+        buf.pop_front(savedSize) != 0 || buf.pop_front(savedMtime) != 0 ||
+        buf.pop_front(count) != 0) {
+        return AVERROR_INVALIDDATA;
+    }
+    if (savedSize != mediaSize || savedMtime != mediaMtime) {
+        // media file changed since the sidecar was written
+        return AVERROR(ESTALE);
+    }
+    if (count == 0 || (size_t)buf.size() != (size_t)count * 28) {
+        return AVERROR_INVALIDDATA;
+    }
+
+    std::vector<KeyframeEntry> entries(count);
+    for (auto &k : entries) {
+        buf.pop_front(k.pos);
+        buf.pop_front(k.timestamp);
+        buf.pop_front(k.pts);
+        buf.pop_front(k.frames);
+    }
+
+    mEntries.swap(entries);
+    mStreamIndex = streamIndex;
+    mTimeBase = av_make_q(tbNum, tbDen);
+    mFromContainer = (flags & kSidecarFlagContainer) != 0;
+    return 0;
+}
+
+} // namespace otl
@@ -0,0 +1,67 @@
+#ifndef STREAM_KEYFRAME_INDEX_H
+#define STREAM_KEYFRAME_INDEX_H
+
+#include <string>
+#include <vector>
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+struct KeyframeEntry {
+    int64_t pos{-1};                    // byte offset of the key packet, -1 if the demuxer has none
+    int64_t timestamp{AV_NOPTS_VALUE};  // seek timestamp in stream time_base (dts for mp4, pts for mkv cues)
+    int64_t pts{AV_NOPTS_VALUE};        // keyframe pts, known after a packet scan only
+    int32_t frames{0};                  // GOP length in video packets, 0 if unknown
+};
+
+// True once pkt is at or past keyframe k in decode order. Matched by file position when both
+// sides have one: exact and monotonic, whereas index timestamps are dts for some demuxers and
+// pts for others.
+bool keyframeReached(const AVPacket *pkt, const KeyframeEntry &k);
+
+// Keyframe list of one video stream. Taken from the container index when the demuxer
+// built one at open time (mp4/mov, mkv cues), otherwise by reading every packet of the
+// file once without decoding (ts, flv, ...).
+class KeyframeIndex {
+public:
+    KeyframeIndex() = default;
+
+    // Opens url, picks the best video stream and builds the index.
+    int build(const std::string &url);
+    // Builds the index on an already opened context. A packet scan leaves the context
+    // rewound to the start of the file.
+    int build(AVFormatContext *ifmtCtx, int streamIndex);
+
+    void clear();
+
+    // Sidecar: compact binary copy of the index kept next to the media file, stamped with the
+    // file's size and mtime so a rewritten recording is indexed again. Local files only.
+    int save(const std::string &sidecarPath, const std::string &mediaPath) const;
+    int load(const std::string &sidecarPath, const std::string &mediaPath);
+    static std::string sidecarPathFor(const std::string &mediaPath) { return mediaPath + ".kfi"; }
+
+    // Index of the GOP containing pts (stream time_base): keyframe pts when known, else the
+    // seek timestamp. -1 if pts lies before the first keyframe.
+    int findGop(int64_t pts) const;
+
+    const std::vector<KeyframeEntry> &entries() const { return mEntries; }
+    size_t size() const { return mEntries.size(); }
+    bool empty() const { return mEntries.empty(); }
+    int streamIndex() const { return mStreamIndex; }
+    AVRational timeBase() const { return mTimeBase; }
+    bool fromContainer() const { return mFromContainer; }
+
+private:
+    static int mediaFileStamp(const std::string &mediaPath, int64_t *size, int64_t *mtime);
+    int loadContainerIndex(AVStream *st);
+    int scanPackets(AVFormatContext *ifmtCtx);
+
+    std::vector<KeyframeEntry> mEntries;
+    int mStreamIndex{-1};
+    AVRational mTimeBase{0, 1};
+    bool mFromContainer{false};
+};
+
+} // namespace otl
+
+#endif // STREAM_KEYFRAME_INDEX_H
@@ -0,0 +1,265 @@
+#include "stream_multi_encoder.h"
+
+#include <chrono>
+
+namespace otl {
+
+static const char* TAG = "MultiRenditionEncoder";
+
+static double msSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+MultiRenditionEncoder::Rendition::~Rendition() {
+    sws_freeContext(sws);
+    av_frame_free(&frame);
+}
+
+MultiRenditionEncoder::~MultiRenditionEncoder() {
+    shutdown();
+}
+
+int MultiRenditionEncoder::init(const MultiRenditionParam &param, OnPacketFunc onPacket) {
+    if (!mRenditions.empty() || param.renditions.empty() || !onPacket) return AVERROR(EINVAL);
+    for (size_t i = 0; i < param.renditions.size(); ++i) {
+        const RenditionParam &rp = param.renditions[i];
+        if (rp.width <= 0 || rp.height <= 0) return AVERROR(EINVAL);
+        for (size_t j = 0; j < i; ++j) {
+            if (param.renditions[j].id == rp.id) return AVERROR(EINVAL);
+        }
+    }
+    mParam = param;
+    mOnPacket = onPacket;
+
+    // only published once every encoder opened, a partial set would have no workers
+    std::vector<std::unique_ptr<Rendition>> renditions;
+    for (auto &rp : mParam.renditions) {
+        std::unique_ptr<Rendition> r(new Rendition());
+        r->param = rp;
+        r->stats.id = rp.id;
+        r->frame = av_frame_alloc();
+        r->encoder = CreateStreamEncoder(mParam.base.codecName);
+        if (!r->frame || !r->encoder) return AVERROR(ENOMEM);
+
+        EncodeParam ep = mParam.base;
+        ep.width = rp.width;
+        ep.height = rp.height;
+        if (rp.bitRate > 0) ep.bitRate = rp.bitRate;
+        // IDRs must land on the same frames everywhere: no scene-cut keyframes, and a forced
+        // I frame is an IDR on the hardware encoders too. Unknown keys are ignored by the codec.
+        AVDictionary *opts = nullptr;
+        if (mParam.base.options) av_dict_copy(&opts, mParam.base.options, 0);
+        av_dict_set(&opts, "sc_threshold", "0", AV_DICT_DONT_OVERWRITE);
+        av_dict_set(&opts, "x265-params", "scenecut=0", AV_DICT_DONT_OVERWRITE);
+        av_dict_set(&opts, "forced-idr", "1", AV_DICT_DONT_OVERWRITE);
+        ep.options = opts;
+        int ret = r->encoder->init(&ep);
+        av_dict_free(&opts);
+        if (ret < 0) {
+            OTL_LOGE(TAG, "rendition %d (%dx%d) init failed: %d", rp.id, rp.width, rp.height, ret);
+            return ret;
+        }
+        renditions.push_back(std::move(r));
+    }
+
+    mRenditions = std::move(renditions);
+    for (size_t i = 0; i < mRenditions.size(); ++i) {
+        mRenditions[i]->thread = new std::thread(&MultiRenditionEncoder::workerLoop, this, i);
+    }
+    return 0;
+}
+
+int MultiRenditionEncoder::encode(const AVFrame *frame) {
+    if (!frame) return AVERROR(EINVAL);
+    bool forceKey;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mRenditions.empty() || mFlushed || mStopping) return AVERROR_EOF;
+        int gop = mParam.base.gopSize;
+        forceKey = mPendingKey || (gop > 0 && mFrameIndex % gop == 0);
+        mPendingKey = false;
+        mFrameIndex++;
+    }
+    return runJob(frame, forceKey);
+}
+
+int MultiRenditionEncoder::requestKeyFrame() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mPendingKey = true;
+    return 0;
+}
+
+int MultiRenditionEncoder::flush() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mRenditions.empty() || mFlushed || mStopping) return 0;
+        mFlushed = true;
+    }
+    return runJob(nullptr, false);
+}
+
+int MultiRenditionEncoder::runJob(const AVFrame *frame, bool forceKey) {
+    std::unique_lock<std::mutex> lk(mLock);
+    mInput = frame;
+    mJobKey = forceKey;
+    mJobError = 0;
+    mPending = mRenditions.size();
+    mJobSeq++;
+    mJobCond.notify_all();
+    // the scaled frames are reused by the next job, so it can't start before this one is done
+    mDoneCond.wait(lk, [this] { return mPending == 0; });
+    mInput = nullptr;
+    return mJobError;
+}
+
+int MultiRenditionEncoder::scaleLevel(Rendition &r, const AVFrame *src, bool forceKey) {
+    AVFrame *dst = r.frame;
+    const int w = r.param.width, h = r.param.height;
+    const AVPixelFormat fmt = mParam.base.pixFmt;
+
+    if (src->width == w && src->height == h && src->format == fmt) {
+        av_frame_unref(dst);
+        int ret = av_frame_ref(dst, src);
+        if (ret < 0) return ret;
+    } else {
+        // the encoder may still hold a reference to last frame's buffer, then a new one is
+        // allocated (not copied, sws_scale overwrites all of it), otherwise it is reused in place
+        if (dst->width != w || dst->height != h || dst->format != fmt || !dst->buf[0] ||
+            !av_frame_is_writable(dst)) {
+            av_frame_unref(dst);
+            dst->width = w;
+            dst->height = h;
+            dst->format = fmt;
+            int ret = av_frame_get_buffer(dst, 0);
+            if (ret < 0) return ret;
+        }
+        r.sws = sws_getCachedContext(r.sws, src->width, src->height, (AVPixelFormat)src->format,
+                                     w, h, fmt, mParam.swsFlags, nullptr, nullptr, nullptr);
+        if (!r.sws) return AVERROR(EINVAL);
+        sws_scale(r.sws, src->data, src->linesize, 0, src->height, dst->data, dst->linesize);
+        av_frame_copy_props(dst, src);
+    }
+    // set here rather than through requestKeyFrame(): the encoder would write it into the frame
+    // while the next level is still reading from it
+    dst->pict_type = forceKey ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    return 0;
+}
+
+void MultiRenditionEncoder::workerLoop(size_t index) {
+    Rendition &r = *mRenditions[index];
+    std::vector<PacketHandle> pkts;
+    int64_t seen = 0;
+
+    std::unique_lock<std::mutex> lk(mLock);
+    while (true) {
+        mJobCond.wait(lk, [&] { return mJobSeq != seen || mStopping; });
+        if (mStopping) break;
+        seen = mJobSeq;
+        const AVFrame *src = mInput;
+        bool forceKey = mJobKey;
+        bool drain = src == nullptr;
+
+        int ret = 0;
+        if (!drain) {
+            if (index > 0) {
+                Rendition &prev = *mRenditions[index - 1];
+                mLevelCond.wait(lk, [&] { return prev.doneSeq == seen; });
+                src = prev.frame;
+                ret = prev.scaleRet;
+            }
+            lk.unlock();
+
+            auto t0 = std::chrono::steady_clock::now();
+            if (ret == 0) ret = scaleLevel(r, src, forceKey);
+            double scaleMs = msSince(t0);
+
+            lk.lock();
+            // published even on failure, the next level then skips the frame instead of
+            // waiting forever
+            r.scaleRet = ret;
+            r.doneSeq = seen;
+            r.scaleMsTotal += scaleMs;
+            lk.unlock();
+            mLevelCond.notify_all();
+
+            if (ret == 0) {
+                t0 = std::chrono::steady_clock::now();
+                ret = r.encoder->encode(r.frame, pkts);
+                double encodeMs = msSince(t0);
+                lk.lock();
+                r.encodeMsTotal += encodeMs;
+                r.stats.frames++;
+                lk.unlock();
+            }
+        } else {
+            lk.unlock();
+            ret = r.encoder->encode(nullptr, pkts);
+        }
+        if (ret < 0) OTL_LOGW(TAG, "rendition %d encode failed: %d", r.param.id, ret);
+
+        int64_t bytes = 0;
+        if (!pkts.empty()) {
+            std::lock_guard<std::mutex> dlk(mDeliverLock);
+            for (auto &pkt : pkts) {
+                bytes += pkt->size;
+                mOnPacket(r.param.id, pkt.get());
+            }
+        }
+
+        lk.lock();
+        r.stats.packets += (int64_t)pkts.size();
+        r.stats.bytes += bytes;
+        pkts.clear();
+        if (ret < 0 && mJobError == 0) mJobError = ret;
+        if (--mPending == 0) mDoneCond.notify_all();
+    }
+}
+
+void MultiRenditionEncoder::shutdown() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mStopping = true;
+    }
+    mJobCond.notify_all();
+    mLevelCond.notify_all();
+    for (auto &r : mRenditions) {
+        if (r->thread) {
+            r->thread->join();
+            delete r->thread;
+            r->thread = nullptr;
+        }
+    }
+}
+
+const MultiRenditionEncoder::Rendition *MultiRenditionEncoder::find(int renditionId) const {
+    for (auto &r : mRenditions) {
+        if (r->param.id == renditionId) return r.get();
+    }
+    return nullptr;
+}
+
+const AVCodecParameters *MultiRenditionEncoder::getCodecParameters(int renditionId) const {
+    const Rendition *r = find(renditionId);
+    return r ? r->encoder->getCodecParameters() : nullptr;
+}
+
+AVRational MultiRenditionEncoder::getTimeBase(int renditionId) const {
+    const Rendition *r = find(renditionId);
+    return r ? r->encoder->getTimeBase() : AVRational{1, 90000};
+}
+
+std::vector<RenditionStats> MultiRenditionEncoder::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    std::vector<RenditionStats> out;
+    for (auto &r : mRenditions) {
+        RenditionStats s = r->stats;
+        if (s.frames > 0) {
+            s.avgScaleMs = r->scaleMsTotal / s.frames;
+            s.avgEncodeMs = r->encodeMsTotal / s.frames;
+        }
+        out.push_back(s);
+    }
+    return out;
+}
+
+} // namespace otl
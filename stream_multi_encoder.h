@@ -0,0 +1,106 @@
+#ifndef STREAM_MULTI_ENCODER_H
+#define STREAM_MULTI_ENCODER_H
+
+#include "stream_encoder.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace otl {
+    // 单个码率档位
+    struct RenditionParam {
+        int id{0};                     // 回调中标识该档位
+        int width{0};
+        int height{0};
+        int64_t bitRate{0};            // 0 沿用 base.bitRate
+    };
+
+    struct MultiRenditionParam {
+        // codec、帧率、时间基、gop、码控等所有档位共用，width/height/bitRate 由档位覆盖
+        EncodeParam base;
+        // 从大到小排列：每一档从上一档缩放（第一档从输入帧缩放），分辨率应逐级递减
+        std::vector<RenditionParam> renditions;
+        int swsFlags{SWS_BILINEAR};
+    };
+
+    struct RenditionStats {
+        int id{0};
+        int64_t frames{0};
+        int64_t packets{0};
+        int64_t bytes{0};
+        double avgScaleMs{0};
+        double avgEncodeMs{0};
+    };
+
+    // One decoded frame in, one packet stream per rendition out. Scaling is a cascade (e.g.
+    // 1080 -> 720 -> 360) so every level after the first reads the previous, already smaller
+    // level instead of the full frame. Each rendition has its own worker: level N encodes while
+    // level N+1 is still scaling. IDRs are placed on the same input frames in every rendition
+    // (fixed GOP, scene-cut keyframes off, keyframe requests fanned out) so players can switch
+    // between renditions at any GOP boundary.
+    class MultiRenditionEncoder {
+    public:
+        // 在各档位的编码线程上回调，回调之间已串行化；pkt 仅在回调期间有效
+        using OnPacketFunc = std::function<void(int renditionId, AVPacket *pkt)>;
+
+        MultiRenditionEncoder() = default;
+        ~MultiRenditionEncoder();
+
+        int init(const MultiRenditionParam &param, OnPacketFunc onPacket);
+
+        // Blocks until every rendition has scaled and encoded the frame. frame is not modified.
+        int encode(const AVFrame *frame);
+        // The next frame becomes an IDR in all renditions.
+        int requestKeyFrame();
+        // Drains all encoders; encode() fails afterwards.
+        int flush();
+
+        size_t renditionCount() const { return mRenditions.size(); }
+        const AVCodecParameters *getCodecParameters(int renditionId) const;
+        AVRational getTimeBase(int renditionId) const;
+        std::vector<RenditionStats> stats();
+
+    private:
+        struct Rendition {
+            ~Rendition();
+            RenditionParam param;
+            std::unique_ptr<StreamEncoder> encoder;
+            SwsContext *sws{nullptr};
+            AVFrame *frame{nullptr};   // 本档位缩放结果，也是下一档的输入
+            std::thread *thread{nullptr};
+            int64_t doneSeq{0};        // 已完成缩放的任务序号
+            int scaleRet{0};
+            double scaleMsTotal{0};
+            double encodeMsTotal{0};
+            RenditionStats stats;
+        };
+
+        int runJob(const AVFrame *frame, bool forceKey);
+        void workerLoop(size_t index);
+        int scaleLevel(Rendition &r, const AVFrame *src, bool forceKey);
+        const Rendition *find(int renditionId) const;
+        void shutdown();
+
+        MultiRenditionParam mParam;
+        OnPacketFunc mOnPacket;
+        std::vector<std::unique_ptr<Rendition>> mRenditions;
+        std::mutex mDeliverLock;
+
+        std::mutex mLock;
+        std::condition_variable mJobCond;
+        std::condition_variable mLevelCond;
+        std::condition_variable mDoneCond;
+        const AVFrame *mInput{nullptr};   // nullptr 表示 drain
+        int64_t mJobSeq{0};
+        bool mJobKey{false};
+        size_t mPending{0};
+        int mJobError{0};
+        bool mStopping{false};
+        bool mFlushed{false};
+        bool mPendingKey{false};
+        int64_t mFrameIndex{0};
+    };
+}
+
+#endif //STREAM_MULTI_ENCODER_H
@@ -0,0 +1,387 @@
+#include "stream_offline_decoder.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace otl {
+
+OfflineParallelDecoder::~OfflineParallelDecoder() {
+    clearRanges();
+}
+
+void OfflineParallelDecoder::abort() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mAbort = true;
+    }
+    mWorkCond.notify_all();
+    mDeliverCond.notify_all();
+}
+
+void OfflineParallelDecoder::clearRanges() {
+    for (auto &range : mRanges) {
+        for (auto frame : range.frames) av_frame_free(&frame);
+    }
+    mRanges.clear();
+    for (auto &item : mUnordered) av_frame_free(&item.second);
+    mUnordered.clear();
+}
+
+#if LIBAVCODEC_VERSION_MAJOR > 56
+
+static int64_t frameTimestamp(const AVFrame *frame) {
+    return frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+}
+
+int OfflineParallelDecoder::decodeFile(const std::string &url, OnFrameFunc onFrame, const OfflineDecodeParam &param) {
+    int64_t startTime = av_gettime_relative();
+    clearRanges();
+    mStats = OfflineDecodeStats();
+    mUrl = url;
+    mParam = param;
+    mOnFrame = onFrame;
+    mNextRange = 0;
+    mDeliverRange = 0;
+    mFinishedRanges = 0;
+    mQueuedFrames = 0;
+    mAbort = false;
+
+    AVFormatContext *ifmtCtx = nullptr;
+    int ret = avformat_open_input(&ifmtCtx, url.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        printf("offline decode: can't open %s\n", url.c_str());
+        return ret;
+    }
+    ret = avformat_find_stream_info(ifmtCtx, nullptr);
+    if (ret >= 0) ret = av_find_best_stream(ifmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (ret >= 0) ret = mIndex.build(ifmtCtx, ret);
+    AVCodecParameters *par = nullptr;
+    if (ret >= 0) {
+        par = avcodec_parameters_alloc();
+        ret = par ? avcodec_parameters_copy(par, ifmtCtx->streams[mIndex.streamIndex()]->codecpar) : AVERROR(ENOMEM);
+    }
+    avformat_close_input(&ifmtCtx);
+    if (ret < 0) {
+        printf("offline decode: no usable video stream in %s, ret=%d\n", url.c_str(), ret);
+        avcodec_parameters_free(&par);
+        return ret;
+    }
+    mStats.indexUs = av_gettime_relative() - startTime;
+    mStats.containerIndex = mIndex.fromContainer();
+
+    const std::vector<KeyframeEntry> &keys = mIndex.entries();
+    size_t step = (size_t)std::max(1, mParam.gopsPerRange);
+    for (size_t i = 0; i < keys.size(); i += step) {
+        Range range;
+        range.start = keys[i];
+        if (i + step < keys.size()) range.end = keys[i + step];
+        mRanges.push_back(std::move(range));
+    }
+
+    int threads = mParam.threads;
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    threads = std::max(1, std::min(threads, (int)mRanges.size()));
+    if (mParam.reorderWindow <= 0) mParam.reorderWindow = 2 * threads;
+    if (mParam.maxQueuedFrames <= 0) mParam.maxQueuedFrames = 8 * threads;
+    mStats.threads = threads;
+    mStats.ranges = (int)mRanges.size();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(&OfflineParallelDecoder::workerLoop, this, par);
+    }
+
+    if (mParam.ordered) {
+        deliverOrdered();
+    } else {
+        deliverUnordered();
+    }
+
+    for (auto &th : workers) th.join();
+    avcodec_parameters_free(&par);
+
+    for (auto &range : mRanges) {
+        if (range.error < 0) mStats.failedRanges++;
+    }
+    clearRanges();
+    mStats.elapsedUs = av_gettime_relative() - startTime;
+
+    printf("offline decode %s: %lld frames, %d ranges (%d failed), %d threads, index %.1f ms (%s), total %.1f ms\n",
+           url.c_str(), (long long)mStats.frames, mStats.ranges, mStats.failedRanges, mStats.threads,
+           mStats.indexUs / 1000.0, mStats.containerIndex ? "container" : "scan", mStats.elapsedUs / 1000.0);
+
+    if (mAbort) return AVERROR_EXIT;
+    return mStats.failedRanges == mStats.ranges ? AVERROR_INVALIDDATA : 0;
+}
+
+int OfflineParallelDecoder::openWorker(Worker &w, const AVCodecParameters *par) {
+    int ret = avformat_open_input(&w.ifmtCtx, mUrl.c_str(), nullptr, nullptr);
+    if (ret < 0) return ret;
+    ret = avformat_find_stream_info(w.ifmtCtx, nullptr);
+    if (ret < 0) return ret;
+
+    int streamIndex = mIndex.streamIndex();
+    if (streamIndex >= (int)w.ifmtCtx->nb_streams ||
+        w.ifmtCtx->streams[streamIndex]->codecpar->codec_id != par->codec_id) {
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+    for (unsigned int i = 0; i < w.ifmtCtx->nb_streams; ++i) {
+        if ((int)i != streamIndex) w.ifmtCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+    if (codec == nullptr) return AVERROR_DECODER_NOT_FOUND;
+    w.decCtx = avcodec_alloc_context3(codec);
+    if (w.decCtx == nullptr) return AVERROR(ENOMEM);
+    ret = avcodec_parameters_to_context(w.decCtx, par);
+    if (ret < 0) return ret;
+    // parallelism comes from the GOP split, stacking codec threads on top only oversubscribes
+    w.decCtx->thread_count = 1;
+    ret = avcodec_open2(w.decCtx, codec, nullptr);
+    if (ret < 0) return ret;
+
+    w.pkt = av_packet_alloc();
+    w.frame = av_frame_alloc();
+    if (w.pkt == nullptr || w.frame == nullptr) return AVERROR(ENOMEM);
+    return 0;
+}
+
+void OfflineParallelDecoder::closeWorker(Worker &w) {
+    av_frame_free(&w.frame);
+    av_packet_free(&w.pkt);
+    avcodec_free_context(&w.decCtx);
+    avformat_close_input(&w.ifmtCtx);
+}
+
+void OfflineParallelDecoder::workerLoop(const AVCodecParameters *par) {
+    Worker w;
+    int openRet = openWorker(w, par);
+    if (openRet < 0) {
+        printf("offline decode: worker open failed, ret=%d\n", openRet);
+    }
+
+    const int rangeNum = (int)mRanges.size();
+    while (true) {
+        int rangeIndex;
+        {
+            std::unique_lock<std::mutex> lk(mLock);
+            mWorkCond.wait(lk, [&] {
+                return mAbort || mNextRange >= rangeNum || !mParam.ordered ||
+                       mNextRange < mDeliverRange + mParam.reorderWindow;
+            });
+            if (mAbort || mNextRange >= rangeNum) break;
+            rangeIndex = mNextRange++;
+        }
+
+        int ret = openRet < 0 ? openRet : decodeRange(w, rangeIndex);
+        {
+            std::lock_guard<std::mutex> lk(mLock);
+            mRanges[rangeIndex].error = ret < 0 ? ret : 0;
+            mRanges[rangeIndex].done = true;
+            mFinishedRanges++;
+        }
+        mDeliverCond.notify_all();
+    }
+
+    closeWorker(w);
+}
+
+int OfflineParallelDecoder::decodeRange(Worker &w, int rangeIndex) {
+    const KeyframeEntry start = mRanges[rangeIndex].start;
+    const KeyframeEntry end = mRanges[rangeIndex].end;
+    const bool hasEnd = end.pos >= 0 || end.timestamp != AV_NOPTS_VALUE;
+    const int streamIndex = mIndex.streamIndex();
+
+    avcodec_flush_buffers(w.decCtx);
+    int ret = -1;
+    if (start.timestamp != AV_NOPTS_VALUE) {
+        ret = av_seek_frame(w.ifmtCtx, streamIndex, start.timestamp, AVSEEK_FLAG_BACKWARD);
+    }
+    if (ret < 0 && start.pos >= 0) {
+        ret = av_seek_frame(w.ifmtCtx, streamIndex, start.pos, AVSEEK_FLAG_BYTE);
+    }
+    if (ret < 0) return ret;
+
+    // [startPts, endPts) is taken from the key packets themselves once they are read.
+    bool started = false;
+    bool boundary = false;
+    int64_t startPts = AV_NOPTS_VALUE;
+    int64_t endPts = INT64_MAX;
+    while (!mAbort) {
+        ret = av_read_frame(w.ifmtCtx, w.pkt);
+        if (ret < 0) break;
+        if (w.pkt->stream_index != streamIndex) {
+            av_packet_unref(w.pkt);
+            continue;
+        }
+
+        bool key = (w.pkt->flags & AV_PKT_FLAG_KEY) != 0;
+        int64_t pts = w.pkt->pts != AV_NOPTS_VALUE ? w.pkt->pts : w.pkt->dts;
+        if (!started) {
+            if (!key || !keyframeReached(w.pkt, start)) {
+                av_packet_unref(w.pkt);
+                continue;
+            }
+            started = true;
+            startPts = pts;
+        } else if (!boundary) {
+            if (hasEnd && key && keyframeReached(w.pkt, end)) {
+                if (pts == AV_NOPTS_VALUE) {
+                    av_packet_unref(w.pkt);
+                    break;
+                }
+                // keep feeding the next keyframe and its leading pictures, they may
+                // still belong to this range in presentation order (open GOP)
+                boundary = true;
+                endPts = pts;
+            }
+        } else if (key || pts == AV_NOPTS_VALUE || pts >= endPts) {
+            av_packet_unref(w.pkt);
+            break;
+        }
+
+        ret = avcodec_send_packet(w.decCtx, w.pkt);
+        av_packet_unref(w.pkt);
+        if (ret < 0) {
+            printf("offline decode: range %d send packet failed, ret=%d\n", rangeIndex, ret);
+            continue;
+        }
+        ret = drainDecoder(w, rangeIndex, startPts, endPts);
+        if (ret < 0) return ret;
+    }
+
+    if (ret < 0 && ret != AVERROR_EOF) {
+        return ret;
+    }
+    if (!started) {
+        printf("offline decode: range %d, keyframe at pos %lld not found\n", rangeIndex, (long long)start.pos);
+        return AVERROR_INVALIDDATA;
+    }
+
+    avcodec_send_packet(w.decCtx, nullptr);
+    return drainDecoder(w, rangeIndex, startPts, endPts);
+}
+
+int OfflineParallelDecoder::drainDecoder(Worker &w, int rangeIndex, int64_t startPts, int64_t endPts) {
+    while (true) {
+        int ret = avcodec_receive_frame(w.decCtx, w.frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0;
+        if (ret < 0) return ret;
+
+        // Frames before the range's keyframe are leading pictures of an open GOP, which
+        // the previous range decodes with their real references.
+        int64_t pts = frameTimestamp(w.frame);
+        bool inRange = pts == AV_NOPTS_VALUE ||
+                       ((startPts == AV_NOPTS_VALUE || pts >= startPts) && pts < endPts);
+        if (!inRange || mAbort) {
+            av_frame_unref(w.frame);
+            continue;
+        }
+
+        AVFrame *out = av_frame_alloc();
+        if (out == nullptr) return AVERROR(ENOMEM);
+        av_frame_move_ref(out, w.frame);
+        pushFrame(rangeIndex, out);
+    }
+}
+
+void OfflineParallelDecoder::pushFrame(int rangeIndex, AVFrame *frame) {
+    {
+        std::unique_lock<std::mutex> lk(mLock);
+        if (mParam.ordered) {
+            // Ranges decoding ahead share maxQueuedFrames; the range being delivered is never
+            // held back by them, or it could wait on frames that only its own delivery frees.
+            Range &range = mRanges[rangeIndex];
+            mWorkCond.wait(lk, [&] {
+                return mAbort || mQueuedFrames < mParam.maxQueuedFrames ||
+                       (rangeIndex == mDeliverRange && (int)range.frames.size() < mParam.maxQueuedFrames);
+            });
+            if (mAbort) {
+                av_frame_free(&frame);
+                return;
+            }
+            range.frames.push_back(frame);
+            mQueuedFrames++;
+        } else {
+            mWorkCond.wait(lk, [&] { return mAbort || (int)mUnordered.size() < mParam.maxQueuedFrames; });
+            if (mAbort) {
+                av_frame_free(&frame);
+                return;
+            }
+            mUnordered.emplace_back(rangeIndex, frame);
+        }
+    }
+    mDeliverCond.notify_one();
+}
+
+void OfflineParallelDecoder::deliverOrdered() {
+    const int rangeNum = (int)mRanges.size();
+    OfflineFrameInfo info;
+    info.timeBase = mIndex.timeBase();
+    while (true) {
+        AVFrame *frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lk(mLock);
+            mDeliverCond.wait(lk, [&] {
+                return mAbort || mDeliverRange >= rangeNum ||
+                       !mRanges[mDeliverRange].frames.empty() || mRanges[mDeliverRange].done;
+            });
+            if (mAbort || mDeliverRange >= rangeNum) break;
+
+            Range &range = mRanges[mDeliverRange];
+            if (range.frames.empty()) {
+                // range fully delivered, let the workers move the window forward
+                mDeliverRange++;
+                lk.unlock();
+                mWorkCond.notify_all();
+                continue;
+            }
+            frame = range.frames.front();
+            range.frames.pop_front();
+            mQueuedFrames--;
+            info.rangeIndex = mDeliverRange;
+        }
+        mWorkCond.notify_all();
+
+        info.pts = frameTimestamp(frame);
+        mStats.frames++;
+        if (mOnFrame) mOnFrame(frame, info);
+        av_frame_free(&frame);
+    }
+}
+
+void OfflineParallelDecoder::deliverUnordered() {
+    const int rangeNum = (int)mRanges.size();
+    OfflineFrameInfo info;
+    info.timeBase = mIndex.timeBase();
+    while (true) {
+        AVFrame *frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lk(mLock);
+            mDeliverCond.wait(lk, [&] {
+                return mAbort || !mUnordered.empty() || mFinishedRanges >= rangeNum;
+            });
+            if (mAbort || mUnordered.empty()) break;
+            info.rangeIndex = mUnordered.front().first;
+            frame = mUnordered.front().second;
+            mUnordered.pop_front();
+        }
+        mWorkCond.notify_all();
+
+        info.pts = frameTimestamp(frame);
+        mStats.frames++;
+        if (mOnFrame) mOnFrame(frame, info);
+        av_frame_free(&frame);
+    }
+}
+
+#else
+
+int OfflineParallelDecoder::decodeFile(const std::string &url, OnFrameFunc onFrame, const OfflineDecodeParam &param) {
+    printf("offline decode: needs the send/receive decode API (libavcodec > 56)\n");
+    return AVERROR(ENOSYS);
+}
+
+#endif
+
+} // namespace otl
@@ -0,0 +1,108 @@
+#ifndef STREAM_OFFLINE_DECODER_H
+#define STREAM_OFFLINE_DECODER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "stream_keyframe_index.h"
+
+namespace otl {
+
+struct OfflineDecodeParam {
+    int threads{0};             // decode workers, each with its own demuxer and codec context; 0 = cpu count
+    bool ordered{true};         // deliver in presentation order, otherwise as soon as a range decodes a frame
+    int reorderWindow{0};       // ordered: GOP ranges allowed to decode ahead of delivery, 0 = 2 * threads
+    int maxQueuedFrames{0};     // decoded frames waiting for delivery, 0 = 8 * threads; ordered mode may
+                                // hold up to twice that, the range being delivered has its own share
+    int gopsPerRange{1};        // GOPs handed to a worker at once; raise for very short GOPs
+};
+
+struct OfflineFrameInfo {
+    int64_t pts{AV_NOPTS_VALUE};    // best effort timestamp in timeBase
+    AVRational timeBase{0, 1};
+    int rangeIndex{0};
+};
+
+struct OfflineDecodeStats {
+    int threads{0};
+    int ranges{0};
+    int failedRanges{0};
+    int64_t frames{0};
+    int64_t indexUs{0};         // keyframe index build time
+    int64_t elapsedUs{0};       // whole decodeFile(), index included
+    bool containerIndex{false}; // false if the file had to be scanned for keyframes
+};
+
+// Batch decoding of recorded files. The video stream is split at keyframes into GOP ranges
+// and the ranges are decoded concurrently, so a single file uses all cores without the
+// latency concerns of frame threading. Each range is decoded from its own keyframe up to
+// the next one; leading pictures of an open GOP are decoded by the range before it.
+// Software decoding only; every worker runs a single threaded codec context.
+class OfflineParallelDecoder : public FfmpegGlobal {
+public:
+    // frame is only valid during the call. Runs on the thread that called decodeFile().
+    using OnFrameFunc = std::function<void(const AVFrame *frame, const OfflineFrameInfo &info)>;
+
+    OfflineParallelDecoder() = default;
+    virtual ~OfflineParallelDecoder();
+
+    // Blocks until the file is decoded or abort() is called.
+    int decodeFile(const std::string &url, OnFrameFunc onFrame,
+                   const OfflineDecodeParam &param = OfflineDecodeParam());
+    // Safe to call from the frame callback or another thread.
+    void abort();
+
+    const OfflineDecodeStats &stats() const { return mStats; }
+    const KeyframeIndex &index() const { return mIndex; }
+
+private:
+    struct Range {
+        KeyframeEntry start;
+        KeyframeEntry end;          // pos == -1 && timestamp == AV_NOPTS_VALUE: until end of file
+        std::deque<AVFrame *> frames;
+        bool done{false};
+        int error{0};
+    };
+
+    struct Worker {
+        AVFormatContext *ifmtCtx{nullptr};
+        AVCodecContext *decCtx{nullptr};
+        AVPacket *pkt{nullptr};
+        AVFrame *frame{nullptr};
+    };
+
+    int openWorker(Worker &w, const AVCodecParameters *par);
+    void closeWorker(Worker &w);
+    void workerLoop(const AVCodecParameters *par);
+    int decodeRange(Worker &w, int rangeIndex);
+    int drainDecoder(Worker &w, int rangeIndex, int64_t startPts, int64_t endPts);
+    void pushFrame(int rangeIndex, AVFrame *frame);
+    void deliverOrdered();
+    void deliverUnordered();
+    void clearRanges();
+
+    std::string mUrl;
+    OfflineDecodeParam mParam;
+    OnFrameFunc mOnFrame;
+    KeyframeIndex mIndex;
+    OfflineDecodeStats mStats;
+
+    std::vector<Range> mRanges;
+    std::deque<std::pair<int, AVFrame *>> mUnordered;   // (range, frame)
+    std::mutex mLock;
+    std::condition_variable mWorkCond;
+    std::condition_variable mDeliverCond;
+    int mNextRange{0};          // next range a worker will take
+    int mDeliverRange{0};       // ordered: range currently being delivered
+    int mFinishedRanges{0};
+    int mQueuedFrames{0};       // ordered: frames held by all ranges
+    std::atomic<bool> mAbort{false};
+};
+
+} // namespace otl
+
+#endif // STREAM_OFFLINE_DECODER_H
@@ -0,0 +1,137 @@
+#include "stream_packet_queue.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace otl {
+
+void GopPacketQueue::setParam(const PacketQueueParam &param) {
+    std::lock_guard<std::mutex> lk(mLock);
+    mParam = param;
+}
+
+bool GopPacketQueue::overLimit() const {
+    if (mParam.maxBytes > 0 && mBytes > mParam.maxBytes) return true;
+    if (mParam.maxDurationUs > 0 && mQueue.size() > 1 &&
+        mQueue.back().enqueueUs - mQueue.front().enqueueUs > mParam.maxDurationUs) {
+        return true;
+    }
+    return false;
+}
+
+void GopPacketQueue::dropFront(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        mBytes -= mQueue.front().pkt->size;
+        mQueue.pop_front();
+    }
+    mStats.droppedPackets += (int64_t)count;
+    mStats.droppedGops++;
+}
+
+bool GopPacketQueue::push(AVPacket *pkt) {
+    return push(PacketHandle(pkt, [](AVPacket *p) { av_packet_free(&p); }));
+}
+
+bool GopPacketQueue::push(PacketHandle pkt) {
+    std::unique_lock<std::mutex> lk(mLock);
+    bool key = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+    if (mShutdown || (mWaitKey && !key)) {
+        if (!mShutdown) mStats.droppedPackets++;
+        return false;
+    }
+    mWaitKey = false;
+
+    mBytes += pkt->size;
+    mQueue.push_back(QueuedPacket{std::move(pkt), av_gettime_relative()});
+    mStats.pushed++;
+
+    bool kept = true;
+    while (mQueue.size() > 1 && overLimit()) {
+        // the head GOP ends where the next keyframe starts
+        auto next = std::find_if(mQueue.begin() + 1, mQueue.end(),
+                                 [](const QueuedPacket &e) { return (e.pkt->flags & AV_PKT_FLAG_KEY) != 0; });
+        if (next != mQueue.end()) {
+            dropFront(next - mQueue.begin());
+            continue;
+        }
+        // a single GOP, the one still arriving, doesn't fit
+        dropFront(mQueue.size());
+        mWaitKey = true;
+        kept = false;
+    }
+    mStats.highWaterBytes = std::max(mStats.highWaterBytes, mBytes);
+    lk.unlock();
+    if (kept) mCond.notify_one();
+    return kept;
+}
+
+bool GopPacketQueue::pop(PacketHandle &pkt, int64_t &enqueueUs, int timeoutMs) {
+    std::unique_lock<std::mutex> lk(mLock);
+    auto ready = [this] { return !mQueue.empty() || mShutdown; };
+    if (timeoutMs < 0) {
+        mCond.wait(lk, ready);
+    } else if (!mCond.wait_for(lk, std::chrono::milliseconds(timeoutMs), ready)) {
+        return false;
+    }
+    if (mQueue.empty()) return false;
+    QueuedPacket &e = mQueue.front();
+    mBytes -= e.pkt->size;
+    pkt = std::move(e.pkt);
+    enqueueUs = e.enqueueUs;
+    mQueue.pop_front();
+    return true;
+}
+
+bool GopPacketQueue::popAll(std::vector<QueuedPacket> &out, int timeoutMs) {
+    std::unique_lock<std::mutex> lk(mLock);
+    auto ready = [this] { return !mQueue.empty() || mShutdown; };
+    if (timeoutMs < 0) {
+        mCond.wait(lk, ready);
+    } else if (!mCond.wait_for(lk, std::chrono::milliseconds(timeoutMs), ready)) {
+        return false;
+    }
+    if (mQueue.empty()) return false;
+    out.insert(out.end(), std::make_move_iterator(mQueue.begin()), std::make_move_iterator(mQueue.end()));
+    mQueue.clear();
+    mBytes = 0;
+    return true;
+}
+
+void GopPacketQueue::restartAtKeyframe() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mQueue.clear();
+    mBytes = 0;
+    mWaitKey = true;
+}
+
+void GopPacketQueue::shutdown() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mShutdown = true;
+    }
+    mCond.notify_all();
+}
+
+void GopPacketQueue::reset() {
+    clear();
+    std::lock_guard<std::mutex> lk(mLock);
+    mShutdown = false;
+    mWaitKey = false;
+}
+
+void GopPacketQueue::clear() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mQueue.clear();
+    mBytes = 0;
+}
+
+PacketQueueStats GopPacketQueue::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    PacketQueueStats s = mStats;
+    s.packets = mQueue.size();
+    s.bytes = mBytes;
+    s.durationUs = mQueue.size() > 1 ? mQueue.back().enqueueUs - mQueue.front().enqueueUs : 0;
+    return s;
+}
+
+} // namespace otl
@@ -0,0 +1,80 @@
+#ifndef STREAM_PACKET_QUEUE_H
+#define STREAM_PACKET_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+struct PacketQueueParam {
+    size_t maxBytes{8 * 1024 * 1024};
+    int64_t maxDurationUs{3000000};  // newest arrival - oldest arrival; 0: no duration bound
+};
+
+struct QueuedPacket {
+    PacketHandle pkt;
+    int64_t enqueueUs;              // av_gettime_relative() of the push
+};
+
+struct PacketQueueStats {
+    size_t packets{0};
+    size_t bytes{0};
+    int64_t durationUs{0};
+    size_t highWaterBytes{0};
+    int64_t pushed{0};
+    int64_t droppedPackets{0};
+    int64_t droppedGops{0};
+};
+
+// Bounded queue between a producer and a network writer. When the writer falls behind past
+// maxBytes or maxDurationUs, whole GOPs are dropped from the head so what is left still starts
+// on a keyframe. If the queue only holds the GOP in progress, it is dropped too and packets are
+// refused until the next keyframe. Duration is measured on arrival time, so it needs no time
+// base and means the same for every stream.
+class GopPacketQueue {
+public:
+    explicit GopPacketQueue(const PacketQueueParam &param = PacketQueueParam()) : mParam(param) {}
+    ~GopPacketQueue() { clear(); }
+
+    void setParam(const PacketQueueParam &param);
+
+    // Takes ownership of pkt. false: dropped (overflow or waiting for a keyframe, or shut down).
+    bool push(AVPacket *pkt);
+    // Shares pkt, several queues can hold the same packet; it must not be modified any more.
+    bool push(PacketHandle pkt);
+    // timeoutMs < 0 waits. enqueueUs is the av_gettime_relative() of the push.
+    bool pop(PacketHandle &pkt, int64_t &enqueueUs, int timeoutMs);
+    // Waits like pop(), then moves everything queued to out (appended) under one lock.
+    // false on timeout, or once shut down and empty.
+    bool popAll(std::vector<QueuedPacket> &out, int timeoutMs);
+
+    // Drops what is queued and accepts packets again from the next keyframe on, e.g. after
+    // the consumer reconnected.
+    void restartAtKeyframe();
+    // Wakes up pop() and refuses pushes until reset().
+    void shutdown();
+    void reset();
+    void clear();
+
+    PacketQueueStats stats();
+
+private:
+    bool overLimit() const;
+    void dropFront(size_t count);
+
+    PacketQueueParam mParam;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<QueuedPacket> mQueue;
+    size_t mBytes{0};
+    bool mWaitKey{false};
+    bool mShutdown{false};
+    PacketQueueStats mStats;
+};
+
+} // namespace otl
+
+#endif // STREAM_PACKET_QUEUE_H
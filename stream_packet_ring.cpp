@@ -0,0 +1,219 @@
+#include "stream_packet_ring.h"
+
+#include <algorithm>
+
+namespace otl {
+
+PacketRingBuffer::PacketRingBuffer(const PacketRingParam &param) : mParam(param) {
+}
+
+PacketRingBuffer::~PacketRingBuffer() {
+    clear();
+    for (auto &par : mCodecpar) avcodec_parameters_free(&par);
+}
+
+void PacketRingBuffer::freeGop(Gop &gop) {
+    for (auto &pkt : gop.packets) av_packet_free(&pkt);
+    gop.packets.clear();
+}
+
+int PacketRingBuffer::setStreams(const AVFormatContext *ifmtCtx, int videoStream) {
+    std::lock_guard<std::mutex> lk(mLock);
+    for (auto &gop : mGops) freeGop(gop);
+    mGops.clear();
+    mBytes = 0;
+    for (auto &par : mCodecpar) avcodec_parameters_free(&par);
+    mCodecpar.assign(ifmtCtx->nb_streams, nullptr);
+    mTimeBase.assign(ifmtCtx->nb_streams, av_make_q(1, AV_TIME_BASE));
+
+    for (unsigned int i = 0; i < ifmtCtx->nb_streams; ++i) {
+        const AVStream *st = ifmtCtx->streams[i];
+        if (st->discard == AVDISCARD_ALL) continue;
+        mCodecpar[i] = avcodec_parameters_alloc();
+        if (mCodecpar[i] == nullptr || avcodec_parameters_copy(mCodecpar[i], st->codecpar) < 0) {
+            return AVERROR(ENOMEM);
+        }
+        mTimeBase[i] = st->time_base;
+    }
+    if (videoStream < 0 || videoStream >= (int)ifmtCtx->nb_streams || mCodecpar[videoStream] == nullptr) {
+        mVideoStream = -1;
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+    mVideoStream = videoStream;
+    mVideoTimeBase = mTimeBase[videoStream];
+    return 0;
+}
+
+void PacketRingBuffer::clear() {
+    std::lock_guard<std::mutex> lk(mLock);
+    for (auto &gop : mGops) freeGop(gop);
+    mGops.clear();
+    mBytes = 0;
+}
+
+int64_t PacketRingBuffer::packetUs(const AVPacket *pkt) const {
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    if (ts == AV_NOPTS_VALUE) return AV_NOPTS_VALUE;
+    return av_rescale_q(ts, mTimeBase[pkt->stream_index], av_make_q(1, AV_TIME_BASE));
+}
+
+void PacketRingBuffer::push(const AVPacket *pkt) {
+    std::lock_guard<std::mutex> lk(mLock);
+    int index = pkt->stream_index;
+    if (mVideoStream < 0 || index < 0 || index >= (int)mCodecpar.size() || mCodecpar[index] == nullptr) return;
+
+    int64_t t = packetUs(pkt);
+    if (index == mVideoStream && (pkt->flags & AV_PKT_FLAG_KEY)) {
+        // file loop or camera restart: the old GOPs are on another timeline
+        if (t != AV_NOPTS_VALUE && !mGops.empty() && mGops.back().startUs != AV_NOPTS_VALUE &&
+            t < mGops.back().startUs) {
+            for (auto &gop : mGops) freeGop(gop);
+            mGops.clear();
+            mBytes = 0;
+        }
+        mGops.emplace_back();
+        mGops.back().startUs = t;
+    } else if (mGops.empty()) {
+        // nothing before the first keyframe can be decoded
+        return;
+    }
+
+    AVPacket *copy = av_packet_clone(pkt);
+    if (copy == nullptr) return;
+    Gop &gop = mGops.back();
+    gop.packets.push_back(copy);
+    gop.bytes += copy->size;
+    mBytes += copy->size;
+    if (index == mVideoStream && t != AV_NOPTS_VALUE && (gop.endUs == AV_NOPTS_VALUE || t > gop.endUs)) {
+        gop.endUs = t;
+    }
+    evict();
+}
+
+void PacketRingBuffer::evict() {
+    // the oldest GOP goes only when the rest still covers the wanted pre-roll
+    while (mGops.size() > 1) {
+        int64_t newestUs = mGops.back().endUs;
+        int64_t nextStartUs = mGops[1].startUs;
+        bool overTime = mParam.maxDurationUs > 0 && newestUs != AV_NOPTS_VALUE && nextStartUs != AV_NOPTS_VALUE &&
+                        newestUs - nextStartUs >= mParam.maxDurationUs;
+        bool overBytes = mParam.maxBytes > 0 && mBytes > mParam.maxBytes;
+        if (!overTime && !overBytes) break;
+        mBytes -= mGops.front().bytes;
+        freeGop(mGops.front());
+        mGops.pop_front();
+        mEvicted++;
+    }
+}
+
+PacketRingStats PacketRingBuffer::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    PacketRingStats s;
+    s.gops = (int)mGops.size();
+    for (const auto &gop : mGops) s.packets += (int)gop.packets.size();
+    s.bytes = mBytes;
+    if (!mGops.empty() && mGops.front().startUs != AV_NOPTS_VALUE && mGops.back().endUs != AV_NOPTS_VALUE) {
+        s.durationUs = mGops.back().endUs - mGops.front().startUs;
+    }
+    s.evictedGops = mEvicted;
+    return s;
+}
+
+int PacketRingBuffer::dumpClip(int64_t startPts, int64_t endPts, const std::string &path) {
+    std::vector<AVPacket *> packets;
+    std::vector<AVCodecParameters *> codecpar;
+    std::vector<AVRational> timeBase;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mGops.empty()) return AVERROR(EAGAIN);
+        AVRational us = av_make_q(1, AV_TIME_BASE);
+        int64_t startUs = av_rescale_q(startPts, mVideoTimeBase, us);
+        int64_t endUs = av_rescale_q(endPts, mVideoTimeBase, us);
+
+        size_t first = 0;
+        for (size_t i = 0; i < mGops.size(); ++i) {
+            if (mGops[i].startUs != AV_NOPTS_VALUE && mGops[i].startUs <= startUs) first = i;
+        }
+        for (size_t i = first; i < mGops.size(); ++i) {
+            if (i > first && mGops[i].startUs != AV_NOPTS_VALUE && mGops[i].startUs > endUs) break;
+            for (const AVPacket *pkt : mGops[i].packets) {
+                // cut on dts: anything a frame up to endPts references is decoded before it
+                int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+                if (ts != AV_NOPTS_VALUE && av_rescale_q(ts, mTimeBase[pkt->stream_index], us) > endUs) continue;
+                AVPacket *copy = av_packet_clone(pkt);
+                if (copy) packets.push_back(copy);
+            }
+        }
+        for (auto par : mCodecpar) {
+            AVCodecParameters *p = nullptr;
+            if (par) {
+                p = avcodec_parameters_alloc();
+                if (p) avcodec_parameters_copy(p, par);
+            }
+            codecpar.push_back(p);
+        }
+        timeBase = mTimeBase;
+    }
+
+    AVFormatContext *ofmtCtx = nullptr;
+    std::vector<int> outIndex(codecpar.size(), -1);
+    int ret = avformat_alloc_output_context2(&ofmtCtx, nullptr, nullptr, path.c_str());
+    if (ret < 0 || ofmtCtx == nullptr) {
+        printf("PacketRingBuffer: no muxer for %s\n", path.c_str());
+        if (ret >= 0) ret = AVERROR_MUXER_NOT_FOUND;
+    }
+    for (size_t i = 0; ret >= 0 && i < codecpar.size(); ++i) {
+        if (codecpar[i] == nullptr) continue;
+        AVStream *out = avformat_new_stream(ofmtCtx, nullptr);
+        if (out == nullptr) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        ret = avcodec_parameters_copy(out->codecpar, codecpar[i]);
+        out->codecpar->codec_tag = 0;
+        out->time_base = timeBase[i];
+        outIndex[i] = out->index;
+    }
+    bool opened = false;
+    if (ret >= 0 && !(ofmtCtx->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&ofmtCtx->pb, path.c_str(), AVIO_FLAG_WRITE);
+        opened = ret >= 0;
+    }
+    if (ret >= 0) ret = avformat_write_header(ofmtCtx, nullptr);
+
+    if (ret >= 0) {
+        // the clip timeline starts at its first keyframe
+        int64_t originUs = 0;
+        if (!packets.empty()) {
+            const AVPacket *p = packets.front();
+            int64_t ts = p->dts != AV_NOPTS_VALUE ? p->dts : p->pts;
+            if (ts != AV_NOPTS_VALUE) originUs = av_rescale_q(ts, timeBase[p->stream_index], av_make_q(1, AV_TIME_BASE));
+        }
+        for (auto &pkt : packets) {
+            int in = pkt->stream_index;
+            AVRational tb = timeBase[in];
+            int64_t offset = av_rescale_q(originUs, av_make_q(1, AV_TIME_BASE), tb);
+            if (pkt->pts != AV_NOPTS_VALUE) pkt->pts -= offset;
+            if (pkt->dts != AV_NOPTS_VALUE) pkt->dts -= offset;
+            pkt->stream_index = outIndex[in];
+            av_packet_rescale_ts(pkt, tb, ofmtCtx->streams[outIndex[in]]->time_base);
+            pkt->pos = -1;
+            int wret = av_interleaved_write_frame(ofmtCtx, pkt);
+            if (wret < 0) {
+                ret = wret;
+                break;
+            }
+        }
+        int tret = av_write_trailer(ofmtCtx);
+        if (ret >= 0) ret = tret;
+    }
+
+    if (opened) avio_closep(&ofmtCtx->pb);
+    avformat_free_context(ofmtCtx);
+    for (auto &pkt : packets) av_packet_free(&pkt);
+    for (auto &par : codecpar) avcodec_parameters_free(&par);
+    if (ret < 0) printf("PacketRingBuffer: clip %s failed, ret=%d\n", path.c_str(), ret);
+    return ret < 0 ? ret : 0;
+}
+
+} // namespace otl
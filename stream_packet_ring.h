@@ -0,0 +1,72 @@
+#ifndef STREAM_PACKET_RING_H
+#define STREAM_PACKET_RING_H
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+struct PacketRingParam {
+    int64_t maxDurationUs{10 * AV_TIME_BASE};   // pre-roll kept, rounded up to whole GOPs
+    int64_t maxBytes{0};                        // hard cap on payload bytes, 0 = none
+};
+
+struct PacketRingStats {
+    int gops{0};
+    int packets{0};
+    int64_t bytes{0};
+    int64_t durationUs{0};
+    int64_t evictedGops{0};
+};
+
+// In-memory pre-event buffer of compressed packets. Packets are grouped by video GOP and the
+// oldest GOP is only dropped as a whole, so every clip starts on a keyframe. dumpClip() remuxes
+// a range to a file (container from the extension, e.g. .mp4 or .ts) without decoding.
+// push() is meant for the demux thread, dumpClip() for any other thread.
+class PacketRingBuffer {
+public:
+    explicit PacketRingBuffer(const PacketRingParam &param = PacketRingParam());
+    ~PacketRingBuffer();
+
+    // Takes the stream layout of a freshly opened input and empties the ring. Streams set to
+    // AVDISCARD_ALL are left out; videoStream's keyframes delimit the GOPs.
+    int setStreams(const AVFormatContext *ifmtCtx, int videoStream);
+    void push(const AVPacket *pkt);
+    void clear();
+
+    // [startPts, endPts] in the video stream time base. The clip starts at the last keyframe
+    // at or before startPts, or at the oldest buffered one.
+    int dumpClip(int64_t startPts, int64_t endPts, const std::string &path);
+
+    AVRational videoTimeBase() const { return mVideoTimeBase; }
+    PacketRingStats stats();
+
+private:
+    struct Gop {
+        std::vector<AVPacket *> packets;
+        int64_t startUs{AV_NOPTS_VALUE};
+        int64_t endUs{AV_NOPTS_VALUE};
+        int64_t bytes{0};
+    };
+
+    int64_t packetUs(const AVPacket *pkt) const;
+    void evict();
+    static void freeGop(Gop &gop);
+
+    PacketRingParam mParam;
+    std::mutex mLock;
+    std::deque<Gop> mGops;
+    std::vector<AVCodecParameters *> mCodecpar;     // nullptr for streams not kept
+    std::vector<AVRational> mTimeBase;
+    int mVideoStream{-1};
+    AVRational mVideoTimeBase{1, AV_TIME_BASE};
+    int64_t mBytes{0};
+    int64_t mEvicted{0};
+};
+
+} // namespace otl
+
+#endif // STREAM_PACKET_RING_H
@@ -0,0 +1,67 @@
+#ifndef STREAM_PROBE_CACHE_H
+#define STREAM_PROBE_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "otl_ffmpeg.h"
+
+namespace otl {
+
+struct ProbedStream {
+    AVMediaType type{AVMEDIA_TYPE_UNKNOWN};
+    AVCodecID codecId{AV_CODEC_ID_NONE};
+    int format{-1};
+    int width{0};
+    int height{0};
+    int profile{0};
+    int level{0};
+    int sampleRate{0};
+    int channels{0};
+    AVRational sampleAspectRatio{0, 1};
+    AVRational timeBase{0, 1};
+    AVRational avgFrameRate{0, 0};
+    AVRational rFrameRate{0, 0};
+    std::string extradata;
+};
+
+struct ProbeEntry {
+    std::vector<ProbedStream> streams;
+    int64_t probeUs{0};     // what avformat_find_stream_info cost when the entry was made
+    int hits{0};
+};
+
+// Results of avformat_find_stream_info() per URL, so reconnects and restarts can skip probing.
+// An entry is used only when the freshly opened context has the same streams, codecs, time
+// bases and (where the demuxer already knows it, e.g. from the SDP) the same extradata; cached
+// fields only fill what the demuxer left unset. Any mismatch drops the entry and probes again.
+class ProbeCache {
+public:
+    static ProbeCache &instance();
+
+    // true if ifmtCtx was completed from the cache and probing can be skipped
+    bool apply(const std::string &url, AVFormatContext *ifmtCtx);
+    void store(const std::string &url, const AVFormatContext *ifmtCtx, int64_t probeUs);
+    void invalidate(const std::string &url);
+    void clear();
+    size_t size();
+
+    // Persist across process restarts (cold start of many channels).
+    int save(const std::string &path);
+    int load(const std::string &path);
+
+private:
+    ProbeCache() = default;
+
+    static bool matches(const ProbeEntry &entry, const AVFormatContext *ifmtCtx);
+    static void fill(const ProbedStream &cached, AVStream *st);
+    static bool complete(const AVStream *st);
+
+    std::mutex mLock;
+    std::map<std::string, ProbeEntry> mEntries;
+};
+
+} // namespace otl
+
+#endif // STREAM_PROBE_CACHE_H
@@ -1,6 +1,8 @@
 #ifndef STREAM_PUSHER_H
 #define STREAM_PUSHER_H
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <thread>
 #include <queue>
@@ -11,11 +13,21 @@
 #include "timestamp_smoother.h"
 #include "otl_ffmpeg.h"
 #include "otl_thread_queue.h"
+#include "stream_packet_queue.h"
 
 
 
 namespace otl {
 
+    struct OutputerStats {
+        PacketQueueStats queue;
+        int64_t written{0};
+        int64_t writeErrors{0};
+        int64_t lastDelayUs{0};         // inputPacket() -> written to the muxer
+        int64_t avgDelayUs{0};
+        int64_t maxDelayUs{0};
+    };
+
     class FfmpegOutputer : public FfmpegGlobal {
         enum State {
             Init = 0, Service, Down
@@ -26,8 +38,13 @@ namespace otl {
         std::thread *m_threadOutput{nullptr};
         bool m_threadOutputIsRunning{false};
 
-        State m_outputState;
-        internal::BlockingQueue<AVPacket *> m_packetQueue;
+        // 关闭时由其他线程修改
+        std::atomic<State> m_outputState{Init};
+        // 对端变慢时按 GOP 丢弃，避免内存无限增长
+        GopPacketQueue m_packetQueue;
+        std::vector<QueuedPacket> m_batch;
+        std::mutex m_statsLock;
+        OutputerStats m_stats;
         bool m_repeat{true};
         TimestampSmoother m_timestampSmoother;
         
@@ -50,6 +67,9 @@ namespace otl {
                 }
             }
 
+            // packets are written in batches, the output is flushed once per batch
+            m_ofmtCtx->flush_packets = 0;
+
             AVDictionary *opts = NULL;
             if (stringStartWith(m_url, "rtsp://")) {
                 av_dict_set(&opts, "rtsp_transport", "tcp", 0);
@@ -64,20 +84,33 @@ namespace otl {
                 return -1;
             }
 
-            m_outputState = Service;
+            // closeOutputStream() may have asked for Down while we were connecting
+            State expected = Init;
+            m_outputState.compare_exchange_strong(expected, Service);
             return 0;
         }
 
         void outputService() {
-            int ret = 0;
-            AVPacket *pkt = nullptr;
-            
-            // Try to get a packet with a short timeout to allow for responsive shutdown
-            if (m_packetQueue.pop(pkt, 10)) { // 10ms timeout
+            // Blocks until packets arrive or closeOutputStream() shuts the queue down, then
+            // writes everything that queued up meanwhile in one go and flushes once.
+            m_batch.clear();
+            if (!m_packetQueue.popAll(m_batch, -1)) {
+                // only returns false once the queue is shut down, i.e. we are closing
+                m_outputState = Down;
+                return;
+            }
+
+            int written = 0, errors = 0;
+            int64_t delaySum = 0, delayMax = 0, delayLast = 0;
+            for (auto &qp : m_batch) {
+                AVPacket *pkt = qp.pkt.get();
+                // closing: whatever is left is dropped, not sent to a possibly stalled peer
+                if (m_outputState != Service) continue;
                 // 使用时间戳平滑器处理时间戳
                 if (m_timestampSmoother.smoothTimestamp(pkt)) {
-                    ret = av_interleaved_write_frame(m_ofmtCtx, pkt);
+                    int ret = av_interleaved_write_frame(m_ofmtCtx, pkt);
                     if (ret != 0) {
+                        errors++;
                         char errorBuf[256];
                         av_strerror(ret, errorBuf, sizeof(errorBuf));
                         std::cout << "av_interleaved_write_frame err: " << ret 
@@ -87,24 +120,36 @@ namespace otl {
                         if (ret == AVERROR(EINVAL)) {
                             m_timestampSmoother.printStatistics();
                         }
+                    } else {
+                        delayLast = av_gettime_relative() - qp.enqueueUs;
+                        delaySum += delayLast;
+                        delayMax = std::max(delayMax, delayLast);
+                        written++;
                     }
                 } else {
                     std::cout << "Failed to smooth timestamp for packet" << std::endl;
                 }
-                
-                av_packet_free(&pkt);
+            }
+            m_batch.clear();
+            if (written > 0 && m_ofmtCtx->pb) avio_flush(m_ofmtCtx->pb);
+
+            std::lock_guard<std::mutex> lk(m_statsLock);
+            m_stats.writeErrors += errors;
+            if (written > 0) {
+                m_stats.written += written;
+                m_stats.lastDelayUs = delayLast;
+                m_stats.maxDelayUs = std::max(m_stats.maxDelayUs, delayMax);
+                m_stats.avgDelayUs += (delaySum / written - m_stats.avgDelayUs) / 16;
             }
         }
 
         void outputDown() {
             if (m_repeat) {
-                m_outputState = Init;
+                State expected = Down;
+                m_outputState.compare_exchange_strong(expected, Init);
             } else {
-                // Process any remaining packets before shutdown
-                AVPacket *pkt = nullptr;
-                while (m_packetQueue.pop(pkt, 0)) { // Non-blocking pop to drain queue
-                    av_packet_free(&pkt);
-                }
+                // Drop any remaining packets before shutdown
+                m_packetQueue.clear();
                 
                 av_write_trailer(m_ofmtCtx);
                 if (!(m_ofmtCtx->oformat->flags & AVFMT_NOFILE)) {
@@ -149,24 +194,15 @@ namespace otl {
             int ret = 0;
             const char *formatName = NULL;
             m_url = url;
+            // a closed outputer is left Down with repeat off
+            m_outputState = Init;
+            m_repeat = true;
             
             // 重置时间戳平滑器
             m_timestampSmoother.reset();
 
-            if (stringStartWith(m_url, "rtsp://")) {
-                formatName = "rtsp";
-            } else if (stringStartWith(m_url, "udp://") || stringStartWith(m_url, "tcp://")) {
-                if (ifmtCtx && ifmtCtx->streams[0]->codecpar->codec_id == AV_CODEC_ID_H264)
-                    formatName = "h264";
-                else if(ifmtCtx && ifmtCtx->streams[0]->codecpar->codec_id == AV_CODEC_ID_HEVC)
-                    formatName = "hevc";
-                else
-                    formatName = "rawvideo";
-            } else if (stringStartWith(m_url, "rtp://")) {
-                formatName = "rtp";
-            } else if (stringStartWith(m_url, "rtmp://")) {
-                formatName = "flv";
-            } else {
+            formatName = outputFormatForUrl(m_url, ifmtCtx ? ifmtCtx->streams[0]->codecpar->codec_id : AV_CODEC_ID_NONE);
+            if (!formatName) {
                 std::cout << "Not support this Url:" << m_url << std::endl;
                 return -1;
             }
@@ -233,24 +269,15 @@ namespace otl {
             int ret = 0;
             const char *formatName = NULL;
             m_url = url;
+            // a closed outputer is left Down with repeat off
+            m_outputState = Init;
+            m_repeat = true;
 
             // 重置时间戳平滑器
             m_timestampSmoother.reset();
 
-            if (stringStartWith(m_url, "rtsp://")) {
-                formatName = "rtsp";
-            } else if (stringStartWith(m_url, "udp://") || stringStartWith(m_url, "tcp://")) {
-                if (codecpar->codec_id == AV_CODEC_ID_H264)
-                    formatName = "h264";
-                else if (codecpar->codec_id == AV_CODEC_ID_HEVC)
-                    formatName = "hevc";
-                else
-                    formatName = "rawvideo";
-            } else if (stringStartWith(m_url, "rtp://")) {
-                formatName = "rtp";
-            } else if (stringStartWith(m_url, "rtmp://")) {
-                formatName = "flv";
-            } else {
+            formatName = outputFormatForUrl(m_url, codecpar->codec_id);
+            if (!formatName) {
                 std::cout << "Not support this Url:" << m_url << std::endl;
                 return -1;
             }
@@ -308,11 +335,29 @@ namespace otl {
         }
 
 
+        // 0: queued; AVERROR(EAGAIN): dropped because the output is behind (whole GOPs are
+        // dropped, sending resumes with the next keyframe).
         int inputPacket(const AVPacket *pkt) {
             AVPacket *pkt1 = av_packet_alloc();
-            av_packet_ref(pkt1, pkt);
-            m_packetQueue.push(pkt1);
-            return 0;
+            if (!pkt1) return AVERROR(ENOMEM);
+            int ret = av_packet_ref(pkt1, pkt);
+            if (ret < 0) {
+                av_packet_free(&pkt1);
+                return ret;
+            }
+            return m_packetQueue.push(pkt1) ? 0 : AVERROR(EAGAIN);
+        }
+
+        // Bounds of the output queue, by bytes and by the arrival time span it holds.
+        void setOutputQueueParam(const PacketQueueParam &param) {
+            m_packetQueue.setParam(param);
+        }
+
+        OutputerStats getOutputStats() {
+            std::lock_guard<std::mutex> lk(m_statsLock);
+            OutputerStats s = m_stats;
+            s.queue = m_packetQueue.stats();
+            return s;
         }
         
         /**
@@ -0,0 +1,280 @@
+#include "stream_synth_source.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "stream_encoder.h"
+
+extern "C" {
+#include "libavutil/parseutils.h"
+}
+
+namespace otl {
+
+static const char *kSynthScheme = "otl-synth://";
+static const AVRational kMuxTimeBase = {1, 90000};
+
+struct SyntheticPacket {
+    std::string data;
+    int flags{0};
+};
+
+struct SyntheticClip {
+    std::vector<SyntheticPacket> packets;     // one GOP, starts with a keyframe
+    AVCodecParameters *codecpar{nullptr};
+
+    ~SyntheticClip() { avcodec_parameters_free(&codecpar); }
+};
+
+int SyntheticSourceParam::parse(const std::string &url, SyntheticSourceParam *param) {
+    if (!SyntheticInputSource::isSyntheticUrl(url)) return AVERROR(EINVAL);
+    size_t q = url.find('?');
+    if (q == std::string::npos) return 0;
+
+    size_t start = q + 1;
+    while (start < url.size()) {
+        size_t end = url.find('&', start);
+        if (end == std::string::npos) end = url.size();
+        std::string kv = url.substr(start, end - start);
+        start = end + 1;
+        size_t eq = kv.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = kv.substr(0, eq);
+        std::string value = kv.substr(eq + 1);
+        if (key == "codec") param->codec = value;
+        else if (key == "size") {
+            if (sscanf(value.c_str(), "%dx%d", &param->width, &param->height) != 2) return AVERROR(EINVAL);
+        } else if (key == "fps") {
+            if (av_parse_video_rate(&param->fps, value.c_str()) < 0) return AVERROR(EINVAL);
+        } else if (key == "gop") param->gop = atoi(value.c_str());
+        else if (key == "bitrate") param->bitRate = atoll(value.c_str());
+        else if (key == "realtime") param->realtime = atoi(value.c_str()) != 0;
+        else if (key == "jitter_ms") param->jitterMs = atoi(value.c_str());
+        else if (key == "loss") param->lossRate = atof(value.c_str());
+        else if (key == "disc_frames") param->discontinuityFrames = atoi(value.c_str());
+        else if (key == "disc_ms") param->discontinuityMs = atoll(value.c_str());
+        else if (key == "frames") param->frames = atoll(value.c_str());
+        else if (key == "seed") param->seed = (uint32_t)strtoul(value.c_str(), nullptr, 10);
+        else printf("otl-synth: unknown option %s\n", key.c_str());
+    }
+    if (param->width <= 0 || param->height <= 0 || param->fps.num <= 0 || param->fps.den <= 0 || param->gop <= 0) {
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+// Moving diagonal gradient plus a bouncing box, enough motion for realistic P frame sizes.
+static void drawPattern(AVFrame *frame, int index) {
+    int w = frame->width, h = frame->height;
+    for (int y = 0; y < h; ++y) {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < w; ++x) row[x] = (uint8_t)(x + y + index * 4);
+    }
+    int box = std::max(16, std::min(w, h) / 8);
+    int bx = (index * 8) % std::max(1, w - box);
+    int by = (index * 5) % std::max(1, h - box);
+    for (int y = by; y < by + box; ++y) memset(frame->data[0] + y * frame->linesize[0] + bx, 235, box);
+    for (int p = 1; p <= 2; ++p) {
+        for (int y = 0; y < (h + 1) / 2; ++y) {
+            memset(frame->data[p] + y * frame->linesize[p], 128 + (p == 1 ? 1 : -1) * (index % 32), (w + 1) / 2);
+        }
+    }
+}
+
+static std::shared_ptr<const SyntheticClip> buildClip(const SyntheticSourceParam &param) {
+    std::unique_ptr<StreamEncoder> encoder = CreateStreamEncoder(param.codec);
+    EncodeParam ep;
+    ep.codecName = param.codec;
+    ep.width = param.width;
+    ep.height = param.height;
+    ep.timeBase = av_inv_q(param.fps);
+    ep.frameRate = param.fps;
+    ep.bitRate = param.bitRate;
+    ep.gopSize = param.gop;
+    ep.maxBFrames = 0;          // the GOP is replayed in a loop, no frame may reference the next loop
+    ep.preferHardware = false;  // same bitstream on every machine
+    if (encoder->init(&ep) < 0) return nullptr;
+
+    AVFrame *frame = av_frame_alloc();
+    if (frame == nullptr) return nullptr;
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = param.width;
+    frame->height = param.height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    std::vector<PacketHandle> pkts;
+    for (int i = 0; i < param.gop; ++i) {
+        if (av_frame_make_writable(frame) < 0) break;
+        drawPattern(frame, i);
+        frame->pts = i;
+        frame->pict_type = i == 0 ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+        if (encoder->encode(frame, pkts) < 0) break;
+    }
+    encoder->encode(nullptr, pkts);
+    av_frame_free(&frame);
+
+    auto clip = std::make_shared<SyntheticClip>();
+    for (auto &pkt : pkts) {
+        SyntheticPacket sp;
+        sp.data.assign((const char *)pkt->data, pkt->size);
+        sp.flags = pkt->flags & AV_PKT_FLAG_KEY;
+        clip->packets.push_back(sp);
+    }
+    pkts.clear();
+    const AVCodecParameters *par = encoder->getCodecParameters();
+    clip->codecpar = avcodec_parameters_alloc();
+    if (par == nullptr || clip->codecpar == nullptr || avcodec_parameters_copy(clip->codecpar, par) < 0) return nullptr;
+    if (clip->packets.empty() || !(clip->packets[0].flags & AV_PKT_FLAG_KEY)) {
+        printf("otl-synth: %s encoder gave no leading keyframe\n", param.codec.c_str());
+        return nullptr;
+    }
+    return clip;
+}
+
+// Encoding is the expensive part, 200 channels with the same parameters share one clip.
+static std::shared_ptr<const SyntheticClip> sharedClip(const SyntheticSourceParam &param) {
+    static std::mutex lock;
+    static std::map<std::string, std::shared_ptr<const SyntheticClip>> clips;
+    char key[256];
+    snprintf(key, sizeof(key), "%s|%dx%d|%d/%d|%d|%lld", param.codec.c_str(), param.width, param.height,
+             param.fps.num, param.fps.den, param.gop, (long long)param.bitRate);
+
+    std::lock_guard<std::mutex> lk(lock);
+    auto it = clips.find(key);
+    if (it != clips.end()) return it->second;
+    auto clip = buildClip(param);
+    if (clip) clips[key] = clip;
+    return clip;
+}
+
+SyntheticInputSource::SyntheticInputSource(const SyntheticSourceParam &param)
+    : mParam(param), mRng(param.seed ? param.seed : std::random_device{}()) {
+}
+
+SyntheticInputSource::~SyntheticInputSource() {
+    close();
+}
+
+bool SyntheticInputSource::isSyntheticUrl(const std::string &url) {
+    return url.compare(0, strlen(kSynthScheme), kSynthScheme) == 0;
+}
+
+int SyntheticInputSource::open() {
+    close();
+
+    mClip = sharedClip(mParam);
+    if (!mClip) return AVERROR_ENCODER_NOT_FOUND;
+
+    int ret = avformat_alloc_output_context2(&mMuxCtx, nullptr, "mpegts", nullptr);
+    if (ret < 0 || mMuxCtx == nullptr) return ret < 0 ? ret : AVERROR_MUXER_NOT_FOUND;
+    AVStream *st = avformat_new_stream(mMuxCtx, nullptr);
+    if (st == nullptr) {
+        close();
+        return AVERROR(ENOMEM);
+    }
+    avcodec_parameters_copy(st->codecpar, mClip->codecpar);
+    st->time_base = kMuxTimeBase;
+
+    uint8_t *buffer = (uint8_t *)av_malloc(4096);
+    mMuxIo = buffer ? avio_alloc_context(buffer, 4096, 1, this, nullptr, writePacket, nullptr) : nullptr;
+    if (mMuxIo == nullptr) {
+        av_free(buffer);
+        close();
+        return AVERROR(ENOMEM);
+    }
+    mMuxCtx->pb = mMuxIo;
+    mMuxCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    ret = avformat_write_header(mMuxCtx, nullptr);
+    if (ret < 0) {
+        close();
+        return ret;
+    }
+
+    mFrame = 0;
+    mTsOffset = 0;
+    mStartClock = av_gettime_relative();
+    mStats = SyntheticSourceStats();
+    return 0;
+}
+
+void SyntheticInputSource::close() {
+    if (mMuxCtx != nullptr) {
+        avformat_free_context(mMuxCtx);
+        mMuxCtx = nullptr;
+    }
+    StreamInputSource::freeAVIOContext(&mMuxIo);
+    mPending.clear();
+    mPendingPos = 0;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int SyntheticInputSource::writePacket(void *opaque, const uint8_t *buf, int size) {
+#else
+int SyntheticInputSource::writePacket(void *opaque, uint8_t *buf, int size) {
+#endif
+    static_cast<SyntheticInputSource *>(opaque)->mPending.append((const char *)buf, size);
+    return size;
+}
+
+int SyntheticInputSource::read(uint8_t *buf, int size) {
+    if (mMuxCtx == nullptr) return AVERROR(EBADF);
+    while (mPendingPos >= mPending.size()) {
+        mPending.clear();
+        mPendingPos = 0;
+        int ret = produce();
+        if (ret < 0) return ret;
+    }
+    int n = (int)std::min<size_t>(size, mPending.size() - mPendingPos);
+    memcpy(buf, mPending.data() + mPendingPos, n);
+    mPendingPos += n;
+    return n;
+}
+
+int SyntheticInputSource::produce() {
+    if (mParam.frames > 0 && mFrame >= mParam.frames) return AVERROR_EOF;
+
+    int64_t frameTs = av_rescale_q(mFrame, av_inv_q(mParam.fps), kMuxTimeBase);
+    if (mParam.realtime) {
+        int64_t due = mStartClock + av_rescale_q(mFrame, av_inv_q(mParam.fps), av_make_q(1, AV_TIME_BASE));
+        if (mParam.jitterMs > 0) {
+            due += std::uniform_int_distribution<int64_t>(0, (int64_t)mParam.jitterMs * 1000)(mRng);
+        }
+        int64_t remain = due - av_gettime_relative();
+        if (remain > 0) av_usleep((unsigned)remain);
+    }
+
+    if (mParam.discontinuityFrames > 0 && mFrame > 0 && mFrame % mParam.discontinuityFrames == 0) {
+        mTsOffset += av_rescale_q(mParam.discontinuityMs, av_make_q(1, 1000), kMuxTimeBase);
+        mStats.discontinuities++;
+    }
+
+    const SyntheticPacket &sp = mClip->packets[mFrame % mClip->packets.size()];
+    mFrame++;
+    if (mParam.lossRate > 0 && std::uniform_real_distribution<double>(0, 1)(mRng) < mParam.lossRate) {
+        mStats.framesDropped++;
+        return 0;
+    }
+
+    AVPacket *pkt = av_packet_alloc();
+    if (pkt == nullptr || av_new_packet(pkt, (int)sp.data.size()) < 0) {
+        av_packet_free(&pkt);
+        return AVERROR(ENOMEM);
+    }
+    memcpy(pkt->data, sp.data.data(), sp.data.size());
+    pkt->flags = sp.flags;
+    pkt->stream_index = 0;
+    pkt->pts = pkt->dts = frameTs + mTsOffset;
+    pkt->duration = av_rescale_q(1, av_inv_q(mParam.fps), kMuxTimeBase);
+    int ret = av_write_frame(mMuxCtx, pkt);
+    av_packet_free(&pkt);
+    if (ret < 0) return ret;
+    avio_flush(mMuxIo);
+    mStats.framesSent++;
+    return 0;
+}
+
+} // namespace otl
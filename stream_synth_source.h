@@ -0,0 +1,80 @@
+#ifndef STREAM_SYNTH_SOURCE_H
+#define STREAM_SYNTH_SOURCE_H
+
+#include <memory>
+#include <random>
+#include <string>
+#include "stream_input_source.h"
+
+namespace otl {
+
+// otl-synth://?codec=h264&size=1280x720&fps=25&gop=50&bitrate=2000000&jitter_ms=0&loss=0
+//             &disc_frames=0&disc_ms=10000&frames=0&realtime=1&seed=0
+struct SyntheticSourceParam {
+    std::string codec{"h264"};          // h264, hevc or any encoder name CreateStreamEncoder takes
+    int width{1280};
+    int height{720};
+    AVRational fps{25, 1};
+    int gop{50};
+    int64_t bitRate{2000000};
+    bool realtime{true};                // release frames at their timestamps like a camera
+    int jitterMs{0};                    // random extra delay per frame, 0..jitterMs
+    double lossRate{0};                 // probability a frame is dropped before muxing
+    int discontinuityFrames{0};         // every N frames the timestamps jump forward
+    int64_t discontinuityMs{10000};
+    int64_t frames{0};                  // EOF after this many frames, 0 = endless
+    uint32_t seed{0};                   // 0 = random per source
+
+    static int parse(const std::string &url, SyntheticSourceParam *param);
+};
+
+struct SyntheticSourceStats {
+    int64_t framesSent{0};
+    int64_t framesDropped{0};
+    int64_t discontinuities{0};
+};
+
+struct SyntheticClip;
+
+// Camera stand-in for load tests without network or media files: one GOP of a moving test
+// pattern is encoded once per parameter set (shared by every source using it) and replayed
+// endlessly as MPEG-TS with fresh timestamps, optionally with jitter, frame loss and timestamp
+// jumps. StreamDemuxer uses it for otl-synth:// URLs.
+class SyntheticInputSource : public StreamInputSource {
+public:
+    explicit SyntheticInputSource(const SyntheticSourceParam &param);
+    virtual ~SyntheticInputSource();
+
+    static bool isSyntheticUrl(const std::string &url);
+
+    int open() override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    const char *formatName() const override { return "mpegts"; }
+
+    SyntheticSourceStats stats() const { return mStats; }
+
+private:
+    int produce();
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+    static int writePacket(void *opaque, const uint8_t *buf, int size);
+#else
+    static int writePacket(void *opaque, uint8_t *buf, int size);
+#endif
+
+    SyntheticSourceParam mParam;
+    std::shared_ptr<const SyntheticClip> mClip;
+    AVFormatContext *mMuxCtx{nullptr};
+    AVIOContext *mMuxIo{nullptr};
+    std::string mPending;
+    size_t mPendingPos{0};
+    int64_t mFrame{0};
+    int64_t mTsOffset{0};
+    int64_t mStartClock{0};
+    std::mt19937 mRng;
+    SyntheticSourceStats mStats;
+};
+
+} // namespace otl
+
+#endif // STREAM_SYNTH_SOURCE_H
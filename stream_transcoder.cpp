@@ -0,0 +1,210 @@
+#include "stream_transcoder.h"
+
+#include <algorithm>
+
+namespace otl {
+
+static const char* TAG = "StreamTranscoder";
+
+StreamTranscoder::StreamTranscoder(const TranscodeParam &param, OnPacketFunc onPacket)
+    : mParam(param), mOnPacket(onPacket) {
+    mRefFrame = av_frame_alloc();
+}
+
+StreamTranscoder::~StreamTranscoder() {
+    mEncoder.reset();
+    av_frame_free(&mRefFrame);
+    for (auto f : mPool) av_frame_free(&f);
+    sws_freeContext(mSws);
+}
+
+AVPixelFormat StreamTranscoder::negotiatePixFmt(AVPixelFormat srcFmt) {
+    std::vector<AVPixelFormat> fmts;
+    if (mEncoder->querySupportedPixFmts(mEncodeParam, fmts) < 0 || fmts.empty()) {
+        return srcFmt;
+    }
+    auto has = [&](AVPixelFormat f) { return std::find(fmts.begin(), fmts.end(), f) != fmts.end(); };
+    if (has(srcFmt)) return srcFmt;
+    // both are what decoders commonly hand out, one of them is a cheap repack of the other
+    if (has(AV_PIX_FMT_NV12)) return AV_PIX_FMT_NV12;
+    if (has(AV_PIX_FMT_YUV420P)) return AV_PIX_FMT_YUV420P;
+    return fmts[0];
+}
+
+int StreamTranscoder::openEncoder(const AVFrame *frame) {
+    mEncodeParam = mParam.encode;
+    AVPixelFormat srcFmt = (AVPixelFormat)frame->format;
+    if (frame->hw_frames_ctx) {
+        srcFmt = ((AVHWFramesContext*)frame->hw_frames_ctx->data)->sw_format;
+    }
+    if (mEncodeParam.width <= 0 || mEncodeParam.height <= 0) {
+        mEncodeParam.width = frame->width;
+        mEncodeParam.height = frame->height;
+    }
+
+    mEncoder = CreateStreamEncoder(mEncodeParam.codecName);
+    if (mEncodeParam.pixFmt == AV_PIX_FMT_NONE) mEncodeParam.pixFmt = negotiatePixFmt(srcFmt);
+    int ret = mEncoder->init(&mEncodeParam);
+    if (ret < 0) {
+        OTL_LOGE(TAG, "encoder open failed: %d", ret);
+        mEncoder.reset();
+        return ret;
+    }
+    // the caller's options dictionary is not needed past init
+    mEncodeParam.options = nullptr;
+    mStats.encodePixFmt = mEncodeParam.pixFmt;
+    OTL_LOGI(TAG, "decoder %s %dx%d -> encoder %s %dx%d", av_get_pix_fmt_name(srcFmt),
+             frame->width, frame->height, av_get_pix_fmt_name(mEncodeParam.pixFmt),
+             mEncodeParam.width, mEncodeParam.height);
+    return 0;
+}
+
+AVFrame *StreamTranscoder::acquireFrame(int width, int height, AVPixelFormat fmt, const AVFrame *inUse) {
+    AVFrame *spare = nullptr;
+    for (auto f : mPool) {
+        if (f == inUse) continue;
+        // a frame the encoder still references is not writable
+        if (!av_frame_is_writable(f)) continue;
+        if (f->width == width && f->height == height && f->format == fmt) return f;
+        if (!spare) spare = f;
+    }
+
+    AVFrame *f = spare;
+    if (f) {
+        av_frame_unref(f);
+    } else {
+        f = av_frame_alloc();
+        if (!f) return nullptr;
+        mPool.push_back(f);
+    }
+    f->width = width;
+    f->height = height;
+    f->format = fmt;
+    if (av_frame_get_buffer(f, 0) < 0) {
+        mPool.erase(std::find(mPool.begin(), mPool.end(), f));
+        av_frame_free(&f);
+        return nullptr;
+    }
+    return f;
+}
+
+int StreamTranscoder::encodeFrame(AVFrame *frame) {
+    int ret = mEncoder->encode(frame, mPackets);
+    for (auto &pkt : mPackets) {
+        mStats.packets++;
+        if (mOnPacket) mOnPacket(pkt.get());
+    }
+    mPackets.clear();
+    if (ret < 0) mStats.errors++;
+    return ret;
+}
+
+int StreamTranscoder::pushFrame(const AVFrame *frame, AVRational srcTimeBase) {
+    if (!frame) return AVERROR(EINVAL);
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mFlushed) return AVERROR_EOF;
+    if (!mEncoder) {
+        // a failed open is not retried per frame
+        if (mOpenError < 0) return mOpenError;
+        int ret = openEncoder(frame);
+        if (ret < 0) {
+            mOpenError = ret;
+            return ret;
+        }
+    }
+    mStats.frames++;
+
+    const AVFrame *src = frame;
+    AVFrame *owned = nullptr;
+    if (frame->hw_frames_ctx) {
+        AVPixelFormat swFmt = ((AVHWFramesContext*)frame->hw_frames_ctx->data)->sw_format;
+        owned = acquireFrame(frame->width, frame->height, swFmt);
+        int ret = owned ? av_hwframe_transfer_data(owned, frame, 0) : AVERROR(ENOMEM);
+        if (ret < 0) {
+            mStats.errors++;
+            return ret;
+        }
+        mStats.downloaded++;
+        src = owned;
+    }
+
+    const int w = mEncodeParam.width, h = mEncodeParam.height;
+    const AVPixelFormat fmt = mEncodeParam.pixFmt;
+    AVFrame *out;
+    if (src->width == w && src->height == h && src->format == fmt) {
+        if (owned) {
+            out = owned;
+        } else {
+            int ret = av_frame_ref(mRefFrame, src);
+            if (ret < 0) {
+                mStats.errors++;
+                return ret;
+            }
+            out = mRefFrame;
+        }
+        mStats.passthrough++;
+    } else {
+        out = acquireFrame(w, h, fmt, owned);
+        mSws = sws_getCachedContext(mSws, src->width, src->height, (AVPixelFormat)src->format,
+                                    w, h, fmt, mParam.swsFlags, nullptr, nullptr, nullptr);
+        if (!out || !mSws) {
+            mStats.errors++;
+            return out ? AVERROR(EINVAL) : AVERROR(ENOMEM);
+        }
+        sws_scale(mSws, src->data, src->linesize, 0, src->height, out->data, out->linesize);
+        mStats.converted++;
+    }
+    if (out != mRefFrame) {
+        // pooled frames only carry what the encoder looks at, not the decoder's side data
+        out->color_range = frame->color_range;
+        out->colorspace = frame->colorspace;
+        out->color_primaries = frame->color_primaries;
+        out->color_trc = frame->color_trc;
+        out->sample_aspect_ratio = frame->sample_aspect_ratio;
+    }
+
+    int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+    if (pts != AV_NOPTS_VALUE) pts = av_rescale_q(pts, srcTimeBase, mEncoder->getTimeBase());
+    // encoders reject pts that don't increase, a reconnect may start the source over
+    if (mLastPts != AV_NOPTS_VALUE && (pts == AV_NOPTS_VALUE || pts <= mLastPts)) pts = mLastPts + 1;
+    if (pts == AV_NOPTS_VALUE) pts = 0;
+    mLastPts = pts;
+    out->pts = pts;
+    // the source GOP must not leak into the encoder's
+    out->pict_type = AV_PICTURE_TYPE_NONE;
+
+    int ret = encodeFrame(out);
+    if (out == mRefFrame) av_frame_unref(mRefFrame);
+    return ret;
+}
+
+int StreamTranscoder::requestKeyFrame() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mEncoder ? mEncoder->requestKeyFrame() : 0;
+}
+
+int StreamTranscoder::flush() {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mFlushed) return 0;
+    mFlushed = true;
+    return mEncoder ? encodeFrame(nullptr) : 0;
+}
+
+const AVCodecParameters *StreamTranscoder::getCodecParameters() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mEncoder ? mEncoder->getCodecParameters() : nullptr;
+}
+
+AVRational StreamTranscoder::getTimeBase() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mEncoder ? mEncoder->getTimeBase() : mParam.encode.timeBase;
+}
+
+TranscodeStats StreamTranscoder::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    TranscodeStats s = mStats;
+    s.pooledFrames = (int)mPool.size();
+    return s;
+}
+
+} // namespace otl
@@ -0,0 +1,85 @@
+#ifndef STREAM_TRANSCODER_H
+#define STREAM_TRANSCODER_H
+
+#include "stream_encoder.h"
+#include <functional>
+#include <mutex>
+
+namespace otl {
+    struct TranscodeParam {
+        // width/height 为 0 时沿用首帧尺寸；pixFmt 为 AV_PIX_FMT_NONE 时与解码输出协商
+        EncodeParam encode;
+        int swsFlags{SWS_BILINEAR};
+
+        TranscodeParam() { encode.pixFmt = AV_PIX_FMT_NONE; }
+    };
+
+    struct TranscodeStats {
+        int64_t frames{0};
+        int64_t passthrough{0};         // handed to the encoder by reference
+        int64_t converted{0};           // scaled or pixel format converted
+        int64_t downloaded{0};          // hw surfaces copied to system memory first
+        int64_t packets{0};
+        int64_t errors{0};
+        AVPixelFormat encodePixFmt{AV_PIX_FMT_NONE};
+        int pooledFrames{0};
+    };
+
+    // Decoded frames straight into a StreamEncoder. The encoder is opened on the first frame
+    // with a pixel format negotiated against what the decoder outputs, so NV12 or YUV420P
+    // reach the encoder as a reference to the decoder's buffer. Only frames whose size or
+    // format don't match are converted, into pooled frames that are reused once the encoder
+    // lets go of them.
+    class StreamTranscoder {
+    public:
+        // pkt 仅在回调期间有效
+        using OnPacketFunc = std::function<void(AVPacket *pkt)>;
+
+        StreamTranscoder(const TranscodeParam &param, OnPacketFunc onPacket);
+        ~StreamTranscoder();
+
+        // Installs the decoded frame callback of a StreamDecoder (sw or hw build).
+        template <class Decoder>
+        void attach(Decoder &decoder) {
+            decoder.setDecodedFrameCallback([this, &decoder](const AVPacket *pkt, const AVFrame *frame) {
+                (void)pkt;
+                pushFrame(frame, decoder.getTimeBase());
+            });
+        }
+
+        // frame pts are in srcTimeBase. frame is not modified.
+        int pushFrame(const AVFrame *frame, AVRational srcTimeBase);
+        int requestKeyFrame();
+        // Drains the encoder; frames pushed afterwards fail with AVERROR_EOF.
+        int flush();
+
+        // nullptr until the first frame has opened the encoder.
+        const AVCodecParameters *getCodecParameters();
+        AVRational getTimeBase();
+        TranscodeStats stats();
+
+    private:
+        int openEncoder(const AVFrame *frame);
+        AVPixelFormat negotiatePixFmt(AVPixelFormat srcFmt);
+        // inUse: pooled frame the current conversion reads from
+        AVFrame *acquireFrame(int width, int height, AVPixelFormat fmt, const AVFrame *inUse = nullptr);
+        int encodeFrame(AVFrame *frame);
+
+        TranscodeParam mParam;
+        OnPacketFunc mOnPacket;
+        std::unique_ptr<StreamEncoder> mEncoder;
+        std::vector<PacketHandle> mPackets;
+
+        std::mutex mLock;
+        EncodeParam mEncodeParam;       // 实际打开编码器的参数
+        bool mFlushed{false};
+        int mOpenError{0};
+        int64_t mLastPts{AV_NOPTS_VALUE};
+        AVFrame *mRefFrame{nullptr};    // 直通时引用解码帧
+        std::vector<AVFrame*> mPool;    // 转换/下载目标帧
+        SwsContext *mSws{nullptr};
+        TranscodeStats mStats;
+    };
+}
+
+#endif //STREAM_TRANSCODER_H
@@ -0,0 +1,140 @@
+#include "stream_fanout.h"
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+using namespace otl;
+
+static const int kFrames = 60;
+
+static std::vector<PacketHandle> encodePackets(StreamEncoder &enc, const EncodeParam &p)
+{
+    std::vector<PacketHandle> out;
+    for (int i = 0; i <= kFrames; ++i) {
+        AVFrame *f = nullptr;
+        if (i < kFrames) {
+            f = av_frame_alloc();
+            f->width = p.width;
+            f->height = p.height;
+            f->format = p.pixFmt;
+            int ret = av_frame_get_buffer(f, 32);
+            assert(ret == 0);
+            for (int y = 0; y < p.height; ++y) memset(f->data[0] + y * f->linesize[0], (y + i * 4) & 0xff, p.width);
+            for (int y = 0; y < p.height / 2; ++y) {
+                memset(f->data[1] + y * f->linesize[1], 0x80, p.width / 2);
+                memset(f->data[2] + y * f->linesize[2], 0x80, p.width / 2);
+            }
+            f->pts = (int64_t)i * 3000;
+        }
+        // the last round flushes
+        int ret = enc.encode(f, out);
+        av_frame_free(&f);
+        assert(ret >= 0);
+    }
+    return out;
+}
+
+static bool waitState(StreamFanout &fanout, int id, FanoutSinkState state)
+{
+    for (int i = 0; i < 500; ++i) {
+        for (auto &s : fanout.stats()) {
+            if (s.id == id && s.state == state) return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+static int64_t writtenBy(StreamFanout &fanout, int id)
+{
+    for (auto &s : fanout.stats()) {
+        if (s.id == id) return s.written;
+    }
+    return -1;
+}
+
+// The file must have been finished (mp4 moov written by the trailer) to open at all.
+static int countPackets(const char *path)
+{
+    AVFormatContext *ifmtCtx = nullptr;
+    int ret = avformat_open_input(&ifmtCtx, path, nullptr, nullptr);
+    if (ret < 0) return ret;
+    ret = avformat_find_stream_info(ifmtCtx, nullptr);
+    assert(ret >= 0);
+    assert(ifmtCtx->nb_streams == 1 && ifmtCtx->streams[0]->codecpar->width == 320);
+    AVPacket *pkt = av_packet_alloc();
+    int packets = 0;
+    while (av_read_frame(ifmtCtx, pkt) >= 0) {
+        packets++;
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&ifmtCtx);
+    return packets;
+}
+
+static void test_file_sinks_finished_on_stop()
+{
+    EncodeParam p;
+    p.codecName = "mpeg4";
+    p.width = 320;
+    p.height = 240;
+    p.timeBase = {1, 90000};
+    p.frameRate = {30, 1};
+    p.gopSize = 30;
+    p.maxBFrames = 0;
+    p.preferHardware = false;
+    auto enc = CreateStreamEncoder(p.codecName);
+    int ret = enc->init(&p);
+    assert(ret == 0);
+    std::vector<PacketHandle> pkts = encodePackets(*enc, p);
+    assert((int)pkts.size() == kFrames);
+
+    const char *removed = "test_fanout_removed.mp4";
+    const char *closed = "test_fanout_closed.mp4";
+    StreamFanout fanout;
+    ret = fanout.open(enc->getCodecParameters(), enc->getTimeBase());
+    assert(ret == 0);
+    FanoutSinkParam sp;
+    sp.url = removed;
+    int a = fanout.addSink(sp);
+    sp.url = closed;
+    int b = fanout.addSink(sp);
+    assert(a >= 0 && b >= 0);
+    // packets are only queued once a sink is connected
+    bool ok = waitState(fanout, a, FanoutSinkState::Streaming) && waitState(fanout, b, FanoutSinkState::Streaming);
+    assert(ok);
+
+    for (auto &pkt : pkts) {
+        ret = fanout.inputPacket(pkt.get());
+        assert(ret == 2);
+    }
+    for (int i = 0; i < 500 && (writtenBy(fanout, a) < kFrames || writtenBy(fanout, b) < kFrames); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(writtenBy(fanout, a) == kFrames && writtenBy(fanout, b) == kFrames);
+
+    // both ways of stopping a sink write the trailer
+    ret = fanout.removeSink(a);
+    assert(ret == 0);
+    fanout.close();
+
+    int packets = countPackets(removed);
+    printf("removed sink: %d packets\n", packets);
+    assert(packets == kFrames);
+    packets = countPackets(closed);
+    printf("closed sink: %d packets\n", packets);
+    assert(packets == kFrames);
+    remove(removed);
+    remove(closed);
+    printf("test_file_sinks_finished_on_stop ok\n");
+}
+
+int main()
+{
+    test_file_sinks_finished_on_stop();
+    printf("fanout tests PASSED\n");
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include "otl_frame_tensor.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+using namespace otl;
+
+struct YuvImage {
+    int width, height;
+    std::vector<uint8_t> y, u, v, uv;   // u/v for yuv420p, uv interleaved for nv12
+
+    YuvImage(int w, int h) : width(w), height(h),
+        y((size_t)w * h), u((size_t)((w + 1) / 2) * ((h + 1) / 2)),
+        v(u.size()), uv(u.size() * 2) {}
+
+    void fill(uint8_t Y, uint8_t U, uint8_t V) {
+        memset(y.data(), Y, y.size());
+        memset(u.data(), U, u.size());
+        memset(v.data(), V, v.size());
+        for (size_t i = 0; i < u.size(); ++i) { uv[2 * i] = U; uv[2 * i + 1] = V; }
+    }
+
+    int convertI420(FrameTensorConverter &conv, void *dst) {
+        const uint8_t *planes[3] = {y.data(), u.data(), v.data()};
+        const int linesizes[3] = {width, (width + 1) / 2, (width + 1) / 2};
+        return conv.convert(planes, linesizes, AV_PIX_FMT_YUV420P, width, height, false, false, dst);
+    }
+
+    int convertNV12(FrameTensorConverter &conv, void *dst) {
+        const uint8_t *planes[3] = {y.data(), uv.data(), nullptr};
+        const int linesizes[3] = {width, ((width + 1) / 2) * 2, 0};
+        return conv.convert(planes, linesizes, AV_PIX_FMT_NV12, width, height, false, false, dst);
+    }
+};
+
+static bool near(float a, float b, float eps = 0.01f) { return std::fabs(a - b) <= eps; }
+
+static void test_gray_letterbox()
+{
+    TensorParam p;
+    p.width = 32; p.height = 32;
+    p.dataType = TensorDataType::Float32;
+    p.letterbox = true;
+    p.padValue = 114;
+    FrameTensorConverter conv;
+    int rc = conv.init(p);
+    assert(rc == 0);
+
+    YuvImage img(64, 32);    // 2:1 -> content 32x16, 8 rows of padding top and bottom
+    img.fill(128, 128, 128);
+    std::vector<float> out(conv.tensorBytes() / sizeof(float));
+    rc = img.convertI420(conv, out.data());
+    assert(rc == 0);
+
+    const TensorLayout &l = conv.layout();
+    assert(l.contentWidth == 32 && l.contentHeight == 16);
+    assert(l.padLeft == 0 && l.padTop == 8);
+
+    float gray = (128 - 16) * 1.164384f;
+    for (int c = 0; c < 3; ++c) {
+        const float *plane = out.data() + c * 32 * 32;
+        assert(near(plane[0], 114.f));                   // top padding
+        assert(near(plane[31 * 32 + 31], 114.f));        // bottom padding
+        assert(near(plane[8 * 32], gray));               // first content row
+        assert(near(plane[23 * 32 + 31], gray));         // last content row
+    }
+    printf("test_gray_letterbox ok\n");
+}
+
+static void test_nv12_matches_i420()
+{
+    TensorParam p;
+    p.width = 37; p.height = 21;    // odd sizes exercise the scalar tail
+    p.letterbox = false;
+    p.mean[0] = 123.675f; p.mean[1] = 116.28f; p.mean[2] = 103.53f;
+    p.std[0] = 58.395f;   p.std[1] = 57.12f;   p.std[2] = 57.375f;
+    FrameTensorConverter conv;
+    int rc = conv.init(p);
+    assert(rc == 0);
+
+    YuvImage img(90, 50);
+    for (int yy = 0; yy < img.height; ++yy)
+        for (int xx = 0; xx < img.width; ++xx)
+            img.y[yy * img.width + xx] = (uint8_t)(16 + (xx * 3 + yy * 2) % 220);
+    for (size_t i = 0; i < img.u.size(); ++i) {
+        img.u[i] = (uint8_t)(60 + i % 120);
+        img.v[i] = (uint8_t)(200 - i % 130);
+        img.uv[2 * i] = img.u[i];
+        img.uv[2 * i + 1] = img.v[i];
+    }
+
+    std::vector<float> a(conv.tensorBytes() / sizeof(float)), b(a.size());
+    rc = img.convertI420(conv, a.data());
+    assert(rc == 0);
+    rc = img.convertNV12(conv, b.data());
+    assert(rc == 0);
+    for (size_t i = 0; i < a.size(); ++i) assert(near(a[i], b[i], 1e-5f));
+    printf("test_nv12_matches_i420 ok\n");
+}
+
+// Bilinear sample of a w x h plane at destination index d of dstLen, pixel-centre aligned.
+static float sampleRef(const std::vector<uint8_t> &plane, int w, int h, int dstW, int dstH, int dx, int dy)
+{
+    auto coord = [](int d, int dstLen, int srcLen, int &i0, int &i1, float &f) {
+        float s = (d + 0.5f) * srcLen / dstLen - 0.5f;
+        if (s < 0.f) s = 0.f;
+        i0 = std::min((int)s, srcLen - 1);
+        i1 = std::min(i0 + 1, srcLen - 1);
+        f = s - (float)i0;
+    };
+    int x0, x1, y0, y1;
+    float fx, fy;
+    coord(dx, dstW, w, x0, x1, fx);
+    coord(dy, dstH, h, y0, y1, fy);
+    float a = plane[y0 * w + x0] * (1 - fx) + plane[y0 * w + x1] * fx;
+    float b = plane[y1 * w + x0] * (1 - fx) + plane[y1 * w + x1] * fx;
+    return a * (1 - fy) + b * fy;
+}
+
+// U ramps horizontally and V vertically across the whole picture, checked pixel by pixel
+// against a scalar BT.601 reference, unscaled and downscaled.
+static void test_chroma_gradient()
+{
+    YuvImage img(64, 64);
+    const int cw = 32, ch = 32;
+    for (int yy = 0; yy < img.height; ++yy)
+        for (int xx = 0; xx < img.width; ++xx)
+            img.y[yy * img.width + xx] = (uint8_t)(40 + xx + yy);
+    for (int yy = 0; yy < ch; ++yy) {
+        for (int xx = 0; xx < cw; ++xx) {
+            int i = yy * cw + xx;
+            img.u[i] = (uint8_t)(16 + xx * 7);
+            img.v[i] = (uint8_t)(16 + yy * 7);
+            img.uv[2 * i] = img.u[i];
+            img.uv[2 * i + 1] = img.v[i];
+        }
+    }
+
+    const int sizes[2] = {64, 32};
+    for (int dst : sizes) {
+        TensorParam p;
+        p.width = dst; p.height = dst;
+        p.letterbox = false;
+        FrameTensorConverter conv;
+        int rc = conv.init(p);
+        assert(rc == 0);
+        std::vector<float> out(conv.tensorBytes() / sizeof(float)), nv12(out.size());
+        rc = img.convertI420(conv, out.data());
+        assert(rc == 0);
+        rc = img.convertNV12(conv, nv12.data());
+        assert(rc == 0);
+
+        const int plane = dst * dst;
+        for (int dy = 0; dy < dst; ++dy) {
+            for (int dx = 0; dx < dst; ++dx) {
+                float Y = sampleRef(img.y, img.width, img.height, dst, dst, dx, dy);
+                float U = sampleRef(img.u, cw, ch, dst, dst, dx, dy) - 128.f;
+                float V = sampleRef(img.v, cw, ch, dst, dst, dx, dy) - 128.f;
+                float yy = (Y - 16.f) * 1.164384f;
+                float ref[3] = {yy + 1.596027f * V, yy - 0.391762f * U - 0.812968f * V, yy + 2.017232f * U};
+                int i = dy * dst + dx;
+                for (int c = 0; c < 3; ++c) {
+                    float r = std::min(255.f, std::max(0.f, ref[c]));
+                    assert(near(out[c * plane + i], r, 0.05f));
+                    assert(near(nv12[c * plane + i], r, 0.05f));
+                }
+            }
+        }
+    }
+    printf("test_chroma_gradient ok\n");
+}
+
+static void test_bgr_and_uint8()
+{
+    TensorParam p;
+    p.width = 18; p.height = 10;
+    p.letterbox = false;
+    p.colorOrder = TensorColorOrder::RGB;
+    FrameTensorConverter rgb;
+    int rc = rgb.init(p);
+    assert(rc == 0);
+    p.colorOrder = TensorColorOrder::BGR;
+    FrameTensorConverter bgr;
+    rc = bgr.init(p);
+    assert(rc == 0);
+    p.dataType = TensorDataType::Uint8;
+    FrameTensorConverter bgr8;
+    rc = bgr8.init(p);
+    assert(rc == 0);
+
+    YuvImage img(36, 20);
+    img.fill(81, 90, 240);   // BT.601 red
+    std::vector<float> outRgb(rgb.tensorBytes() / sizeof(float)), outBgr(outRgb.size());
+    std::vector<uint8_t> outBgr8(bgr8.tensorBytes());
+    rc = img.convertI420(rgb, outRgb.data());
+    assert(rc == 0);
+    rc = img.convertI420(bgr, outBgr.data());
+    assert(rc == 0);
+    rc = img.convertI420(bgr8, outBgr8.data());
+    assert(rc == 0);
+
+    const int plane = 18 * 10;
+    assert(outRgb[0] > 200.f && outRgb[2 * plane] < 60.f);   // red dominates
+    for (int i = 0; i < plane; ++i) {
+        assert(near(outRgb[i], outBgr[2 * plane + i]));
+        assert(near(outRgb[2 * plane + i], outBgr[i]));
+        for (int c = 0; c < 3; ++c) {
+            assert(std::fabs(outBgr8[c * plane + i] - outBgr[c * plane + i]) <= 0.5f + 1e-3f);
+        }
+    }
+    printf("test_bgr_and_uint8 ok\n");
+}
+
+static void test_invalid()
+{
+    FrameTensorConverter conv;
+    TensorParam p;
+    int rc = conv.init(p);
+    assert(rc != 0);                     // zero size
+    p.width = 8; p.height = 8; p.std[1] = 0.f;
+    rc = conv.init(p);
+    assert(rc != 0);                     // division by zero
+    p.std[1] = 1.f;
+    rc = conv.init(p);
+    assert(rc == 0);
+    std::vector<float> out(conv.tensorBytes() / sizeof(float));
+    uint8_t dummy[16] = {0};
+    const uint8_t *planes[3] = {dummy, dummy, dummy};
+    const int linesizes[3] = {4, 2, 2};
+    rc = conv.convert(planes, linesizes, AV_PIX_FMT_BGR24, 4, 4, false, false, out.data());
+    assert(rc < 0);
+    printf("test_invalid ok\n");
+}
+
+int main()
+{
+    test_gray_letterbox();
+    test_nv12_matches_i420();
+    test_chroma_gradient();
+    test_bgr_and_uint8();
+    test_invalid();
+    printf("frame tensor tests PASSED\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "stream_jitter_buffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+using namespace otl;
+
+static AVPacket *makePacket(int64_t dts, int streamIndex = 0)
+{
+    AVPacket *pkt = av_packet_alloc();
+    pkt->pts = pkt->dts = dts;
+    pkt->stream_index = streamIndex;
+    return pkt;
+}
+
+// 25 fps delivered in bursts of 5 packets every 200 ms: once the delay has adapted, the
+// packets come out evenly spaced again
+static void test_burst_smoothing()
+{
+    std::vector<int64_t> released;
+    std::mutex lock;
+    JitterBuffer jb(JitterBufferParam(), [&](AVPacket *) {
+        std::lock_guard<std::mutex> lk(lock);
+        released.push_back(av_gettime_relative());
+    });
+    for (int burst = 0; burst < 20; ++burst) {
+        for (int i = 0; i < 5; ++i) {
+            jb.push(makePacket((burst * 5 + i) * 40), true, av_make_q(1, 1000));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    JitterBufferStats s = jb.stats();
+    assert(s.jitterUs > 0 && s.targetDelayUs > JitterBufferParam().minDelayUs);
+    assert(s.targetDelayUs <= JitterBufferParam().maxLatencyUs);
+    assert(s.discontinuities == 0);
+
+    std::lock_guard<std::mutex> lk(lock);
+    assert(released.size() > 60);
+    int64_t minGap = INT64_MAX, maxGap = 0;
+    // the first 3 seconds are warm-up
+    for (size_t i = 60; i < released.size(); ++i) {
+        int64_t gap = released[i] - released[i - 1];
+        minGap = std::min(minGap, gap);
+        maxGap = std::max(maxGap, gap);
+    }
+    printf("test_burst_smoothing: gaps %lld..%lld us, target %lld us\n",
+           (long long)minGap, (long long)maxGap, (long long)s.targetDelayUs);
+    assert(minGap > 30000 && maxGap < 50000);
+    printf("test_burst_smoothing ok\n");
+}
+
+static void test_stop_flush_and_fifo()
+{
+    JitterBufferParam p;
+    p.minDelayUs = 1000000;
+    p.maxLatencyUs = 2000000;
+    std::vector<int> order;
+    JitterBuffer jb(p, [&](AVPacket *pkt) { order.push_back(pkt->stream_index); });
+    // other streams keep their place behind the timing stream
+    jb.push(makePacket(0, 0), true, av_make_q(1, 1000));
+    jb.push(makePacket(0, 1), false, av_make_q(1, 1000));
+    jb.push(makePacket(40, 0), true, av_make_q(1, 1000));
+    // a dts jump restarts the schedule
+    jb.push(makePacket(40 + 5000, 0), true, av_make_q(1, 1000));
+    assert(jb.stats().queued == 4);
+    assert(jb.stats().discontinuities == 1);
+
+    jb.stop(true);
+    assert(order.size() == 4 && order[0] == 0 && order[1] == 1 && order[2] == 0);
+    JitterBufferStats s = jb.stats();
+    assert(s.released == 4 && s.queued == 0);
+
+    // dropped once stopped
+    jb.push(makePacket(80, 0), true, av_make_q(1, 1000));
+    assert(jb.stats().queued == 0 && order.size() == 4);
+    printf("test_stop_flush_and_fifo ok\n");
+}
+
+int main()
+{
+    test_burst_smoothing();
+    test_stop_flush_and_fifo();
+    printf("jitter buffer tests PASSED\n");
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "stream_packet_queue.h"
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+
+using namespace otl;
+
+static AVPacket *makePacket(int64_t pts, bool key, int size = 100)
+{
+    AVPacket *pkt = av_packet_alloc();
+    pkt->pts = pkt->dts = pts;
+    pkt->size = size;
+    pkt->flags = key ? AV_PKT_FLAG_KEY : 0;
+    return pkt;
+}
+
+static int64_t frontPts(GopPacketQueue &q)
+{
+    PacketHandle pkt;
+    int64_t enqueueUs = 0;
+    bool ok = q.pop(pkt, enqueueUs, 0);
+    assert(ok);
+    return pkt->pts;
+}
+
+static void test_bytes_drop_head_gop()
+{
+    PacketQueueParam p;
+    p.maxBytes = 1000;
+    p.maxDurationUs = 0;
+    GopPacketQueue q(p);
+    // GOPs of 4: 0..3, 4..7, 8..11; the 11th packet goes over 1000 bytes
+    for (int i = 0; i < 12; ++i) {
+        bool kept = q.push(makePacket(i, i % 4 == 0));
+        assert(kept);
+    }
+    PacketQueueStats s = q.stats();
+    assert(s.packets == 8 && s.bytes == 800);
+    assert(s.droppedGops == 1 && s.droppedPackets == 4);
+    assert(s.pushed == 12);
+    assert(frontPts(q) == 4);    // still starts on a keyframe
+    printf("test_bytes_drop_head_gop ok\n");
+}
+
+static void test_duration_drop_head_gop()
+{
+    PacketQueueParam p;
+    p.maxBytes = 0;
+    p.maxDurationUs = 30000;
+    GopPacketQueue q(p);
+    bool kept = q.push(makePacket(0, true));
+    assert(kept);
+    kept = q.push(makePacket(1, false));
+    assert(kept);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    kept = q.push(makePacket(2, true));
+    assert(kept);
+
+    PacketQueueStats s = q.stats();
+    assert(s.packets == 1 && s.droppedGops == 1 && s.droppedPackets == 2);
+    assert(frontPts(q) == 2);
+    printf("test_duration_drop_head_gop ok\n");
+}
+
+static void test_gop_in_progress_and_wait_key()
+{
+    PacketQueueParam p;
+    p.maxBytes = 1000;
+    p.maxDurationUs = 0;
+    GopPacketQueue q(p);
+    bool kept = q.push(makePacket(0, true));
+    assert(kept);
+    for (int i = 1; i < 10; ++i) {
+        kept = q.push(makePacket(i, false));
+        assert(kept);
+    }
+    // the only GOP no longer fits: it is dropped as a whole, including this packet
+    kept = q.push(makePacket(10, false));
+    assert(!kept);
+    PacketQueueStats s = q.stats();
+    assert(s.packets == 0 && s.bytes == 0);
+    assert(s.droppedGops == 1 && s.droppedPackets == 11);
+
+    // refused until the next keyframe
+    kept = q.push(makePacket(11, false));
+    assert(!kept);
+    kept = q.push(makePacket(12, false));
+    assert(!kept);
+    s = q.stats();
+    assert(s.packets == 0 && s.droppedPackets == 13);
+
+    kept = q.push(makePacket(13, true));
+    assert(kept);
+    kept = q.push(makePacket(14, false));
+    assert(kept);
+    s = q.stats();
+    assert(s.packets == 2);
+    assert(frontPts(q) == 13);
+    printf("test_gop_in_progress_and_wait_key ok\n");
+}
+
+static void test_restart_and_shutdown()
+{
+    GopPacketQueue q;
+    bool kept = q.push(makePacket(0, true));
+    assert(kept);
+    q.restartAtKeyframe();
+    assert(q.stats().packets == 0);
+    kept = q.push(makePacket(1, false));
+    assert(!kept);
+    kept = q.push(makePacket(2, true));
+    assert(kept);
+
+    // shared packets: two queues hold the same one
+    GopPacketQueue other;
+    PacketHandle shared(makePacket(3, true), [](AVPacket *pkt) { av_packet_free(&pkt); });
+    kept = q.push(shared);
+    assert(kept);
+    kept = other.push(shared);
+    assert(kept);
+    assert(shared.use_count() == 3);
+
+    std::vector<QueuedPacket> batch;
+    bool ok = q.popAll(batch, 0);
+    assert(ok && batch.size() == 2 && batch[0].pkt->pts == 2 && batch[1].pkt->pts == 3);
+
+    // pop() blocked in another thread is woken up by shutdown()
+    std::thread t([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        q.shutdown();
+    });
+    PacketHandle pkt;
+    int64_t enqueueUs = 0;
+    ok = q.pop(pkt, enqueueUs, -1);
+    assert(!ok);
+    t.join();
+    kept = q.push(makePacket(4, true));
+    assert(!kept);
+
+    // what was queued before shutdown is still handed out
+    other.shutdown();
+    ok = other.pop(pkt, enqueueUs, -1);
+    assert(ok && pkt->pts == 3);
+    ok = other.pop(pkt, enqueueUs, -1);
+    assert(!ok);
+    printf("test_restart_and_shutdown ok\n");
+}
+
+int main()
+{
+    test_bytes_drop_head_gop();
+    test_duration_drop_head_gop();
+    test_gop_in_progress_and_wait_key();
+    test_restart_and_shutdown();
+    printf("packet queue tests PASSED\n");
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include "stream_encoder.h"
+#include "stream_async_encoder.h"
+#include "stream_multi_encoder.h"
+#include "stream_encoder_pool.h"
 #include "otl_log.h"
 #include <vector>
 #include <string>
@@ -60,18 +63,24 @@ static int encode_frames(StreamEncoder& enc, int frames, int w, int h, AVPixelFo
     return totalPkts;
 }
 
-static bool test_functional(const std::string& codec)
-{
-    OTL_LOGI("TEST", "Functional test codec=%s", codec.c_str());
-    auto enc = CreateStreamEncoder(codec);
+// Software path at 30 fps and 90 kHz, the settings every test below starts from.
+static EncodeParam make_param(const std::string& codec, int w = 320, int h = 240, int gop = 30) {
     EncodeParam p;
     p.codecName = codec;
-    p.width = 320; p.height = 240;
+    p.width = w; p.height = h;
     p.timeBase = {1, 90000};
     p.frameRate = {30, 1};
     p.pixFmt = AV_PIX_FMT_YUV420P;
-    p.gopSize = 30; p.maxBFrames = 0;
+    p.gopSize = gop; p.maxBFrames = 0;
     p.preferHardware = false; // tests use SW path for stability across environments
+    return p;
+}
+
+static bool test_functional(const std::string& codec)
+{
+    OTL_LOGI("TEST", "Functional test codec=%s", codec.c_str());
+    auto enc = CreateStreamEncoder(codec);
+    EncodeParam p = make_param(codec);
 
     if (enc->init(&p) < 0) {
         OTL_LOGW("TEST", "init failed for codec=%s (may be unavailable)", codec.c_str());
@@ -96,15 +105,8 @@ static bool test_performance(const std::string& codec)
 {
     OTL_LOGI("TEST", "Performance test codec=%s", codec.c_str());
     auto enc = CreateStreamEncoder(codec);
-    EncodeParam p;
-    p.codecName = codec;
-    p.width = 1280; p.height = 720;
-    p.timeBase = {1, 90000};
-    p.frameRate = {30, 1};
-    p.pixFmt = AV_PIX_FMT_YUV420P;
-    p.gopSize = 60; p.maxBFrames = 0;
+    EncodeParam p = make_param(codec, 1280, 720, 60);
     p.bitRate = 3'000'000;
-    p.preferHardware = false; // stabilize perf test across CI/macOS environments
 
     if (enc->init(&p) < 0) {
         OTL_LOGW("TEST", "perf init failed for codec=%s (skip)", codec.c_str());
@@ -121,6 +123,199 @@ static bool test_performance(const std::string& codec)
     return pkts > 0;
 }
 
+static bool test_async(const std::string& codec)
+{
+    OTL_LOGI("TEST", "Async test codec=%s", codec.c_str());
+    EncodeParam p = make_param(codec);
+
+    AsyncEncodeParam ap;
+    ap.queueSize = 4;
+    ap.policy = EncodeOverloadPolicy::Block;
+    AsyncStreamEncoder enc(CreateStreamEncoder(codec), ap);
+    int pkts = 0;
+    bool firstKey = false;
+    enc.setPacketCallback([&](AVPacket* pkt) {
+        if (pkts++ == 0) firstKey = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+    });
+    if (enc.init(&p) < 0) {
+        OTL_LOGW("TEST", "async init failed for codec=%s (skip)", codec.c_str());
+        return true;
+    }
+
+    const int N = 30;
+    for (int i = 0; i < N; ++i) {
+        AVFrame* f = make_test_frame(p.width, p.height, p.pixFmt, i * 3000);
+        if (!f) return false;
+        // the encoder holds its own reference, the caller frees right away
+        int ret = enc.submit(f);
+        av_frame_free(&f);
+        if (ret < 0) { OTL_LOGE("TEST", "submit failed: %d", ret); return false; }
+    }
+    enc.flush();
+    AVFrame* late = make_test_frame(p.width, p.height, p.pixFmt, N * 3000);
+    int lateRet = late ? enc.submit(late) : AVERROR_EOF;
+    av_frame_free(&late);
+    if (lateRet != AVERROR_EOF) { OTL_LOGE("TEST", "submit after flush should fail"); return false; }
+
+    AsyncEncodeStats st = enc.stats();
+    OTL_LOGI("TEST", "async: encoded=%lld packets=%d dropped=%lld avg=%.2fms",
+             (long long)st.encoded, pkts, (long long)st.dropped, st.avgEncodeMs);
+    return st.encoded == N && st.dropped == 0 && pkts == N && firstKey;
+}
+
+static bool test_packet_api(const std::string& codec)
+{
+    OTL_LOGI("TEST", "Packet API test codec=%s", codec.c_str());
+    auto pool = PacketPool::create(4);
+    AVPacket* raw = nullptr;
+    {
+        PacketHandle a = pool->acquire();
+        raw = a.get();
+    }
+    PacketHandle b = pool->acquire();
+    if (b.get() != raw) { OTL_LOGE("TEST", "pool did not recycle the packet"); return false; }
+    b.reset();
+
+    auto enc = CreateStreamEncoder(codec);
+    EncodeParam p = make_param(codec);
+    if (enc->init(&p) < 0) return true;
+
+    // send/receive into one caller owned packet
+    AVPacket* pkt = av_packet_alloc();
+    int received = 0;
+    for (int i = 0; i <= 10; ++i) {
+        AVFrame* f = i < 10 ? make_test_frame(p.width, p.height, p.pixFmt, i * 3000) : nullptr;
+        if (enc->send(f) < 0) { av_frame_free(&f); av_packet_free(&pkt); return false; }
+        av_frame_free(&f);
+        while (enc->receive(pkt) == 0) ++received;
+    }
+    av_packet_free(&pkt);
+    OTL_LOGI("TEST", "send/receive packets=%d", received);
+    return received == 10;
+}
+
+static bool test_multi_rendition(const std::string& codec)
+{
+    OTL_LOGI("TEST", "Multi rendition test codec=%s", codec.c_str());
+    MultiRenditionParam mp;
+    mp.base = make_param(codec, 0, 0, 10);
+    mp.renditions = {{0, 640, 360, 0}, {1, 320, 180, 0}, {2, 160, 90, 0}};
+
+    MultiRenditionEncoder enc;
+    // keyframe positions per rendition, they have to match for switching
+    std::vector<std::vector<int64_t>> keys(3);
+    std::vector<int> pkts(3, 0);
+    int ret = enc.init(mp, [&](int id, AVPacket* pkt) {
+        pkts[id]++;
+        if (pkt->flags & AV_PKT_FLAG_KEY) keys[id].push_back(pkt->pts);
+    });
+    if (ret < 0) {
+        OTL_LOGW("TEST", "multi rendition init failed for codec=%s (skip)", codec.c_str());
+        return true;
+    }
+
+    const int N = 30;
+    for (int i = 0; i < N; ++i) {
+        AVFrame* f = make_test_frame(1280, 720, mp.base.pixFmt, i * 3000);
+        if (!f) return false;
+        if (i == 15) enc.requestKeyFrame();
+        ret = enc.encode(f);
+        av_frame_free(&f);
+        if (ret < 0) { OTL_LOGE("TEST", "multi encode failed: %d", ret); return false; }
+    }
+    enc.flush();
+
+    for (auto &s : enc.stats()) {
+        OTL_LOGI("TEST", "rendition %d: frames=%lld packets=%lld scale=%.2fms encode=%.2fms",
+                 s.id, (long long)s.frames, (long long)s.packets, s.avgScaleMs, s.avgEncodeMs);
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (pkts[i] != N) return false;
+        if (keys[i] != keys[0]) { OTL_LOGE("TEST", "rendition %d keyframes not aligned", i); return false; }
+    }
+    return true;
+}
+
+static bool test_reconfigure(const std::string& codec)
+{
+    OTL_LOGI("TEST", "Reconfigure test codec=%s", codec.c_str());
+    auto enc = CreateStreamEncoder(codec);
+    EncodeParam p = make_param(codec);
+    p.bitRate = 800000;
+    if (enc->init(&p) < 0) return true;
+
+    EncodeReconfig bad;
+    bad.bitRate = 0;
+    if (enc->reconfigure(bad) != AVERROR(EINVAL)) return false;
+
+    std::vector<int64_t> keys;
+    std::vector<PacketHandle> pkts;
+    for (int i = 0; i <= 60; ++i) {
+        if (i == 5) {
+            EncodeReconfig rate;
+            rate.bitRate = 400000;
+            rate.maxRate = 400000;
+            enc->reconfigure(rate);
+        }
+        if (i == 10) {
+            EncodeReconfig gop;
+            gop.gopSize = 15;
+            enc->reconfigure(gop);
+        }
+        AVFrame* f = i < 60 ? make_test_frame(p.width, p.height, p.pixFmt, i * 3000) : nullptr;
+        int ret = enc->encode(f, pkts);
+        av_frame_free(&f);
+        if (ret < 0) return false;
+    }
+    for (auto &pkt : pkts) {
+        if (pkt->flags & AV_PKT_FLAG_KEY) keys.push_back(pkt->pts / 3000);
+    }
+    // no extra IDR for either change, the new GOP starts on the old one's boundary
+    std::vector<int64_t> expect = {0, 30, 45};
+    OTL_LOGI("TEST", "reconfigure: packets=%zu keys=%zu", pkts.size(), keys.size());
+    return pkts.size() == 60 && keys == expect;
+}
+
+static bool test_encoder_pool(const std::string& codec)
+{
+    OTL_LOGI("TEST", "Encoder pool test codec=%s", codec.c_str());
+    EncodeParam p = make_param(codec);
+
+    EncoderPool pool;
+    if (pool.addProfile("cif", p, 1, 1) < 0) return true;
+
+    StreamEncoder* first = nullptr;
+    {
+        EncoderLease a = pool.acquire("cif");
+        if (!a) return false;
+        first = a.get();
+        // the only session is out
+        if (pool.acquire(p, 50)) { OTL_LOGE("TEST", "second lease should time out"); return false; }
+        std::vector<PacketHandle> pkts;
+        for (int i = 0; i < 5; ++i) {
+            AVFrame* f = make_test_frame(p.width, p.height, p.pixFmt, i * 3000);
+            a->encode(f, pkts);
+            av_frame_free(&f);
+        }
+    }
+
+    EncoderLease b = pool.acquire(p, 50);
+    if (!b || b.get() != first) { OTL_LOGE("TEST", "session was not reused"); return false; }
+    // a reset session starts the next user on an IDR
+    std::vector<PacketHandle> pkts;
+    AVFrame* f = make_test_frame(p.width, p.height, p.pixFmt, 0);
+    b->encode(f, pkts);
+    b->encode(nullptr, pkts);
+    av_frame_free(&f);
+    b.release();
+
+    EncoderPoolStats st = pool.stats()[0];
+    OTL_LOGI("TEST", "pool: sessions=%d leases=%lld timeouts=%lld util=%.2f",
+             st.sessions, (long long)st.leases, (long long)st.timeouts, st.utilization);
+    return !pkts.empty() && (pkts[0]->flags & AV_PKT_FLAG_KEY) && st.sessions == 1 &&
+           st.leases == 2 && st.timeouts == 1 && st.leased == 0;
+}
+
 static bool test_exceptions()
 {
     OTL_LOGI("TEST", "Exception tests");
@@ -135,7 +330,7 @@ static bool test_exceptions()
     // 2) invalid size
     {
         auto enc = CreateStreamEncoder("h264");
-        EncodeParam p; p.codecName = "h264"; p.width = 0; p.height = 0; p.pixFmt = AV_PIX_FMT_YUV420P; p.preferHardware = false;
+        EncodeParam p = make_param("h264", 0, 0);
         int ret = enc->init(&p);
         if (ret >= 0) { OTL_LOGE("TEST", "init with invalid size should fail"); return false; }
     }
@@ -143,7 +338,7 @@ static bool test_exceptions()
     // 3) unknown codec
     {
         auto enc = CreateStreamEncoder("this_codec_does_not_exist");
-        EncodeParam p; p.codecName = "this_codec_does_not_exist"; p.width = 320; p.height = 240; p.pixFmt = AV_PIX_FMT_YUV420P; p.preferHardware = false;
+        EncodeParam p = make_param("this_codec_does_not_exist");
         int ret = enc->init(&p);
         if (ret >= 0) { OTL_LOGE("TEST", "init should fail for unknown codec"); return false; }
     }
@@ -161,13 +356,19 @@ static bool test_exceptions()
 
 int main()
 {
-    OTL_INIT_LOG("stream_encoder_test");
+    otl::log::LogConfig cfg; cfg.targets = otl::log::OutputTarget::Console; cfg.level = otl::log::LOG_INFO; cfg.enableConsole = true; cfg.queueSize = 1024;
+    otl::log::init(cfg);
 
     std::vector<std::string> codecs = {"h264", "hevc", "mjpeg"};
 
     bool ok = true;
     for (auto &c : codecs) ok = test_functional(c) && ok;
     for (auto &c : codecs) ok = test_performance(c) && ok;
+    for (auto &c : codecs) ok = test_async(c) && ok;
+    for (auto &c : codecs) ok = test_packet_api(c) && ok;
+    for (auto &c : codecs) ok = test_multi_rendition(c) && ok;
+    ok = test_reconfigure("h264") && ok;
+    for (auto &c : codecs) ok = test_encoder_pool(c) && ok;
     ok = test_exceptions() && ok;
 
     if (!ok) {
@@ -0,0 +1,71 @@
+#include "stream_pusher.h"
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+using namespace otl;
+
+// raw h264 over udp: no receiver is needed and the muxer takes any bytes
+static const char *kUrl = "udp://127.0.0.1:23456";
+
+static void pushPackets(FfmpegOutputer &out, int first, int count)
+{
+    static const uint8_t nal[] = {0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00, 0x33};
+    for (int i = first; i < first + count; ++i) {
+        AVPacket *pkt = av_packet_alloc();
+        int ret = av_new_packet(pkt, sizeof(nal));
+        assert(ret == 0);
+        memcpy(pkt->data, nal, sizeof(nal));
+        pkt->pts = pkt->dts = (int64_t)i * 3000;
+        pkt->flags = AV_PKT_FLAG_KEY;
+        ret = out.inputPacket(pkt);
+        assert(ret == 0);
+        av_packet_free(&pkt);
+    }
+}
+
+static bool waitWritten(FfmpegOutputer &out, int64_t written)
+{
+    for (int i = 0; i < 300; ++i) {
+        if (out.getOutputStats().written >= written) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+static void test_open_close_reopen()
+{
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    par->codec_type = AVMEDIA_TYPE_VIDEO;
+    par->codec_id = AV_CODEC_ID_H264;
+    par->width = 320;
+    par->height = 240;
+
+    FfmpegOutputer out;
+    int ret = out.openOutputStreamWithCodec(kUrl, par, AVRational{1, 90000});
+    assert(ret == 0);
+    pushPackets(out, 0, 10);
+    bool ok = waitWritten(out, 10);
+    assert(ok);
+    out.closeOutputStream();
+
+    // a closed outputer streams again once reopened
+    ret = out.openOutputStreamWithCodec(kUrl, par, AVRational{1, 90000});
+    assert(ret == 0);
+    pushPackets(out, 10, 10);
+    ok = waitWritten(out, 20);
+    assert(ok);
+    out.closeOutputStream();
+
+    avcodec_parameters_free(&par);
+    printf("test_open_close_reopen ok\n");
+}
+
+int main()
+{
+    test_open_close_reopen();
+    printf("stream pusher tests PASSED\n");
+    return 0;
+}
@@ -100,6 +100,64 @@ static void test_light_queue_shutdown_reset()
     assert(ok && v == 7);
 }
 
+static void test_spsc_wrap_full_empty()
+{
+    SpscQueue<int> q(5);                 // rounded up to 8
+    assert(q.capacity() == 8);
+    int v = -1;
+    bool ok = q.tryPop(v);
+    assert(!ok && v == -1);              // empty
+
+    // several laps so head/tail wrap around the ring
+    int next = 0, expect = 0;
+    for (int lap = 0; lap < 5; ++lap) {
+        for (int i = 0; i < 8; ++i) {
+            int item = next++;
+            ok = q.tryPush(std::move(item));
+            assert(ok);
+        }
+        assert(q.size() == 8);
+        int extra = 1000;
+        ok = q.tryPush(std::move(extra));
+        assert(!ok && extra == 1000);   // full, item untouched
+        for (int i = 0; i < 5; ++i) {
+            ok = q.tryPop(v);
+            assert(ok && v == expect++);
+        }
+        for (int i = 0; i < 3; ++i) {
+            ok = q.tryPop(v);
+            assert(ok && v == expect++);
+        }
+        assert(q.size() == 0);
+        ok = q.tryPop(v);
+        assert(!ok);
+    }
+}
+
+static void test_spsc_two_threads()
+{
+    SpscQueue<int> q(64);
+    const int N = 1000000;
+    std::thread producer([&] {
+        for (int i = 0; i < N; ++i) {
+            int item = i;
+            while (!q.tryPush(std::move(item))) std::this_thread::yield();
+        }
+    });
+    // every item arrives exactly once and in order
+    int expect = 0, v = 0;
+    while (expect < N) {
+        if (q.tryPop(v)) {
+            assert(v == expect);
+            ++expect;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    assert(q.size() == 0);
+}
+
 int main()
 {
     // init logging minimal
@@ -114,6 +172,9 @@ int main()
     test_light_queue_basic();
     test_light_queue_shutdown_reset();
 
+    test_spsc_wrap_full_empty();
+    test_spsc_two_threads();
+
     otl::log::deinit();
     return 0;
 }